@@ -51,10 +51,27 @@ typedef enum SLINPUT_KeyCode {
   SLINPUT_KC_BACKSPACE,
   SLINPUT_KC_ESCAPE,
   SLINPUT_KC_END_OF_TRANSMISSION,
+  SLINPUT_KC_UNDO,
+  SLINPUT_KC_REDO,
+  SLINPUT_KC_KILL_TO_START,
+  SLINPUT_KC_KILL_TO_END,
+  SLINPUT_KC_KILL_WORD,
+  SLINPUT_KC_YANK,
+  SLINPUT_KC_YANK_POP,
+  SLINPUT_KC_SEARCH_BACKWARD,
+  SLINPUT_KC_SEARCH_FUZZY,
 
   SLINPUT_KC_MAX
 } SLINPUT_KeyCode;
 
+/**
+ * Encodings in which lines saved into history are stored.
+ */
+typedef enum SLINPUT_HistoryEncoding {
+  SLINPUT_HE_NATIVE,
+  SLINPUT_HE_UTF8
+} SLINPUT_HistoryEncoding;
+
 /**
  * Cursor control codes used by SLINPUT_CursorControl.
  */
@@ -69,6 +86,8 @@ typedef enum SLINPUT_CursorControlCode {
   SLINPUT_CCC_CLEAR_LINE,
   SLINPUT_CCC_WRAP_ON,
   SLINPUT_CCC_WRAP_OFF,
+  SLINPUT_CCC_DIM_ON,
+  SLINPUT_CCC_DIM_OFF,
 
   SLINPUT_CCC_MAX
 } SLINPUT_CursorControlCode;
@@ -106,12 +125,43 @@ typedef struct SLINPUT_CompletionInfo {
   void *completion_info_data;  /**< Pointer to data for implementation */
 } SLINPUT_CompletionInfo;
 
+/**
+ * Task runner information passed as a parameter to SLINPUT_RunTasks.
+ * Specified using a parameter to SLINPUT_Set_RunTasks.
+ */
+typedef struct SLINPUT_TaskInfo {
+  void *task_info_data;  /**< Pointer to data for implementation */
+} SLINPUT_TaskInfo;
+
 /**
  * State structure created by SLINPUT_CreateState and destroyed by
  * SLINPUT_DestroyState. Passed as parameter to functions and callbacks.
  */
 typedef struct SLINPUT_State SLINPUT_State;
 
+/**
+ * History shared between states, created by SLINPUT_CreateSharedHistory and
+ * attached by SLINPUT_AttachSharedHistory.
+ */
+typedef struct SLINPUT_SharedHistory SLINPUT_SharedHistory;
+
+/**
+ * A line in history found by SLINPUT_MatchHistory or SLINPUT_FrecentHistory.
+ */
+typedef struct SLINPUT_HistoryMatch {
+  size_t age;  /**< Number of lines in history newer than the line */
+  long score;  /**< Score of the match, higher is better */
+} SLINPUT_HistoryMatch;
+
+/**
+ * A line in history as stored by the state, found by SLINPUT_ViewHistory.
+ */
+typedef struct SLINPUT_HistoryView {
+  const void *text;  /**< The stored text, not nil terminated */
+  size_t num_bytes;  /**< Number of bytes of text */
+  SLINPUT_HistoryEncoding encoding;  /**< Encoding of the text */
+} SLINPUT_HistoryView;
+
 /**
  * Allocates memory.
  * @param[in] alloc_info allocation information that was passed to
@@ -268,6 +318,35 @@ typedef int SLINPUT_CompletionRequest(
   SLINPUT_CompletionInfo completion_info,
   sli_ushort string_length, const sli_char *string);
 
+/**
+ * A task passed to SLINPUT_RunTasks.
+ * @param[in] task_data the task data passed to SLINPUT_RunTasks.
+ * @param[in] task_index the index of the task, less than num_tasks.
+ */
+typedef void SLINPUT_Task(void *task_data, size_t task_index);
+
+/**
+ * Callback to run tasks, used to search history in shards. Each task index
+ * from 0 to num_tasks - 1 must be run exactly once before returning. The
+ * tasks are independent and may run concurrently on other threads, in any
+ * order, for example on a work-stealing thread pool. Tasks do not call the
+ * other callbacks of the state: a search is given to the runner in batches,
+ * and a key pressed, which abandons the search, is checked for on the
+ * calling thread between batches. The default runs the tasks in turn on the
+ * calling thread, checking for a key pressed as they go.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] task_info task runner information specified by
+ * SLINPUT_Set_RunTasks.
+ * @param[in] task the task to run for each task index.
+ * @param[in] task_data the data to pass to the task.
+ * @param[in] num_tasks the number of tasks to run.
+ * @return negative value on error, 0 on success.
+ */
+typedef int SLINPUT_RunTasks(
+  const SLINPUT_State *state,
+  SLINPUT_TaskInfo task_info,
+  SLINPUT_Task *task, void *task_data, size_t num_tasks);
+
 /***************************************************************************/
 /* Setting callback pointers ***********************************************/
 /***************************************************************************/
@@ -367,6 +446,18 @@ void SLINPUT_Set_CompletionRequest(
   SLINPUT_CompletionInfo completion_info,
   SLINPUT_CompletionRequest *completion_request_cb);
 
+/**
+ * Sets the callback to run tasks.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] task_info the task info which will be passed to
+ * SLINPUT_RunTasks when it is invoked.
+ * @param[in] run_tasks_cb the callback pointer, or NULL for the default.
+ */
+void SLINPUT_Set_RunTasks(
+  SLINPUT_State *state,
+  SLINPUT_TaskInfo task_info,
+  SLINPUT_RunTasks *run_tasks_cb);
+
 /***************************************************************************/
 /* Configuration ***********************************************************/
 /***************************************************************************/
@@ -412,6 +503,128 @@ void SLINPUT_Set_ContinueCharRight(
   SLINPUT_State *state,
   sli_char continuation_character_right);
 
+/**
+ * Sets the encoding in which lines are stored when saved into history.
+ * SLINPUT_HE_UTF8 stores most lines in a fraction of the memory of
+ * SLINPUT_HE_NATIVE when sli_char is wider than a byte. A stored line is
+ * only decoded when it is recalled. Lines already saved keep their encoding.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] history_encoding the encoding.
+ * @note If this function is not called, then SLINPUT_HE_NATIVE is used.
+ * Where sli_char is a single byte, lines are always stored natively.
+ */
+void SLINPUT_Set_HistoryEncoding(
+  SLINPUT_State *state,
+  SLINPUT_HistoryEncoding history_encoding);
+
+/**
+ * Sets the maximum number of lines kept in history. Once full, saving a line
+ * removes the oldest. If the capacity is reduced, the oldest lines that no
+ * longer fit are removed.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] capacity the number of lines, zero disables history.
+ * @return negative value on error, 0 on success.
+ * @note If this function is not called, then up to SLINPUT_MAX_HISTORY
+ * lines are kept.
+ */
+int SLINPUT_Set_HistoryCapacity(
+  SLINPUT_State *state,
+  size_t capacity);
+
+/**
+ * Sets the most bytes of memory that may be allocated for history, as
+ * reported by SLINPUT_GetHistoryBytes less the indexes. Saving a line removes
+ * the oldest lines until the rest fit, and a line that could not fit on its
+ * own is not kept in memory, though it is still appended to the history file.
+ * If the budget is reduced, the oldest lines over it are removed. The prefix
+ * and context indexes built while browsing, the history file and a shared
+ * history attached are not counted.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] num_bytes the budget in bytes, zero for no limit.
+ * @note If this function is not called, then SLINPUT_HISTORY_BUDGET is used,
+ * which is no limit unless it is defined otherwise.
+ */
+void SLINPUT_Set_HistoryBudget(
+  SLINPUT_State *state,
+  size_t num_bytes);
+
+/**
+ * Sets whether saving a line into history erases any older copy of it, so
+ * that each line is only kept at its most recent position. Otherwise a line
+ * is only discarded if it is identical to the most recent line.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] erase_duplicates non-zero to erase older duplicates.
+ * @note If this function is not called, then older duplicates are kept.
+ */
+void SLINPUT_Set_HistoryEraseDuplicates(
+  SLINPUT_State *state,
+  int erase_duplicates);
+
+/**
+ * Sets whether older lines in history are packed into front coded blocks of
+ * SLINPUT_HISTORY_BLOCK_LINES lines, each line held as the number of leading
+ * bytes it shares with the line before and the bytes that follow. This cuts
+ * the memory used by repetitive history, while a packed line is decoded from
+ * its block only when it is browsed or searched. The newest lines are always
+ * held whole. Lines already packed stay packed if this is turned off.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] front_coding non-zero to pack lines into front coded blocks.
+ * @note If this function is not called, then lines are not packed.
+ */
+void SLINPUT_Set_HistoryFrontCoding(
+  SLINPUT_State *state,
+  int front_coding);
+
+/**
+ * Sets whether up and down browse only the lines in history that start with
+ * the text before the cursor, which stays in place. Moving down past the
+ * newest of those lines leaves just that text. With the cursor at the start
+ * of the line, all of history is browsed as usual. The lines are found using
+ * an index of their first SLINPUT_PREFIX_CHARS characters, built when first
+ * needed and kept up to date as lines are saved.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] prefix_browse non-zero to browse history by prefix.
+ * @note If this function is not called, then all of history is browsed.
+ */
+void SLINPUT_Set_HistoryPrefixBrowse(
+  SLINPUT_State *state,
+  int prefix_browse);
+
+/**
+ * Sets the context of lines saved into history, such as a hash of the
+ * working directory or the host, and browses history preferring it. Up first
+ * moves through the lines saved in the context, newest first, and then
+ * through the rest of history. Lines saved in the context also rank higher in
+ * fuzzy search, and the newest line of the context extending the line is
+ * suggested first among the lines examined. The lines of each context are
+ * indexed, so switching context does not search history, and a context is
+ * dropped from the index with the last of its lines to leave the ring.
+ * Browsing by prefix and incremental search with control R ignore the
+ * context, moving through all of history in order.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] context the context key, or zero for none.
+ * @note If this function is not called, then lines have no context and all
+ * of history is browsed in order. Lines read from a history file have no
+ * context.
+ */
+void SLINPUT_Set_HistoryContext(
+  SLINPUT_State *state,
+  unsigned long context);
+
+/**
+ * Sets whether the newest line in history that extends the line being input
+ * is suggested, shown dimmed after the cursor while it is at the end of the
+ * line. Right or End accept the suggestion. Each keystroke examines at most
+ * SLINPUT_SUGGEST_PROBES lines in the prefix index, so a suggestion may be
+ * missed rather than the keystroke delayed.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] suggest_history non-zero to suggest lines from history.
+ * @note If this function is not called, then no lines are suggested.
+ */
+void SLINPUT_Set_HistorySuggest(
+  SLINPUT_State *state,
+  int suggest_history);
+
 /**
  * Sets the input and output streams.
  * @param[in] state the state pointer created by SLINPUT_CreateState.
@@ -475,12 +688,226 @@ int SLINPUT_Get(
  * are removed.
  * @param[in] state the state pointer created by SLINPUT_CreateState.
  * @param[in] line the line of input to save
- * @return the number of lines in history or a negative value on error.
+ * @return the number of lines in history, at most INT_MAX, or a negative
+ * value on error.
  */
 int SLINPUT_Save(
   SLINPUT_State *state,
   const sli_char *line);
 
+/**
+ * Sets when lines saved into history are committed to the attached history
+ * file. Lines are gathered in memory and written together, once they reach
+ * num_bytes or the oldest has waited for seconds, checked when a line is saved
+ * and when SLINPUT_Get is called. Waiting lines are also committed when the
+ * file is detached and by SLINPUT_DestroyState.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] num_bytes the bytes of waiting lines that cause a commit, or 0 to
+ * commit each line as it is saved.
+ * @param[in] seconds the number of seconds a line may wait to be committed.
+ * @note If this function is not called, then lines are committed once 4096
+ * bytes or 5 seconds are reached.
+ */
+void SLINPUT_Set_HistoryCommit(
+  SLINPUT_State *state,
+  size_t num_bytes,
+  unsigned long seconds);
+
+/**
+ * Sets whether the history file is shared with other processes. Lines that
+ * other processes append to a shared file are read into history each time
+ * SLINPUT_Get is called, reading only the bytes appended since the file was
+ * last read. Reads of a shared file take advisory locks, and commits to any
+ * history file take an exclusive one.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] share_history non-zero to share the history file.
+ * @note If this function is not called, then the history file is not shared.
+ */
+void SLINPUT_Set_HistoryShared(
+  SLINPUT_State *state,
+  int share_history);
+
+/**
+ * Attaches a history file. Lines already in the file can be browsed after the
+ * lines saved into history since, and are only read from the file when
+ * browsed to. Lines saved into history are also appended to the file.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] path the path of the file, which is created if it does not
+ * exist. NULL detaches the file currently attached.
+ * @return negative value on error, 0 on success. If the lines waiting to be
+ * written to the file currently attached cannot be committed, then that file
+ * stays attached with the lines still waiting.
+ */
+int SLINPUT_AttachHistory(
+  SLINPUT_State *state,
+  const char *path);
+
+/**
+ * Creates history that states can share, holding the lines in history of
+ * the state, including those in its attached history file. The lines are
+ * stored once, however many states attach them, with an index of their
+ * leading characters built here for browsing by prefix. Each state attached
+ * indexes only the lines it saves.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @return the shared history, with one reference held by the caller, or NULL
+ * if out of memory.
+ */
+SLINPUT_SharedHistory *SLINPUT_CreateSharedHistory(
+  SLINPUT_State *state);
+
+/**
+ * Attaches shared history in place of a history file, after detaching any
+ * file or shared history attached. The shared lines are reached by moving up
+ * past the oldest line in memory, as for a history file, and are never
+ * copied or changed. Lines saved into history are kept in memory only.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] shared_history the shared history, which gains a reference
+ * until it is detached. NULL detaches the shared history attached.
+ * @return negative value on error, 0 on success.
+ * @note The reference count is not locked, so states sharing history must
+ * not attach, detach or release it on different threads at the same time.
+ */
+int SLINPUT_AttachSharedHistory(
+  SLINPUT_State *state,
+  SLINPUT_SharedHistory *shared_history);
+
+/**
+ * Releases a reference to shared history, freeing it when none are left.
+ * @param[in] shared_history the shared history.
+ */
+void SLINPUT_ReleaseSharedHistory(
+  SLINPUT_SharedHistory *shared_history);
+
+/**
+ * Compacts the attached history file, keeping only the most recent occurrence
+ * of each line and at most max_lines lines. The records are written to a new
+ * file that is renamed over the history file, so a crash leaves either the
+ * old or the new file. Commits by other processes attached to the file wait
+ * for the lock, and are then made to the new file, whether or not they share
+ * it. This may be called whenever
+ * convenient, for example before SLINPUT_Get when the file has grown.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] max_lines the maximum number of lines to keep.
+ * @return negative value on error, 0 on success.
+ */
+int SLINPUT_CompactHistory(
+  SLINPUT_State *state,
+  size_t max_lines);
+
+/**
+ * Commits lines saved into history that are waiting to be written to the
+ * attached history file.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @return negative value on error, 0 on success. On error the lines keep
+ * waiting, and are written by the next commit.
+ */
+int SLINPUT_CommitHistory(
+  SLINPUT_State *state);
+
+/**
+ * Finds the lines in history that best match a query as a fuzzy match. The
+ * characters of the query must appear in a line in order, though not
+ * necessarily together, and a lower case letter also matches its capital.
+ * Matches score more for consecutive characters and characters starting
+ * words, and less for gaps. Only the lines held in memory are searched, not
+ * the attached history file.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] query the characters to match.
+ * @param[in] max_matches the maximum number of matches to find.
+ * @param[out] matches the matches found, best first. Equal scores are
+ * ordered newest first.
+ * @return negative value on error, otherwise the number of matches found.
+ */
+int SLINPUT_MatchHistory(
+  SLINPUT_State *state,
+  const sli_char *query,
+  size_t max_matches,
+  SLINPUT_HistoryMatch *matches);
+
+/**
+ * Finds the lines in history used most often and most recently. Each time a
+ * line is saved, or saved again, its frecency gains 256, while it halves over
+ * every SLINPUT_FRECENCY_HALF_LIFE lines saved, and is also used to rank
+ * fuzzy matches. Only saving counts as a use: a line recalled from history
+ * gains frecency when the application saves it again, not when it is
+ * browsed or found by a search. The best lines are selected without sorting
+ * all of history. Only the lines held in memory are ranked, each line once.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] max_matches the maximum number of lines to find.
+ * @param[out] matches the lines found, best first, with their frecency as
+ * their score. Equal scores are ordered newest first.
+ * @return negative value on error, otherwise the number of lines found.
+ */
+int SLINPUT_FrecentHistory(
+  SLINPUT_State *state,
+  size_t max_matches,
+  SLINPUT_HistoryMatch *matches);
+
+/**
+ * Copies a line in history, as found by SLINPUT_MatchHistory or
+ * SLINPUT_FrecentHistory.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] age the number of lines in history newer than the line.
+ * @param[in] buffer_chars the number of characters in the buffer, including
+ * the nil terminator.
+ * @param[out] buffer the line, truncated to fit the buffer.
+ * @return negative value if there is no such line, otherwise the number of
+ * characters copied.
+ */
+int SLINPUT_GetHistory(
+  SLINPUT_State *state,
+  size_t age,
+  sli_ushort buffer_chars,
+  sli_char *buffer);
+
+/**
+ * Views the lines in history, oldest first, without copying them. The text
+ * viewed is where the state stores the line, except for a line packed by
+ * front coding, which is decoded into a buffer the state reuses. A view is
+ * only valid until the next call to the library.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in,out] iterator zero to view the oldest line, advanced past the
+ * line viewed. It should not be kept while lines are saved.
+ * @param[out] view the line viewed.
+ * @return 1 if a line was viewed, 0 after the newest line.
+ */
+int SLINPUT_ViewHistory(
+  SLINPUT_State *state,
+  size_t *iterator,
+  SLINPUT_HistoryView *view);
+
+/**
+ * Saves lines into history from a buffer, for example lines viewed by
+ * SLINPUT_ViewHistory in an earlier session. Each line is nil terminated,
+ * oldest first, and saved as by SLINPUT_Save, though not appended to the
+ * attached history file.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @param[in] lines the lines. They are copied into history, so the caller
+ * keeps the buffer and may free it once this returns.
+ * @param[in] num_bytes the number of bytes of lines.
+ * @param[in] encoding the encoding of the lines. Where sli_char is a single
+ * byte, lines are always read natively.
+ * @return negative value on error, otherwise the number of lines in history,
+ * at most INT_MAX. No lines are saved if any is not nil terminated or not
+ * correctly encoded.
+ */
+int SLINPUT_ImportHistory(
+  SLINPUT_State *state,
+  const void *lines,
+  size_t num_bytes,
+  SLINPUT_HistoryEncoding encoding);
+
+/**
+ * Returns the bytes of memory allocated for history: the lines, the room
+ * left in the chunks holding them, the ring, the contexts of lines, the hash
+ * table, the decoders, and the prefix and context indexes, which are not
+ * counted against the budget.
+ * @param[in] state the state pointer created by SLINPUT_CreateState.
+ * @return the number of bytes.
+ */
+size_t SLINPUT_GetHistoryBytes(
+  const SLINPUT_State *state);
+
 /**
  * Replaces the current input string with the completion string and redraws
  * Call during SLINPUT_CompletionRequest callback.
@@ -1,7 +1,11 @@
 #include <sys/select.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -10,6 +14,7 @@
 #include <wchar.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 
 #include "include/slinput.h"
 #include "src/slinputi.h"
@@ -24,6 +29,15 @@ typedef struct LinuxInputStream {
   sli_ushort env_width;  /**< Width of terminal from environment */
 } LinuxInputStream;
 
+/** History file state */
+typedef struct LinuxHistoryFile {
+  int fd;  /**< File descriptor, opened for appending */
+  void *map;  /**< The mapped file contents, or NULL if empty */
+  size_t map_size;  /**< The size of the mapping in bytes */
+  HistoryLock lock;  /**< The lock held on the file */
+  char *path;  /**< The path of the file, stored after this structure */
+} LinuxHistoryFile;
+
 int SLINPUT_EnterRaw_Default(
     const SLINPUT_State *state,
     SLINPUT_Stream stream_in,
@@ -105,6 +119,7 @@ static const EscapeSequenceMapping M_SequenceMapping[] = {
   { "\033[1;5C", SLINPUT_KC_WARP_RIGHT },  /* With control cursor warp right */
   { "\033[H", SLINPUT_KC_HOME },  /* Home cursor to start of line */
   { "\033[F", SLINPUT_KC_END },  /* End cursor to end of line */
+  { "\033y", SLINPUT_KC_YANK_POP },  /* Alt y yank older killed text */
   { NULL, SLINPUT_KC_NUL }  /* End of mappings */
 };
 
@@ -119,6 +134,14 @@ static const CharMapping M_CharMapping[] = {
   { '\x04', SLINPUT_KC_END_OF_TRANSMISSION },
   { '\x1b', SLINPUT_KC_ESCAPE },
   { '\t', SLINPUT_KC_TAB },
+  { '\x1f', SLINPUT_KC_UNDO },  /* Control underscore */
+  { '\x1e', SLINPUT_KC_REDO },  /* Control caret */
+  { '\x15', SLINPUT_KC_KILL_TO_START },  /* Control u */
+  { '\x0b', SLINPUT_KC_KILL_TO_END },  /* Control k */
+  { '\x17', SLINPUT_KC_KILL_WORD },  /* Control w */
+  { '\x19', SLINPUT_KC_YANK },  /* Control y */
+  { '\x12', SLINPUT_KC_SEARCH_BACKWARD },  /* Control r */
+  { '\x13', SLINPUT_KC_SEARCH_FUZZY },  /* Control s */
   { '\0' }
 };
 
@@ -362,7 +385,9 @@ static const char *SLINPUT_CursorControlTable[SLINPUT_CCC_MAX] = {
   "\033[u",     /* SLINPUT_CCC_RESTORE_CURSOR */
   "\033[2K\r",  /* SLINPUT_CCC_CLEAR_LINE */
   "\033[7h",    /* SLINPUT_CCC_WRAP_ON */
-  "\033[7l"     /* SLINPUT_CCC_WRAP_OFF */
+  "\033[7l",    /* SLINPUT_CCC_WRAP_OFF */
+  "\033[2m",    /* SLINPUT_CCC_DIM_ON */
+  "\033[22m"    /* SLINPUT_CCC_DIM_OFF */
 };
 
 int SLINPUT_CursorControl_Default(
@@ -488,3 +513,267 @@ void SLINPUT_DestroyStreams_Default(
   stream_in->stream_data = NULL;
   stream_out->stream_data = NULL;
 }
+
+/* Open a history file, mapping its contents */
+int SLINPUT_OpenHistoryFile_Default(
+    const SLINPUT_State *state,
+    const char *path,
+    HistoryFile *history_file) {
+  const TermInfo *term_info = &state->term_info;
+  const size_t path_length = strlen(path);
+  LinuxHistoryFile *file = term_info->malloc_in(term_info->alloc_info,
+    sizeof(LinuxHistoryFile) + path_length + 1);
+  struct stat file_stat;
+  int result = 0;
+
+  if (file == NULL)
+    return -1;
+
+  file->map = NULL;
+  file->map_size = 0;
+  file->lock = HISTORY_LOCK_NONE;
+  file->path = (char *) (file + 1);
+  memcpy(file->path, path, path_length + 1);
+  file->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+  if (file->fd == -1) {
+    result = -errno;
+  } else if (fstat(file->fd, &file_stat) == -1) {
+    result = -errno;
+  } else if (file_stat.st_size > 0) {
+    /* Pages are only read when records are browsed */
+    file->map_size = (size_t) file_stat.st_size;
+    file->map = mmap(NULL, file->map_size, PROT_READ, MAP_SHARED, file->fd,
+      0);
+    if (file->map == MAP_FAILED) {
+      result = -errno;
+      file->map = NULL;
+    }
+  }
+
+  if (result < 0) {
+    if (file->fd != -1)
+      close(file->fd);
+    term_info->free_in(term_info->alloc_info, file);
+    return result;
+  }
+
+  history_file->file_data = file;
+  history_file->contents = (const unsigned char *) file->map;
+  history_file->num_bytes = (unsigned long) file->map_size;
+  return 0;
+}
+
+/* Write all bytes to a file descriptor */
+static int WriteAll(int fd, const void *data, size_t num_bytes) {
+  const char *ptr = (const char *) data;
+  while (num_bytes) {
+    const ssize_t num_written = write(fd, ptr, num_bytes);
+    if (num_written == -1) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+
+    ptr += num_written;
+    num_bytes -= (size_t) num_written;
+  }
+
+  return 0;
+}
+
+/* Append to a history file */
+int SLINPUT_AppendHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file,
+    const void *data,
+    size_t num_bytes) {
+  const LinuxHistoryFile *file =
+    (const LinuxHistoryFile *) history_file->file_data;
+  const int result = WriteAll(file->fd, data, num_bytes);
+  if (result < 0)
+    return result;
+
+  return fsync(file->fd) == -1 ? -errno : 0;
+}
+
+/* Lock or unlock a file descriptor */
+static int LockDescriptor(int fd, HistoryLock lock) {
+  const int operation = lock == HISTORY_LOCK_SHARED ? LOCK_SH :
+    lock == HISTORY_LOCK_EXCLUSIVE ? LOCK_EX : LOCK_UN;
+  while (flock(fd, operation) == -1) {
+    if (errno != EINTR)
+      return -errno;
+  }
+
+  return 0;
+}
+
+/* Lock or unlock a history file */
+int SLINPUT_LockHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file,
+    HistoryLock lock) {
+  LinuxHistoryFile *file = (LinuxHistoryFile *) history_file->file_data;
+  const int result = LockDescriptor(file->fd, lock);
+  if (result < 0)
+    return result;
+
+  file->lock = lock;
+  return 0;
+}
+
+/* Refresh a history file, mapping it again if it has grown. Only the pages
+appended are read when they are used. If another process has renamed a
+compacted file over the path, then 1 is returned, with the file replaced still
+mapped. */
+int SLINPUT_RefreshHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  LinuxHistoryFile *file = (LinuxHistoryFile *) history_file->file_data;
+  struct stat file_stat;
+  struct stat path_stat;
+  void *map = NULL;
+  int replaced = 0;
+  if (fstat(file->fd, &file_stat) == -1)
+    return -errno;
+
+  if (stat(file->path, &path_stat) == 0 &&
+      (path_stat.st_ino != file_stat.st_ino ||
+      path_stat.st_dev != file_stat.st_dev))
+    replaced = 1;
+  if ((size_t) file_stat.st_size <= file->map_size)
+    return replaced;
+
+  map = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_SHARED,
+    file->fd, 0);
+  if (map == MAP_FAILED)
+    return -errno;
+
+  if (file->map)
+    munmap(file->map, file->map_size);
+  file->map = map;
+  file->map_size = (size_t) file_stat.st_size;
+  history_file->contents = (const unsigned char *) file->map;
+  history_file->num_bytes = (unsigned long) file->map_size;
+  return replaced;
+}
+
+/* Open the file another process renamed over the path of a history file,
+with the same lock held */
+int SLINPUT_ReopenHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  LinuxHistoryFile *file = (LinuxHistoryFile *) history_file->file_data;
+  struct stat file_stat;
+  void *map = NULL;
+  const int fd = open(file->path, O_RDWR | O_APPEND);
+  int result;
+  if (fd == -1)
+    return -errno;
+
+  result = LockDescriptor(fd, file->lock);
+  if (result == 0 && fstat(fd, &file_stat) == -1)
+    result = -errno;
+  if (result == 0 && file_stat.st_size > 0) {
+    map = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_SHARED, fd,
+      0);
+    if (map == MAP_FAILED)
+      result = -errno;
+  }
+
+  if (result < 0) {
+    close(fd);
+    return result;
+  }
+
+  if (file->map)
+    munmap(file->map, file->map_size);
+  close(file->fd);
+  file->fd = fd;
+  file->map = map;
+  file->map_size = (size_t) file_stat.st_size;
+  history_file->contents = (const unsigned char *) file->map;
+  history_file->num_bytes = (unsigned long) file->map_size;
+  return 0;
+}
+
+/* Replace the contents of a history file, writing a temporary file that is
+renamed over it. The temporary file is locked before the rename, so other
+processes cannot append to it until the lock is released. */
+int SLINPUT_ReplaceHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file,
+    const void *data,
+    size_t num_bytes) {
+  const TermInfo *term_info = &state->term_info;
+  LinuxHistoryFile *file = (LinuxHistoryFile *) history_file->file_data;
+  const size_t path_length = strlen(file->path);
+  char *temp_path = term_info->malloc_in(term_info->alloc_info,
+    path_length + sizeof(".tmp"));
+  void *map = MAP_FAILED;
+  int fd;
+  int result;
+  if (!temp_path)
+    return -1;
+
+  memcpy(temp_path, file->path, path_length);
+  memcpy(temp_path + path_length, ".tmp", sizeof(".tmp"));
+  fd = open(temp_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  if (fd == -1) {
+    result = -errno;
+  } else {
+    result = LockDescriptor(fd, file->lock);
+    if (result == 0)
+      result = WriteAll(fd, data, num_bytes);
+    if (result == 0 && fsync(fd) == -1)
+      result = -errno;
+    if (result == 0) {
+      map = mmap(NULL, num_bytes, PROT_READ, MAP_SHARED, fd, 0);
+      if (map == MAP_FAILED)
+        result = -errno;
+    }
+    if (result == 0 && rename(temp_path, file->path) == -1)
+      result = -errno;
+
+    if (result < 0) {
+      if (map != MAP_FAILED)
+        munmap(map, num_bytes);
+      close(fd);
+      unlink(temp_path);
+    }
+  }
+
+  term_info->free_in(term_info->alloc_info, temp_path);
+  if (result < 0)
+    return result;
+
+  if (file->map)
+    munmap(file->map, file->map_size);
+  close(file->fd);
+  file->fd = fd;
+  file->map = map;
+  file->map_size = num_bytes;
+  history_file->contents = (const unsigned char *) file->map;
+  history_file->num_bytes = (unsigned long) file->map_size;
+  return 0;
+}
+
+/* Seconds for timing history commits */
+unsigned long SLINPUT_Seconds_Default(void) {
+  return (unsigned long) time(NULL);
+}
+
+/* Close a history file */
+void SLINPUT_CloseHistoryFile_Default(
+    const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  const TermInfo *term_info = &state->term_info;
+  LinuxHistoryFile *file = (LinuxHistoryFile *) history_file->file_data;
+  if (file->map)
+    munmap(file->map, file->map_size);
+  close(file->fd);
+  term_info->free_in(term_info->alloc_info, file);
+  history_file->file_data = NULL;
+  history_file->contents = NULL;
+  history_file->num_bytes = 0;
+}
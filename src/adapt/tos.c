@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <time.h>
 #include <tos.h>
 
 #if (defined(__TOS__) && defined(__PUREC__)) || \
@@ -16,6 +17,14 @@ typedef struct TOSInputStream {
   sli_ushort env_width;  /**< Width of terminal from environment */
 } TOSInputStream;
 
+/** History file state */
+typedef struct TOSHistoryFile {
+  int handle;  /**< GEMDOS file handle */
+  unsigned char *contents;  /**< The file contents read so far */
+  unsigned long size;  /**< Bytes allocated for contents */
+  char *path;  /**< The path of the file, stored after this structure */
+} TOSHistoryFile;
+
 int SLINPUT_EnterRaw_Default(
     const SLINPUT_State *state,
     SLINPUT_Stream stream_in,
@@ -37,6 +46,7 @@ int SLINPUT_GetCharIn_Default(const SLINPUT_State *state,
   const long kbshift_state = Kbshift(-1);
 
   const int control = !!(kbshift_state & 0x4);
+  const int alternate = !!(kbshift_state & 0x8);
   const int left_shift = !!(kbshift_state & 0x1);
   const int right_shift = !!(kbshift_state & 0x2);
   const int shifted = left_shift | right_shift;
@@ -65,6 +75,13 @@ int SLINPUT_GetCharIn_Default(const SLINPUT_State *state,
     case 0x53: /* delete */
         kc_enum_value = SLINPUT_KC_DEL;
       break;
+    case 0x61: /* undo */
+        kc_enum_value = shifted ? SLINPUT_KC_REDO : SLINPUT_KC_UNDO;
+      break;
+    case 0x15: /* y */
+      if (alternate)
+        kc_enum_value = SLINPUT_KC_YANK_POP;
+      break;
   }
 
   switch (chv) {
@@ -81,6 +98,30 @@ int SLINPUT_GetCharIn_Default(const SLINPUT_State *state,
       if (control)
         kc_enum_value = SLINPUT_KC_END_OF_TRANSMISSION;
       break;
+    case 0x15:
+      if (control)
+        kc_enum_value = SLINPUT_KC_KILL_TO_START;
+      break;
+    case 0xb:
+      if (control)
+        kc_enum_value = SLINPUT_KC_KILL_TO_END;
+      break;
+    case 0x17:
+      if (control)
+        kc_enum_value = SLINPUT_KC_KILL_WORD;
+      break;
+    case 0x19:
+      if (control)
+        kc_enum_value = SLINPUT_KC_YANK;
+      break;
+    case 0x12:
+      if (control)
+        kc_enum_value = SLINPUT_KC_SEARCH_BACKWARD;
+      break;
+    case 0x13:
+      if (control)
+        kc_enum_value = SLINPUT_KC_SEARCH_FUZZY;
+      break;
   }
 
   if (key_code)
@@ -195,6 +236,270 @@ void SLINPUT_DestroyStreams_Default(const SLINPUT_State *state,
   stream_out->stream_data = NULL;
 }
 
+/* Open a history file, reading its contents as there is no mmap */
+int SLINPUT_OpenHistoryFile_Default(const SLINPUT_State *state,
+    const char *path, HistoryFile *history_file) {
+  const TermInfo *term_info = &state->term_info;
+  size_t path_length = 0;
+  size_t index;
+  TOSHistoryFile *file;
+  long result;
+  long num_bytes = 0;
+
+  while (path[path_length])
+    ++path_length;
+
+  file = term_info->malloc_in(term_info->alloc_info,
+    sizeof(TOSHistoryFile) + path_length + 1);
+  if (!file)
+    return -1;
+
+  file->handle = -1;
+  file->contents = NULL;
+  file->size = 0;
+  file->path = (char *) (file + 1);
+  for (index = 0; index <= path_length; ++index)
+    file->path[index] = path[index];
+  result = Fopen(path, 2);
+  if (result < 0)
+    result = Fcreate(path, 0);
+
+  if (result >= 0) {
+    file->handle = (int) result;
+    num_bytes = Fseek(0L, file->handle, 2);
+    result = num_bytes;
+  }
+
+  if (result > 0) {
+    file->contents = term_info->malloc_in(term_info->alloc_info,
+      (size_t) num_bytes);
+    if (!file->contents) {
+      result = -1;
+    } else {
+      file->size = (unsigned long) num_bytes;
+      result = Fseek(0L, file->handle, 0);
+      if (result >= 0)
+        result = Fread(file->handle, num_bytes, file->contents);
+      if (result >= 0 && result != num_bytes)
+        result = -1;
+    }
+  }
+
+  if (result < 0) {
+    if (file->contents)
+      term_info->free_in(term_info->alloc_info, file->contents);
+    if (file->handle >= 0)
+      Fclose(file->handle);
+    term_info->free_in(term_info->alloc_info, file);
+    return (int) result;
+  }
+
+  history_file->file_data = file;
+  history_file->contents = file->contents;
+  history_file->num_bytes = (unsigned long) num_bytes;
+  return 0;
+}
+
+/* Append to a history file */
+int SLINPUT_AppendHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file, const void *data, size_t num_bytes) {
+  const TOSHistoryFile *file = (const TOSHistoryFile *) history_file->file_data;
+  long result = Fseek(0L, file->handle, 2);
+  if (result >= 0)
+    result = Fwrite(file->handle, (long) num_bytes, (void *) data);
+  if (result >= 0 && result != (long) num_bytes)
+    result = -1;
+
+  return result < 0 ? (int) result : 0;
+}
+
+/* Lock a history file. TOS runs one process at a time, so there is nothing
+to lock against. */
+int SLINPUT_LockHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file, HistoryLock lock) {
+  return 0;
+}
+
+/* Refresh a history file, reading only the bytes appended since it was last
+read */
+int SLINPUT_RefreshHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  const TermInfo *term_info = &state->term_info;
+  TOSHistoryFile *file = (TOSHistoryFile *) history_file->file_data;
+  const long num_bytes = Fseek(0L, file->handle, 2);
+  long num_appended;
+  long result;
+  if (num_bytes < 0)
+    return (int) num_bytes;
+
+  if ((unsigned long) num_bytes <= history_file->num_bytes)
+    return 0;
+
+  /* Grow the contents geometrically, so reading appends is linear */
+  if ((unsigned long) num_bytes > file->size) {
+    unsigned long size = file->size*2;
+    unsigned char *contents;
+    unsigned long index;
+    if (size < (unsigned long) num_bytes)
+      size = (unsigned long) num_bytes;
+    contents = term_info->malloc_in(term_info->alloc_info, (size_t) size);
+    if (!contents)
+      return -1;
+
+    for (index = 0; index < history_file->num_bytes; ++index)
+      contents[index] = file->contents[index];
+    if (file->contents)
+      term_info->free_in(term_info->alloc_info, file->contents);
+    file->contents = contents;
+    file->size = size;
+    history_file->contents = contents;
+  }
+
+  num_appended = num_bytes - (long) history_file->num_bytes;
+  result = Fseek((long) history_file->num_bytes, file->handle, 0);
+  if (result >= 0) {
+    result = Fread(file->handle, num_appended,
+      file->contents + history_file->num_bytes);
+  }
+  if (result >= 0 && result != num_appended)
+    result = -1;
+  if (result < 0)
+    return (int) result;
+
+  history_file->num_bytes = (unsigned long) num_bytes;
+  return 0;
+}
+
+/* Open the file that replaced a history file. TOS runs one process at a
+time, so no other process replaces the file and there is nothing to open. */
+int SLINPUT_ReopenHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  return 0;
+}
+
+/* Replace the contents of a history file, writing a temporary file with the
+extension $$$ that is renamed over it. GEMDOS cannot rename over an existing
+file, so the original is first renamed aside with the extension $$B, and
+deleted once the temporary file is in place. If interrupted between the
+renames, the original is left with the extension $$B. */
+int SLINPUT_ReplaceHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file, const void *data, size_t num_bytes) {
+  const TermInfo *term_info = &state->term_info;
+  TOSHistoryFile *file = (TOSHistoryFile *) history_file->file_data;
+  size_t path_length = 0;
+  size_t extension = 0;
+  char *temp_path;
+  char *old_path;
+  long handle;
+  long result;
+  unsigned long index;
+
+  /* Find the extension of the file name */
+  for (; file->path[path_length]; ++path_length) {
+    if (file->path[path_length] == '.')
+      extension = path_length;
+    else if (file->path[path_length] == '\\')
+      extension = 0;
+  }
+  if (!extension)
+    extension = path_length;
+
+  temp_path = term_info->malloc_in(term_info->alloc_info, (extension + 5)*2);
+  if (!temp_path)
+    return -1;
+
+  old_path = temp_path + extension + 5;
+  for (index = 0; index < extension; ++index) {
+    temp_path[index] = file->path[index];
+    old_path[index] = file->path[index];
+  }
+  temp_path[extension] = '.';
+  temp_path[extension + 1] = '$';
+  temp_path[extension + 2] = '$';
+  temp_path[extension + 3] = '$';
+  temp_path[extension + 4] = '\0';
+  old_path[extension] = '.';
+  old_path[extension + 1] = '$';
+  old_path[extension + 2] = '$';
+  old_path[extension + 3] = 'B';
+  old_path[extension + 4] = '\0';
+
+  result = Fcreate(temp_path, 0);
+  if (result >= 0) {
+    const int handle = (int) result;
+    result = Fwrite(handle, (long) num_bytes, (void *) data);
+    if (result >= 0 && result != (long) num_bytes)
+      result = -1;
+    Fclose(handle);
+    if (result < 0)
+      Fdelete(temp_path);
+  }
+
+  if (result >= 0) {
+    Fclose(file->handle);
+    Fdelete(old_path);
+    result = Frename(0, file->path, old_path);
+    if (result >= 0) {
+      result = Frename(0, temp_path, file->path);
+      if (result >= 0)
+        Fdelete(old_path);
+      else
+        Frename(0, old_path, file->path);
+    }
+    if (result < 0)
+      Fdelete(temp_path);
+
+    /* The original is opened again if it was not replaced */
+    handle = Fopen(file->path, 2);
+    file->handle = handle >= 0 ? (int) handle : -1;
+    if (result >= 0)
+      result = handle;
+  }
+
+  term_info->free_in(term_info->alloc_info, temp_path);
+  if (result < 0)
+    return (int) result;
+
+  /* The contents are those written */
+  if (num_bytes > file->size) {
+    unsigned char *contents = term_info->malloc_in(term_info->alloc_info,
+      num_bytes);
+    if (!contents)
+      return -1;
+
+    if (file->contents)
+      term_info->free_in(term_info->alloc_info, file->contents);
+    file->contents = contents;
+    file->size = (unsigned long) num_bytes;
+  }
+
+  for (index = 0; index < num_bytes; ++index)
+    file->contents[index] = ((const unsigned char *) data)[index];
+  history_file->contents = file->contents;
+  history_file->num_bytes = (unsigned long) num_bytes;
+  return 0;
+}
+
+/* Seconds for timing history commits */
+unsigned long SLINPUT_Seconds_Default(void) {
+  return (unsigned long) (clock() / CLK_TCK);
+}
+
+/* Close a history file */
+void SLINPUT_CloseHistoryFile_Default(const SLINPUT_State *state,
+    HistoryFile *history_file) {
+  const TermInfo *term_info = &state->term_info;
+  TOSHistoryFile *file = (TOSHistoryFile *) history_file->file_data;
+  if (file->contents)
+    term_info->free_in(term_info->alloc_info, file->contents);
+  if (file->handle >= 0)
+    Fclose(file->handle);
+  term_info->free_in(term_info->alloc_info, file);
+  history_file->file_data = NULL;
+  history_file->contents = NULL;
+  history_file->num_bytes = 0;
+}
+
 static const char *SLINPUT_CursorControlTable[SLINPUT_CCC_MAX] = {
   "\033C",    /* SLINPUT_CCC_CURSOR_RIGHT */
   "\033D",    /* SLINPUT_CCC_CURSOR_LEFT */
@@ -205,7 +510,9 @@ static const char *SLINPUT_CursorControlTable[SLINPUT_CCC_MAX] = {
   "\033k",    /* SLINPUT_CCC_RESTORE_CURSOR */
   "\033l",    /* SLINPUT_CCC_CLEAR_LINE */
   "\033v",    /* SLINPUT_CCC_WRAP_ON */
-  "\033w"     /* SLINPUT_CCC_WRAP_OFF */
+  "\033w",    /* SLINPUT_CCC_WRAP_OFF */
+  "\033p",    /* SLINPUT_CCC_DIM_ON, reverse video */
+  "\033q"     /* SLINPUT_CCC_DIM_OFF */
 };
 
 int SLINPUT_CursorControl_Default(
@@ -1,121 +1,3029 @@
 #include <stdlib.h>
 #include <stddef.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "include/slinput.h"
 #include "src/slinputi.h"
 
+#if SLI_CHAR_SIZE > 1
+#include "src/unicode/width.h"
+#include "src/unicode/grapheme.h"
+#endif
+
+/* History files hold UTF-8, or single byte characters as they are */
+#define HISTORY_FILE_ENCODING \
+  (SLI_CHAR_SIZE > 1 ? SLINPUT_HE_UTF8 : SLINPUT_HE_NATIVE)
+
+/* A history file record is a 32 bit length, the text, then the length again
+and a 32 bit checksum of the text, all little endian */
+#define HISTORY_RECORD_HEAD 4
+#define HISTORY_RECORD_TAIL 8
+
+/* The frecency a line gains each time it is used, and the frecency worth
+one point of a fuzzy match score */
+#define FRECENCY_USE 256
+#define FUZZY_FRECENCY_SCALE 1024
+
+/* Fuzzy match scores of each character matched, bonuses for characters
+following a match or starting a word, and penalties for the first and each
+further character of a gap */
+#define FUZZY_SCORE_MATCH 16
+#define FUZZY_BONUS_CONSECUTIVE 8
+#define FUZZY_BONUS_BOUNDARY 8
+#define FUZZY_PENALTY_GAP_START 3
+#define FUZZY_PENALTY_GAP 1
+
+/* The fuzzy match score bonus for a line saved in the current context */
+#define FUZZY_BONUS_CONTEXT 16
+
 static const sli_char EmptyString[1] = { '\0' };
+static const unsigned long HistoryHashStart = 2166136261UL;
+static const unsigned char HistoryFileMagic[8] = {
+  'S', 'L', 'I', 'H', 'I', 'S', 'T', '1'
+};
+
+/* Check pointers are within expected ranges */
+static void CheckState(SLINPUT_State *state) {
+  assert(state->line_info.end_ptr >= state->line_info.buffer);
+  assert(state->line_info.cursor_ptr >= state->line_info.buffer);
+  assert(state->line_info.scroll_ptr >= state->line_info.buffer);
+
+  assert(state->line_info.end_ptr <= state->line_info.buffer +
+    state->line_info.max_chars);
+  assert(state->line_info.cursor_ptr <= state->line_info.end_ptr);
+  assert(state->line_info.scroll_ptr <= state->line_info.cursor_ptr);
+}
+
+/* Minimum of two integer values, used when checking for negative error
+values. */
+static int Minimum(int value1, int value2) {
+  return value1 < value2 ? value1 : value2;
+}
+
+/* Finds the start of a word by searching leftwards, using spaces as the
+delimeter. */
+static sli_char *FindStartOfWord(SLINPUT_State *state,
+    const sli_char *buffer, sli_char *cursor_ptr) {
+  const TermInfo *term_info = &state->term_info;
+  while (cursor_ptr > buffer) {
+    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr) &&
+        term_info->is_space_in(state, term_info->stream_in,
+          *(cursor_ptr - 1))) {
+      break;
+    }
+    --cursor_ptr;
+  }
+  return cursor_ptr;
+}
+
+/* Skips spaces leftwards */
+static sli_char *SkipSpacesLeft(SLINPUT_State *state,
+    const sli_char *buffer, sli_char *cursor_ptr) {
+  const TermInfo *term_info = &state->term_info;
+  while (cursor_ptr > buffer) {
+    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
+      break;
+    --cursor_ptr;
+  }
+  return cursor_ptr;
+}
+
+/* Skips rightwards until a space is found */
+static sli_char *SkipWordRight(SLINPUT_State *state,
+    const sli_char *end_ptr, sli_char *cursor_ptr) {
+  const TermInfo *term_info = &state->term_info;
+  while (cursor_ptr < end_ptr) {
+    if (term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
+      break;
+    ++cursor_ptr;
+  }
+  return cursor_ptr;
+}
+
+/* Skips spaces rightwards */
+static sli_char *SkipSpacesRight(SLINPUT_State *state,
+    const sli_char *end_ptr, sli_char *cursor_ptr) {
+  const TermInfo *term_info = &state->term_info;
+  while (cursor_ptr < end_ptr) {
+    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
+      break;
+    ++cursor_ptr;
+  }
+  return cursor_ptr;
+}
+
+/* Outputs characters until a nil or the max_chars count is reached */
+static int OutputMaxChars(SLINPUT_State *state,
+    ptrdiff_t max_chars, const sli_char *str) {
+  SLINPUT_Stream stream = state->term_info.stream_out;
+  SLINPUT_Putchar *putchar_out = state->term_info.putchar_out;
+  int result = 0;
+  while (max_chars-- > 0 && *str)
+    result = Minimum(result, (*putchar_out)(state, stream, *str++));
+
+  return result;
+}
+
+/* Returns the number of columns a character occupies when displayed */
+static unsigned char CharWidth(sli_char character) {
+#if SLI_CHAR_SIZE > 1
+  const unsigned long code_point = (unsigned long) character;
+  const unsigned int offset_mask = (1U << SLINPUT_WIDTH_BLOCK_BITS) - 1;
+  unsigned int block;
+  unsigned int offset;
+
+  if (code_point >= SLINPUT_WIDTH_CODE_POINTS)
+    return 1;
+
+  /* Two level lookup, four widths are packed in each byte of a block */
+  block = SLINPUT_WidthIndex[code_point >> SLINPUT_WIDTH_BLOCK_BITS];
+  offset = (unsigned int) code_point & offset_mask;
+  return (unsigned char) ((SLINPUT_WidthBlocks[
+    (block << (SLINPUT_WIDTH_BLOCK_BITS - 2)) + (offset >> 2)] >>
+    ((offset & 3) * 2)) & 3);
+#else
+  return 1;
+#endif
+}
+
+/* Returns the grapheme cluster break class of a character */
+static GraphemeBreak CharBreak(sli_char character) {
+#if SLI_CHAR_SIZE > 1
+  const unsigned long code_point = (unsigned long) character;
+  const unsigned int offset_mask = (1U << SLINPUT_BREAK_BLOCK_BITS) - 1;
+  unsigned int block;
+  unsigned int offset;
+
+  if (code_point >= SLINPUT_BREAK_CODE_POINTS)
+    return BREAK_OTHER;
+
+  /* Two level lookup, two classes are packed in each byte of a block */
+  block = SLINPUT_BreakIndex[code_point >> SLINPUT_BREAK_BLOCK_BITS];
+  offset = (unsigned int) code_point & offset_mask;
+  return (GraphemeBreak) ((SLINPUT_BreakBlocks[
+    (block << (SLINPUT_BREAK_BLOCK_BITS - 1)) + (offset >> 1)] >>
+    ((offset & 1) * 4)) & 0xf);
+#else
+  const unsigned char code = (unsigned char) character;
+
+  if (code == '\r')
+    return BREAK_CR;
+  if (code == '\n')
+    return BREAK_LF;
+  if (code < 0x20 || code == 0x7f)
+    return BREAK_CONTROL;
+  return BREAK_OTHER;
+#endif
+}
+
+/* Determines the number of columns the string occupies when displayed */
+static size_t StringColumns(const sli_char *str) {
+  size_t num_columns = 0;
+  while (*str)
+    num_columns += CharWidth(*str++);
+
+  return num_columns;
+}
+
+/* Outputs the characters from str that fit within num_columns. If a wide
+character does not fit, the columns remaining are filled with spaces. Stores
+a pointer to the first character not output in next_ptr. */
+static int OutputColumns(SLINPUT_State *state, ptrdiff_t num_columns,
+    const sli_char *str, const sli_char **next_ptr) {
+  SLINPUT_Stream stream = state->term_info.stream_out;
+  SLINPUT_Putchar *putchar_out = state->term_info.putchar_out;
+  const unsigned char *width =
+    state->line_info.widths + (str - state->line_info.buffer);
+  int result = 0;
+  while (*str && *width <= num_columns) {
+    num_columns -= *width++;
+    result = Minimum(result, (*putchar_out)(state, stream, *str++));
+  }
+
+  if (*str) {
+    while (num_columns-- > 0)
+      result = Minimum(result, (*putchar_out)(state, stream, ' '));
+  }
+
+  *next_ptr = str;
+  return result;
+}
+
+/* Outputs characters until a nil is reached */
+static int OutputChars(SLINPUT_State *state, const sli_char *str) {
+  SLINPUT_Stream stream = state->term_info.stream_out;
+  SLINPUT_Putchar *putchar_out = state->term_info.putchar_out;
+  int result = 0;
+  while (*str)
+    result = Minimum(result, (*putchar_out)(state, stream, *str++));
+
+  return result;
+}
+
+/* Copies characters until a nil or the max_chars count is reached. Returns
+pointer to the destination terminating nil character. */
+static sli_char *CopyChars(sli_ushort max_chars, const sli_char *str,
+    sli_char *dst_ptr) {
+  while (max_chars-- > 0 && *str)
+    *dst_ptr++ = *str++;
+  *dst_ptr = '\0';
+  return dst_ptr;
+}
+
+/* Returns the number of bytes UTF-8 encodes the character in, or zero if it
+is not a Unicode code point */
+static size_t Utf8Length(sli_char character) {
+  const unsigned long code = (unsigned long) character;
+  if (code < 0x80)
+    return 1;
+  if (code < 0x800)
+    return 2;
+  if (code < 0x10000L)
+    return 3;
+
+  return code < 0x110000L ? 4 : 0;
+}
+
+/* Encodes the character as UTF-8. Returns pointer to the following byte. */
+static unsigned char *Utf8Encode(sli_char character, unsigned char *dst_ptr) {
+  static const unsigned char lead_bits[5] = { 0, 0x00, 0xC0, 0xE0, 0xF0 };
+  unsigned long code = (unsigned long) character;
+  const size_t length = Utf8Length(character);
+  size_t index;
+  for (index = length - 1; index > 0; --index) {
+    dst_ptr[index] = (unsigned char) (0x80 | (code & 0x3F));
+    code >>= 6;
+  }
+  dst_ptr[0] = (unsigned char) (lead_bits[length] | code);
+
+  return dst_ptr + length;
+}
+
+/* Decodes a character encoded by Utf8Encode. Returns pointer to the
+following byte. */
+static const unsigned char *Utf8Decode(const unsigned char *src_ptr,
+    sli_char *character) {
+  unsigned long code = *src_ptr++;
+  if (code >= 0xC0) {
+    const unsigned int num_trail = code >= 0xF0 ? 3 : code >= 0xE0 ? 2 : 1;
+    unsigned int index;
+    code &= 0x3FU >> num_trail;
+    for (index = 0; index < num_trail; ++index)
+      code = (code << 6) | (unsigned long) (*src_ptr++ & 0x3F);
+  }
+
+  *character = (sli_char) code;
+  return src_ptr;
+}
+
+/* Returns the number of bytes the character is stored in using the history
+encoding, or zero if the encoding cannot represent it */
+static size_t HistoryCharBytes(sli_ushort encoding, sli_char character) {
+  return encoding == SLINPUT_HE_UTF8 ? Utf8Length(character) :
+    sizeof(sli_char);
+}
+
+/* Stores the character using the history encoding. Returns pointer to the
+following byte. */
+static unsigned char *HistoryWriteChar(sli_ushort encoding,
+    unsigned char *text, sli_char character) {
+  if (encoding == SLINPUT_HE_UTF8)
+    return Utf8Encode(character, text);
+
+  *(sli_char *) text = character;
+  return text + sizeof(sli_char);
+}
+
+/* Reads a character stored using the history encoding. Returns pointer to
+the following byte. */
+static const unsigned char *HistoryReadChar(sli_ushort encoding,
+    const unsigned char *text, sli_char *character) {
+  if (encoding == SLINPUT_HE_UTF8)
+    return Utf8Decode(text, character);
+
+  *character = *(const sli_char *) text;
+  return text + sizeof(sli_char);
+}
+
+/* Reads the character stored using the history encoding that ends at text.
+Returns pointer to the first byte of the character. */
+static const unsigned char *HistoryReadCharBack(sli_ushort encoding,
+    const unsigned char *text, sli_char *character) {
+  if (encoding == SLINPUT_HE_UTF8) {
+    do {
+      --text;
+    } while ((*text & 0xC0) == 0x80);
+
+    Utf8Decode(text, character);
+    return text;
+  }
+
+  text -= sizeof(sli_char);
+  *character = *(const sli_char *) text;
+  return text;
+}
+
+/* Returns the text stored after the header of a history entry */
+static const unsigned char *HistoryText(const HistoryEntry *entry) {
+  return (const unsigned char *) (entry + 1);
+}
+
+/* Returns the history entry at index, counting from the oldest entry */
+static HistoryEntry *HistoryAt(const TermInfo *term_info, size_t index) {
+  return term_info->history[(term_info->first_history + index) %
+    term_info->history_capacity];
+}
+
+/* Returns the context key of the line at index, counting from the oldest
+line */
+static unsigned long HistoryContextAt(const TermInfo *term_info,
+    size_t index) {
+  return term_info->history_contexts ?
+    term_info->history_contexts[(term_info->first_history + index) %
+    term_info->history_capacity] : 0;
+}
+
+/* Sets memory bytes to a value */
+static void MemorySet(void *memory, unsigned char value, size_t num_values) {
+  unsigned char *ptr = (unsigned char *) memory;
+  const unsigned char *end_ptr = ptr + num_values;
+  while (ptr < end_ptr)
+    *ptr++ = value;
+}
+
+/* Copies memory bytes */
+static void MemoryCopy(void *dst, const void *src, size_t num_values) {
+  unsigned char *dst_ptr = (unsigned char *) dst;
+  const unsigned char *src_ptr = (const unsigned char *) src;
+  while (num_values--)
+    *dst_ptr++ = *src_ptr++;
+}
+
+/* Rounds a number of bytes up to keep history entries aligned */
+static size_t HistoryAlign(size_t num_bytes) {
+  return (num_bytes + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+}
+
+/* Returns the chunk bytes a history entry occupies */
+static size_t HistoryEntryBytes(const HistoryEntry *entry) {
+  return HistoryAlign(sizeof(HistoryEntry) + entry->num_bytes);
+}
+
+/* Returns the bytes of a chunk following its header */
+static unsigned char *ChunkData(HistoryChunk *chunk) {
+  return (unsigned char *) (chunk + 1);
+}
+
+/* Returns the bytes of room for more entries a chunk is allocated with.
+Under a budget it is at most a sixteenth of the budget. */
+static size_t HistorySlack(const TermInfo *term_info) {
+  const size_t budget = term_info->history_budget;
+  return budget && budget/16 < SLINPUT_HISTORY_CHUNK_BYTES ? budget/16 :
+    SLINPUT_HISTORY_CHUNK_BYTES;
+}
+
+/* Allocates bytes for a history entry from the newest chunk, adding a chunk
+when there is not enough room */
+static HistoryEntry *HistoryAlloc(TermInfo *term_info, size_t num_bytes) {
+  HistoryChunk *chunk = term_info->history_chunks;
+  HistoryEntry *entry;
+  num_bytes = HistoryAlign(num_bytes);
+  if (!chunk || chunk->num_bytes - chunk->used_bytes < num_bytes) {
+    const size_t slack = HistorySlack(term_info);
+    const size_t chunk_bytes = num_bytes > slack ? num_bytes : slack;
+    chunk = term_info->malloc_in(term_info->alloc_info,
+      sizeof(HistoryChunk) + chunk_bytes);
+    if (!chunk)
+      return NULL;
+
+    chunk->next = term_info->history_chunks;
+    chunk->previous = NULL;
+    chunk->num_bytes = chunk_bytes;
+    chunk->used_bytes = 0;
+    chunk->live_bytes = 0;
+    if (term_info->history_chunks)
+      term_info->history_chunks->previous = chunk;
+    else
+      term_info->history_oldest_chunk = chunk;
+
+    term_info->history_chunks = chunk;
+    term_info->history_chunk_bytes += sizeof(HistoryChunk) + chunk_bytes;
+  }
+
+  entry = (HistoryEntry *) (ChunkData(chunk) + chunk->used_bytes);
+  chunk->used_bytes += num_bytes;
+  chunk->live_bytes += num_bytes;
+  term_info->history_live_bytes += num_bytes;
+  return entry;
+}
+
+/* Returns non-zero if a history entry was allocated from the chunk */
+static int ChunkHolds(HistoryChunk *chunk, const HistoryEntry *entry) {
+  const unsigned char *bytes = (const unsigned char *) entry;
+  return bytes >= ChunkData(chunk) &&
+    bytes < ChunkData(chunk) + chunk->used_bytes;
+}
+
+/* Returns the chunk a history entry was allocated from, searching from the
+oldest and the newest chunk at once, as lines mostly leave history at either
+end */
+static HistoryChunk *HistoryChunkOf(const TermInfo *term_info,
+    const HistoryEntry *entry) {
+  HistoryChunk *older = term_info->history_oldest_chunk;
+  HistoryChunk *newer = term_info->history_chunks;
+  while (!ChunkHolds(older, entry) && !ChunkHolds(newer, entry)) {
+    older = older->previous;
+    newer = newer->next;
+  }
+
+  return ChunkHolds(older, entry) ? older : newer;
+}
+
+/* Releases the chunk bytes of a history entry. The newest entry is returned
+to its chunk, others leave a dead region until the chunks are compacted or
+the rest of their chunk is released, when it is freed. The newest chunk is
+kept for the entries that follow. A packed line's block is freed along with
+the last of its lines. */
+static void HistoryRelease(TermInfo *term_info, HistoryEntry *entry) {
+  HistoryChunk *chunk;
+  size_t num_bytes;
+  if (entry->line) {
+    HistoryBlock *block = (HistoryBlock *) (entry - (entry->line - 1)) - 1;
+    HistoryDecode *decode = term_info->history_decode;
+    if (--block->num_live)
+      return;
+
+    if (decode[0].block == block)
+      decode[0].block = NULL;
+    if (decode[1].block == block)
+      decode[1].block = NULL;
+    if (block->max_bytes == decode->size)
+      --term_info->history_decode_blocks;
+    term_info->history_block_bytes -= block->num_bytes;
+    term_info->free_in(term_info->alloc_info, block);
+    return;
+  }
+
+  chunk = HistoryChunkOf(term_info, entry);
+  num_bytes = HistoryEntryBytes(entry);
+  chunk->live_bytes -= num_bytes;
+  term_info->history_live_bytes -= num_bytes;
+  if ((unsigned char *) entry + num_bytes ==
+      ChunkData(chunk) + chunk->used_bytes)
+    chunk->used_bytes -= num_bytes;
+  else
+    term_info->history_dead_bytes += num_bytes;
+
+  if (chunk->live_bytes)
+    return;
+
+  term_info->history_dead_bytes -= chunk->used_bytes;
+  chunk->used_bytes = 0;
+  if (chunk == term_info->history_chunks)
+    return;
+
+  chunk->previous->next = chunk->next;
+  if (chunk->next)
+    chunk->next->previous = chunk->previous;
+  else
+    term_info->history_oldest_chunk = chunk->previous;
+
+  term_info->history_chunk_bytes -= sizeof(HistoryChunk) + chunk->num_bytes;
+  term_info->free_in(term_info->alloc_info, chunk);
+}
+
+/* Frees every history chunk */
+static void HistoryFreeChunks(TermInfo *term_info) {
+  while (term_info->history_chunks) {
+    HistoryChunk *chunk = term_info->history_chunks;
+    term_info->history_chunks = chunk->next;
+    term_info->free_in(term_info->alloc_info, chunk);
+  }
+
+  term_info->history_oldest_chunk = NULL;
+  term_info->history_chunk_bytes = 0;
+  term_info->history_live_bytes = 0;
+  term_info->history_dead_bytes = 0;
+}
+
+/* Copies the entries in history into a single new chunk, leaving out the
+dead regions, with room for slack bytes more. Packed lines stay in their
+blocks. Nothing is done if memory runs out, as the current chunks remain
+usable. */
+static void HistoryCopyChunks(TermInfo *term_info, size_t slack) {
+  const size_t live_bytes = term_info->history_live_bytes;
+  HistoryChunk *chunk;
+  size_t index;
+  chunk = term_info->malloc_in(term_info->alloc_info,
+    sizeof(HistoryChunk) + live_bytes + slack);
+  if (!chunk)
+    return;
+
+  chunk->next = NULL;
+  chunk->previous = NULL;
+  chunk->num_bytes = live_bytes + slack;
+  chunk->used_bytes = 0;
+  chunk->live_bytes = live_bytes;
+  for (index = 0; index < term_info->num_history; ++index) {
+    HistoryEntry **slot = &term_info->history[(term_info->first_history +
+      index) % term_info->history_capacity];
+    if (*slot && !(*slot)->line) {
+      const size_t num_bytes = HistoryEntryBytes(*slot);
+      HistoryEntry *entry =
+        (HistoryEntry *) (ChunkData(chunk) + chunk->used_bytes);
+      MemoryCopy(entry, *slot, num_bytes);
+      *slot = entry;
+      chunk->used_bytes += num_bytes;
+    }
+  }
+
+  HistoryFreeChunks(term_info);
+  term_info->history_chunks = chunk;
+  term_info->history_oldest_chunk = chunk;
+  term_info->history_chunk_bytes = sizeof(HistoryChunk) + chunk->num_bytes;
+  term_info->history_live_bytes = live_bytes;
+}
+
+/* Compacts the chunks once their dead regions take more room than the
+entries */
+static void HistoryCompact(TermInfo *term_info) {
+  if (term_info->history_dead_bytes > term_info->history_live_bytes &&
+      term_info->history_dead_bytes >= SLINPUT_HISTORY_CHUNK_BYTES)
+    HistoryCopyChunks(term_info, HistorySlack(term_info));
+}
+
+/* Returns the bytes of text of a history entry, without the nil */
+static size_t HistoryTextBytes(const HistoryEntry *entry) {
+  return entry->num_bytes - HistoryCharBytes(entry->encoding, '\0');
+}
+
+/* Stores a count as a base 128 number, low digits first, with the top bit
+set in each byte but the last. Returns pointer to the following byte. */
+static unsigned char *HistoryPutCount(size_t count, unsigned char *bytes) {
+  while (count >= 0x80) {
+    *bytes++ = (unsigned char) ((count & 0x7F) | 0x80);
+    count >>= 7;
+  }
+
+  *bytes++ = (unsigned char) count;
+  return bytes;
+}
+
+/* Reads a count stored by HistoryPutCount. Returns pointer to the following
+byte. */
+static const unsigned char *HistoryGetCount(const unsigned char *bytes,
+    size_t *count) {
+  unsigned int shift = 0;
+  *count = 0;
+  do {
+    *count |= (size_t) (*bytes & 0x7F) << shift;
+    shift += 7;
+  } while (*bytes++ & 0x80);
+
+  return bytes;
+}
+
+/* Returns the number of bytes HistoryPutCount stores for a count */
+static size_t HistoryCountBytes(size_t count) {
+  size_t num_bytes = 1;
+  for (; count >= 0x80; count >>= 7)
+    ++num_bytes;
+
+  return num_bytes;
+}
+
+/* Decodes the text of a packed history entry, continuing from the line the
+decoder holds if it is earlier in the same block. Returns the text. */
+static const unsigned char *HistoryDecodeLine(HistoryDecode *decode,
+    const HistoryEntry *entry) {
+  const HistoryEntry *lines = entry - (entry->line - 1);
+  const HistoryBlock *block = (const HistoryBlock *) lines - 1;
+  const unsigned char *coded =
+    (const unsigned char *) (lines + block->num_lines);
+  if (decode->block != block || decode->line > entry->line) {
+    decode->block = block;
+    decode->offset = 0;
+    decode->line = 0;
+  }
+
+  while (decode->line < entry->line) {
+    const size_t num_bytes = HistoryTextBytes(&lines[decode->line++]);
+    const unsigned char *text;
+    size_t shared;
+    text = HistoryGetCount(coded + decode->offset, &shared);
+    MemoryCopy(decode->bytes + shared, text, num_bytes - shared);
+    decode->offset = (size_t) (text - coded) + num_bytes - shared;
+  }
+
+  return decode->bytes;
+}
+
+/* Finds the text of a history entry, decoded by the decoder given if it is
+packed. Returns the encoding of the text. */
+static sli_ushort HistoryEntryText(HistoryDecode *decode,
+    const HistoryEntry *entry, const unsigned char **text,
+    const unsigned char **text_end) {
+  *text = entry->line ? HistoryDecodeLine(decode, entry) : HistoryText(entry);
+  *text_end = *text + HistoryTextBytes(entry);
+  return entry->encoding;
+}
+
+/* Returns non-zero if both history entries hold the same characters */
+static int HistoryIsSame(const TermInfo *term_info,
+    const HistoryEntry *entry1, const HistoryEntry *entry2) {
+  HistoryDecode *decode = term_info->history_decode;
+  const unsigned char *text1;
+  const unsigned char *text1_end;
+  const unsigned char *text2;
+  const unsigned char *text2_end;
+  const sli_ushort encoding1 =
+    HistoryEntryText(decode, entry1, &text1, &text1_end);
+  const sli_ushort encoding2 =
+    HistoryEntryText(decode ? decode + 1 : NULL, entry2, &text2, &text2_end);
+  sli_char character1;
+  sli_char character2;
+  while (text1 < text1_end && text2 < text2_end) {
+    text1 = HistoryReadChar(encoding1, text1, &character1);
+    text2 = HistoryReadChar(encoding2, text2, &character2);
+    if (character1 != character2)
+      return 0;
+  }
+
+  return text1 == text1_end && text2 == text2_end;
+}
+
+/* Folds an ASCII capital to lower case, for fuzzy matching */
+static sli_char FuzzyLower(sli_char character) {
+  return (sli_char) (character >= 'A' && character <= 'Z' ?
+    character - 'A' + 'a' : character);
+}
+
+/* Returns the bit standing for a character in the masks that rule lines out
+of fuzzy matches before they are scored */
+static sli_ushort FuzzyMaskBit(sli_char character) {
+  return (sli_ushort) (1U << ((unsigned int) FuzzyLower(character) & 15));
+}
+
+/* Returns the hash of a line continued with the character. Starting from
+HistoryHashStart, this is the 32 bit FNV-1a hash of the characters. */
+static unsigned long HistoryHashChar(unsigned long hash, sli_char character) {
+  return ((hash ^ (unsigned long) character) * 16777619UL) & 0xFFFFFFFFUL;
+}
+
+/* Returns the history entry with the sequence number */
+static HistoryEntry *HistorySequenceEntry(const TermInfo *term_info,
+    size_t sequence) {
+  return HistoryAt(term_info, sequence - term_info->first_sequence);
+}
+
+/* Adds a sequence number to the hash table, if there is one */
+static void HistoryTableInsert(TermInfo *term_info, unsigned long hash,
+    size_t sequence) {
+  size_t *table = term_info->history_table;
+  const size_t mask = term_info->history_table_size - 1;
+  size_t slot = (size_t) hash & mask;
+  if (!table)
+    return;
+
+  while (table[slot])
+    slot = (slot + 1) & mask;
+  table[slot] = sequence + 1;
+}
+
+/* Removes the sequence number of an entry from the hash table, if there is
+one and the entry is in it. Later slots of the probe sequence are moved back
+to fill the gap. */
+static void HistoryTableRemove(TermInfo *term_info, const HistoryEntry *entry,
+    size_t sequence) {
+  size_t *table = term_info->history_table;
+  const size_t mask = term_info->history_table_size - 1;
+  size_t slot = (size_t) entry->hash & mask;
+  size_t next;
+  if (!table)
+    return;
+
+  while (table[slot] != sequence + 1) {
+    if (!table[slot])
+      return;
+
+    slot = (slot + 1) & mask;
+  }
+
+  for (next = (slot + 1) & mask; table[next]; next = (next + 1) & mask) {
+    const size_t home = (size_t) HistorySequenceEntry(term_info,
+      table[next] - 1)->hash & mask;
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      table[slot] = table[next];
+      slot = next;
+    }
+  }
+
+  table[slot] = 0;
+}
+
+/* Returns the sequence number plus one of the entry in the hash table
+holding the same characters as entry, or zero if there is none */
+static size_t HistoryTableMatch(const TermInfo *term_info,
+    const HistoryEntry *entry) {
+  const size_t *table = term_info->history_table;
+  const size_t mask = term_info->history_table_size - 1;
+  size_t slot;
+  for (slot = (size_t) entry->hash & mask; table[slot];
+      slot = (slot + 1) & mask) {
+    const HistoryEntry *other =
+      HistorySequenceEntry(term_info, table[slot] - 1);
+    if (other->hash == entry->hash &&
+        HistoryIsSame(term_info, other, entry))
+      return table[slot];
+  }
+
+  return 0;
+}
+
+/* Erases the entry with the sequence number, leaving its ring slot NULL
+until the ring is squeezed. The caller removes it from the hash table. */
+static void HistoryErase(TermInfo *term_info, size_t sequence) {
+  HistoryEntry **slot = &term_info->history[(term_info->first_history +
+    sequence - term_info->first_sequence) % term_info->history_capacity];
+  HistoryRelease(term_info, *slot);
+  *slot = NULL;
+  ++term_info->num_erased;
+}
+
+/* Empties a list of ordinals */
+static void OrdinalListInit(OrdinalList *list) {
+  list->ordinals = NULL;
+  list->ordinals_base = NULL;
+  list->num_ordinals = 0;
+  list->ordinals_size = 0;
+}
+
+/* Frees the ordinals of a list */
+static void OrdinalListFree(TermInfo *term_info, OrdinalList *list) {
+  if (list->ordinals_base) {
+    term_info->free_in(term_info->alloc_info, list->ordinals_base);
+    term_info->index_bytes -= sizeof(unsigned long)*list->ordinals_size;
+  }
+}
+
+/* Returns the slot of the context table for a context key */
+static size_t ContextSlot(const TermInfo *term_info, unsigned long context) {
+  return (size_t) (context ^ context >> 16) &
+    (term_info->context_table_size - 1);
+}
+
+/* Frees a context of the context index, with its lines */
+static void ContextFree(TermInfo *term_info, HistoryContext *context) {
+  OrdinalListFree(term_info, &context->lines);
+  term_info->free_in(term_info->alloc_info, context);
+  term_info->index_bytes -= sizeof(HistoryContext);
+}
+
+/* Doubles the slots of the context table, or allocates the first, moving
+the contexts into their new slots */
+static int ContextTableGrow(TermInfo *term_info) {
+  HistoryContext **old_table = term_info->context_table;
+  const size_t old_size = term_info->context_table_size;
+  const size_t size = old_size ? 2*old_size : 8;
+  HistoryContext **table;
+  size_t index;
+  table = term_info->malloc_in(term_info->alloc_info,
+    sizeof(HistoryContext *)*size);
+  if (!table) {
+    /* Out of memory */
+    return -1;
+  }
+
+  term_info->index_bytes += sizeof(HistoryContext *)*size;
+  for (index = 0; index < size; ++index)
+    table[index] = NULL;
+
+  term_info->context_table = table;
+  term_info->context_table_size = size;
+  for (index = 0; index < old_size; ++index) {
+    while (old_table[index]) {
+      HistoryContext *context = old_table[index];
+      HistoryContext **link =
+        &table[ContextSlot(term_info, context->context)];
+      old_table[index] = context->next;
+      context->next = *link;
+      *link = context;
+    }
+  }
+
+  if (old_table) {
+    term_info->free_in(term_info->alloc_info, old_table);
+    term_info->index_bytes -= sizeof(HistoryContext *)*old_size;
+  }
+
+  return 0;
+}
+
+/* Returns the link in the context table to a context, or to the NULL ending
+its slot if it is not in the table */
+static HistoryContext **ContextLink(const TermInfo *term_info,
+    unsigned long context) {
+  HistoryContext **link =
+    &term_info->context_table[ContextSlot(term_info, context)];
+  while (*link && (*link)->context != context)
+    link = &(*link)->next;
+
+  return link;
+}
+
+/* Finds a context in the context index, adding it if add is non-zero.
+Returns NULL if it is not found, or if out of memory. */
+static HistoryContext *ContextFind(TermInfo *term_info,
+    unsigned long context, int add) {
+  HistoryContext *found = term_info->context_table ?
+    *ContextLink(term_info, context) : NULL;
+  HistoryContext **link;
+  if (found || !add)
+    return found;
+
+  if (term_info->num_contexts >= term_info->context_table_size &&
+      ContextTableGrow(term_info) < 0)
+    return NULL;
+
+  found = term_info->malloc_in(term_info->alloc_info, sizeof(HistoryContext));
+  if (!found) {
+    /* Out of memory */
+    return NULL;
+  }
+
+  term_info->index_bytes += sizeof(HistoryContext);
+
+  link = ContextLink(term_info, context);
+  found->next = *link;
+  found->context = context;
+  OrdinalListInit(&found->lines);
+  *link = found;
+  ++term_info->num_contexts;
+  if (context == term_info->history_context)
+    term_info->context_lines = found;
+
+  return found;
+}
+
+/* Frees the context of a line leaving the ring, once no newer line of the
+context is left */
+static void ContextDrop(TermInfo *term_info, unsigned long context_key,
+    unsigned long ordinal) {
+  HistoryContext **link;
+  HistoryContext *context;
+  if (!context_key || !term_info->context_table)
+    return;
+
+  link = ContextLink(term_info, context_key);
+  context = *link;
+  if (!context || (context->lines.num_ordinals &&
+      context->lines.ordinals[context->lines.num_ordinals - 1] > ordinal))
+    return;
+
+  *link = context->next;
+  --term_info->num_contexts;
+  if (context == term_info->context_lines)
+    term_info->context_lines = NULL;
+
+  ContextFree(term_info, context);
+}
+
+/* Removes the oldest history entry, or erased slot */
+static void HistoryDropOldest(TermInfo *term_info) {
+  HistoryEntry *entry = term_info->history[term_info->first_history];
+  if (term_info->context_indexed) {
+    ContextDrop(term_info, HistoryContextAt(term_info, 0),
+      term_info->history_file_end + 1 + term_info->first_sequence);
+  }
+
+  if (entry) {
+    HistoryTableRemove(term_info, entry, term_info->first_sequence);
+    HistoryRelease(term_info, entry);
+  } else {
+    --term_info->num_erased;
+  }
+
+  term_info->first_history =
+    (term_info->first_history + 1) % term_info->history_capacity;
+  ++term_info->first_sequence;
+  --term_info->num_history;
+  if (term_info->history_packed)
+    --term_info->history_packed;
+}
+
+/* Returns the bytes allocated for both decoders with room for a line of
+max_bytes */
+static size_t HistoryDecodeBytes(size_t max_bytes) {
+  return HistoryAlign(2*sizeof(HistoryDecode)) + 2*HistoryAlign(max_bytes);
+}
+
+/* Reallocates both decoders with room for a line of max_bytes, without the
+lines they hold */
+static int HistoryDecodeAlloc(TermInfo *term_info, size_t max_bytes) {
+  const size_t decode_bytes = HistoryAlign(2*sizeof(HistoryDecode));
+  HistoryDecode *decode;
+  size_t index;
+  decode = term_info->malloc_in(term_info->alloc_info,
+    HistoryDecodeBytes(max_bytes));
+  if (!decode) {
+    /* Out of memory */
+    return -1;
+  }
+
+  for (index = 0; index < 2; ++index) {
+    decode[index].block = NULL;
+    decode[index].offset = 0;
+    decode[index].bytes = (unsigned char *) decode + decode_bytes +
+      index*HistoryAlign(max_bytes);
+    decode[index].size = max_bytes;
+    decode[index].line = 0;
+  }
+
+  if (term_info->history_decode)
+    term_info->free_in(term_info->alloc_info, term_info->history_decode);
+
+  term_info->history_decode = decode;
+  return 0;
+}
+
+/* Makes room in both decoders for a line of max_bytes, reallocating them
+without the lines they hold if needed */
+static int HistoryDecodeReserve(TermInfo *term_info, size_t max_bytes) {
+  const HistoryDecode *decode = term_info->history_decode;
+  if (decode && decode->size >= max_bytes)
+    return 0;
+
+  term_info->history_decode_blocks = 0;
+  return HistoryDecodeAlloc(term_info, max_bytes);
+}
+
+/* Shrinks both decoders to the longest line of the blocks left, once no
+block has a line as long as they hold, or frees them once no block is left.
+If memory runs out they are kept as they are. */
+static void HistoryDecodeFit(TermInfo *term_info) {
+  const HistoryBlock *previous = NULL;
+  size_t max_bytes = 0;
+  size_t num_blocks = 0;
+  size_t index;
+  if (!term_info->history_decode || term_info->history_decode_blocks)
+    return;
+
+  for (index = 0; index < term_info->history_packed; ++index) {
+    const HistoryEntry *entry = HistoryAt(term_info, index);
+    const HistoryBlock *block = entry && entry->line ?
+      (const HistoryBlock *) (entry - (entry->line - 1)) - 1 : NULL;
+    if (block && block != previous) {
+      if (!previous || max_bytes < block->max_bytes) {
+        max_bytes = block->max_bytes;
+        num_blocks = 0;
+      }
+
+      if (block->max_bytes == max_bytes)
+        ++num_blocks;
+      previous = block;
+    }
+  }
+
+  if (!previous) {
+    term_info->free_in(term_info->alloc_info, term_info->history_decode);
+    term_info->history_decode = NULL;
+  } else if (max_bytes == term_info->history_decode->size ||
+      HistoryDecodeAlloc(term_info, max_bytes) == 0) {
+    term_info->history_decode_blocks = num_blocks;
+  }
+}
+
+/* Returns the bytes of text of the longest line HistoryPack packs next */
+static size_t HistoryPackBytes(const TermInfo *term_info) {
+  const size_t first = term_info->history_packed;
+  size_t max_bytes = 0;
+  size_t index;
+  for (index = first; index < term_info->num_history &&
+      index < first + SLINPUT_HISTORY_BLOCK_LINES; ++index) {
+    const HistoryEntry *entry = HistoryAt(term_info, index);
+    if (entry && max_bytes < HistoryTextBytes(entry))
+      max_bytes = HistoryTextBytes(entry);
+  }
+
+  return max_bytes;
+}
+
+/* Returns the number of leading bytes of text a history entry shares with
+the one before it, when both have their text following the header */
+static size_t HistoryShared(const HistoryEntry *previous,
+    const HistoryEntry *entry) {
+  const unsigned char *text1;
+  const unsigned char *text2;
+  size_t num_bytes;
+  size_t shared = 0;
+  if (!previous || previous->encoding != entry->encoding)
+    return 0;
+
+  text1 = HistoryText(previous);
+  text2 = HistoryText(entry);
+  num_bytes = HistoryTextBytes(previous) < HistoryTextBytes(entry) ?
+    HistoryTextBytes(previous) : HistoryTextBytes(entry);
+  while (shared < num_bytes && text1[shared] == text2[shared])
+    ++shared;
+
+  return shared;
+}
+
+/* Packs the oldest lines in history not yet considered into a front coded
+block, once twice SLINPUT_HISTORY_BLOCK_LINES lines wait, so that the newest
+lines are always held whole. If memory runs out the lines are left as they
+are, and packed after a later save. */
+static void HistoryPack(TermInfo *term_info) {
+  const size_t first = term_info->history_packed;
+  const size_t end = first + SLINPUT_HISTORY_BLOCK_LINES;
+  const HistoryEntry *previous = NULL;
+  HistoryBlock *block;
+  HistoryEntry *lines;
+  unsigned char *coded;
+  size_t coded_bytes = 0;
+  size_t max_bytes = 0;
+  sli_ushort num_lines = 0;
+  size_t index;
+  if (!term_info->front_coding ||
+      term_info->num_history < end + SLINPUT_HISTORY_BLOCK_LINES)
+    return;
+
+  for (index = first; index < end; ++index) {
+    const HistoryEntry *entry = HistoryAt(term_info, index);
+    if (entry) {
+      const size_t num_bytes = HistoryTextBytes(entry);
+      const size_t shared = HistoryShared(previous, entry);
+      coded_bytes += HistoryCountBytes(shared) + num_bytes - shared;
+      if (max_bytes < num_bytes)
+        max_bytes = num_bytes;
+
+      ++num_lines;
+      previous = entry;
+    }
+  }
+
+  if (num_lines) {
+    if (HistoryDecodeReserve(term_info, max_bytes) < 0)
+      return;
+
+    coded_bytes += sizeof(HistoryBlock) + sizeof(HistoryEntry)*num_lines;
+    block = term_info->malloc_in(term_info->alloc_info, coded_bytes);
+    if (!block)
+      return;
+
+    term_info->history_block_bytes += coded_bytes;
+    block->num_bytes = coded_bytes;
+    block->max_bytes = max_bytes;
+    block->num_lines = num_lines;
+    block->num_live = num_lines;
+    lines = (HistoryEntry *) (block + 1);
+    coded = (unsigned char *) (lines + num_lines);
+    if (max_bytes == term_info->history_decode->size)
+      ++term_info->history_decode_blocks;
+
+    previous = NULL;
+    num_lines = 0;
+    for (index = first; index < end; ++index) {
+      const HistoryEntry *entry = HistoryAt(term_info, index);
+      if (entry) {
+        const size_t num_bytes = HistoryTextBytes(entry);
+        const size_t shared = HistoryShared(previous, entry);
+        coded = HistoryPutCount(shared, coded);
+        MemoryCopy(coded, HistoryText(entry) + shared, num_bytes - shared);
+        coded += num_bytes - shared;
+        lines[num_lines] = *entry;
+        lines[num_lines].line = (sli_ushort) (num_lines + 1);
+        ++num_lines;
+        previous = entry;
+      }
+    }
+
+    /* Releasing an entry may free its chunk, so the entries are only
+    released once all are coded */
+    num_lines = 0;
+    for (index = first; index < end; ++index) {
+      HistoryEntry **slot = &term_info->history[(term_info->first_history +
+        index) % term_info->history_capacity];
+      if (*slot) {
+        HistoryRelease(term_info, *slot);
+        *slot = &lines[num_lines++];
+      }
+    }
+  }
+
+  term_info->history_packed = end;
+}
+
+/* Returns the bytes allocated for history whatever lines it holds: the
+ring, the contexts of its lines, the hash table and the decoders */
+static size_t HistoryFixedBytes(const TermInfo *term_info) {
+  size_t num_bytes = 0;
+  if (term_info->history)
+    num_bytes += sizeof(HistoryEntry *)*term_info->history_capacity;
+
+  if (term_info->history_contexts)
+    num_bytes += sizeof(unsigned long)*term_info->history_capacity;
+
+  if (term_info->history_table)
+    num_bytes += sizeof(size_t)*term_info->history_table_size;
+
+  if (term_info->history_decode)
+    num_bytes += HistoryDecodeBytes(term_info->history_decode->size);
+
+  return num_bytes;
+}
+
+/* Returns the bytes of memory allocated for history that count against the
+budget, including the room in its chunks not yet used but not the indexes */
+static size_t HistoryBytes(const TermInfo *term_info) {
+  return HistoryFixedBytes(term_info) + term_info->history_chunk_bytes +
+    term_info->history_block_bytes;
+}
+
+/* Frees a node of the prefix index, with the nodes that follow it */
+static void PrefixFree(TermInfo *term_info, PrefixNode *node) {
+  while (node) {
+    PrefixNode *sibling = node->sibling;
+    PrefixFree(term_info, node->child);
+    OrdinalListFree(term_info, &node->lines);
+    term_info->free_in(term_info->alloc_info, node);
+    term_info->index_bytes -= sizeof(PrefixNode);
+    node = sibling;
+  }
+}
+
+/* Discards the prefix index. It is rebuilt when history is next browsed by
+prefix. */
+static void PrefixIndexReset(TermInfo *term_info) {
+  PrefixFree(term_info, term_info->prefix_index);
+  term_info->prefix_index = NULL;
+  term_info->prefix_file_next = 0;
+}
+
+/* Discards the prefix and context indexes when the ordinals of lines
+change. They are rebuilt when history is next browsed by prefix or in a
+context. */
+static void HistoryIndexReset(TermInfo *term_info) {
+  size_t index;
+  PrefixIndexReset(term_info);
+  for (index = 0; index < term_info->context_table_size; ++index) {
+    while (term_info->context_table[index]) {
+      HistoryContext *context = term_info->context_table[index];
+      term_info->context_table[index] = context->next;
+      ContextFree(term_info, context);
+    }
+  }
+
+  if (term_info->context_table) {
+    term_info->free_in(term_info->alloc_info, term_info->context_table);
+    term_info->index_bytes -=
+      sizeof(HistoryContext *)*term_info->context_table_size;
+  }
+
+  term_info->context_table = NULL;
+  term_info->context_table_size = 0;
+  term_info->num_contexts = 0;
+  term_info->context_lines = NULL;
+  term_info->context_indexed = 0;
+}
+
+/* Removes the oldest lines in history until what is allocated for history
+fits the budget, first shrinking the decoders if they can be. The chunks are
+freed as the lines leave them, and are only copied once their dead regions
+take more room than the entries, or to fit the last line left. */
+static void HistoryFitBudget(TermInfo *term_info) {
+  const size_t budget = term_info->history_budget;
+  const size_t slack = HistorySlack(term_info);
+  HistoryDecodeFit(term_info);
+  if (!budget)
+    return;
+
+  while (term_info->num_history && HistoryBytes(term_info) > budget) {
+    const size_t num_bytes = HistoryBytes(term_info) -
+      term_info->history_chunk_bytes + sizeof(HistoryChunk) +
+      term_info->history_live_bytes;
+    if (!term_info->history_live_bytes) {
+      HistoryFreeChunks(term_info);
+    } else if ((term_info->history_dead_bytes >
+        term_info->history_live_bytes || term_info->num_history == 1) &&
+        num_bytes <= budget) {
+      HistoryCopyChunks(term_info,
+        budget - num_bytes < slack ? budget - num_bytes : slack);
+    }
+
+    if (HistoryBytes(term_info) > budget) {
+      HistoryDropOldest(term_info);
+      HistoryDecodeFit(term_info);
+    }
+  }
+
+  if (!term_info->num_history)
+    HistoryFreeChunks(term_info);
+}
+
+/* Returns the index of the first ordinal listed that is not less than the
+ordinal given */
+static size_t OrdinalLowerBound(const OrdinalList *list,
+    unsigned long ordinal) {
+  size_t lower = 0;
+  size_t upper = list->num_ordinals;
+  while (lower < upper) {
+    const size_t middle = lower + (upper - lower)/2;
+    if (list->ordinals[middle] < ordinal)
+      lower = middle + 1;
+    else
+      upper = middle;
+  }
+
+  return lower;
+}
+
+/* Makes room for another ordinal in a list, after those listed, or before
+them for an older line loaded from the history file. The ordinals of lines
+since dropped from the ring are removed first, and the list is only grown if
+that does not free any. Growing keeps the room on the other side. */
+static int OrdinalGrow(TermInfo *term_info, OrdinalList *list, int older) {
+  const size_t dropped = OrdinalLowerBound(list,
+    term_info->history_file_end + 1);
+  const size_t kept = OrdinalLowerBound(list,
+    term_info->history_file_end + 1 + term_info->first_sequence);
+  const size_t size = list->ordinals_size ? 2*list->ordinals_size : 4;
+  unsigned long *ordinals;
+  size_t start;
+  size_t index;
+  if (!older && dropped < kept) {
+    for (index = kept; index < list->num_ordinals; ++index)
+      list->ordinals[dropped + index - kept] = list->ordinals[index];
+
+    list->num_ordinals -= kept - dropped;
+    return 0;
+  }
+
+  ordinals = term_info->malloc_in(term_info->alloc_info,
+    sizeof(unsigned long)*size);
+  if (!ordinals) {
+    /* Out of memory */
+    return -1;
+  }
+
+  term_info->index_bytes += sizeof(unsigned long)*size;
+
+  start = list->ordinals_base ?
+    (size_t) (list->ordinals - list->ordinals_base) : 0;
+  if (older)
+    start += size - list->ordinals_size;
+
+  for (index = 0; index < list->num_ordinals; ++index)
+    ordinals[start + index] = list->ordinals[index];
+
+  OrdinalListFree(term_info, list);
+  list->ordinals_base = ordinals;
+  list->ordinals = ordinals + start;
+  list->ordinals_size = size;
+  return 0;
+}
+
+/* Adds the ordinal of a line to a list. The line is newer than those
+listed, or older if loaded from the history file. */
+static int OrdinalAdd(TermInfo *term_info, OrdinalList *list,
+    unsigned long ordinal, int older) {
+  if (older) {
+    if (list->ordinals == list->ordinals_base &&
+        OrdinalGrow(term_info, list, 1) < 0)
+      return -1;
+
+    *--list->ordinals = ordinal;
+    ++list->num_ordinals;
+  } else {
+    if ((!list->ordinals_base || list->ordinals + list->num_ordinals ==
+        list->ordinals_base + list->ordinals_size) &&
+        OrdinalGrow(term_info, list, 0) < 0)
+      return -1;
+
+    list->ordinals[list->num_ordinals++] = ordinal;
+  }
+
+  return 0;
+}
+
+/* Lists the ordinal of a line at the prefix index nodes for its leading
+characters, adding nodes as needed. The line is newer than those listed, or
+older if loaded from the history file. */
+static int PrefixAdd(TermInfo *term_info, const unsigned char *text,
+    const unsigned char *text_end, sli_ushort encoding,
+    unsigned long ordinal, int older) {
+  PrefixNode *node = term_info->prefix_index;
+  size_t depth;
+  for (depth = 0; depth < SLINPUT_PREFIX_CHARS && text < text_end; ++depth) {
+    PrefixNode **link = &node->child;
+    sli_char character;
+    text = HistoryReadChar(encoding, text, &character);
+    while (*link && (*link)->character != character)
+      link = &(*link)->sibling;
+
+    if (!*link) {
+      *link = term_info->malloc_in(term_info->alloc_info, sizeof(PrefixNode));
+      if (!*link) {
+        /* Out of memory */
+        return -1;
+      }
+
+      term_info->index_bytes += sizeof(PrefixNode);
+
+      (*link)->child = NULL;
+      (*link)->sibling = NULL;
+      OrdinalListInit(&(*link)->lines);
+      (*link)->character = character;
+    }
+
+    node = *link;
+    if (OrdinalAdd(term_info, &node->lines, ordinal, older) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Lists the ordinal of a line in the ring at the context it was saved in,
+unless it has none */
+static int ContextAdd(TermInfo *term_info, unsigned long context_key,
+    unsigned long ordinal) {
+  HistoryContext *context;
+  if (!context_key)
+    return 0;
+
+  context = ContextFind(term_info, context_key, 1);
+  return context ? OrdinalAdd(term_info, &context->lines, ordinal, 0) : -1;
+}
+
+/* Moves the entries in history together, leaving out erased slots. The
+caller rebuilds the hash table, as sequence numbers change, while the prefix
+and context indexes are discarded. */
+static void HistorySqueeze(TermInfo *term_info) {
+  size_t num_history = 0;
+  size_t num_packed = 0;
+  size_t index;
+  for (index = 0; index < term_info->num_history; ++index) {
+    HistoryEntry *entry = HistoryAt(term_info, index);
+    if (entry) {
+      const size_t slot = (term_info->first_history + num_history++) %
+        term_info->history_capacity;
+      if (term_info->history_contexts) {
+        term_info->history_contexts[slot] =
+          HistoryContextAt(term_info, index);
+      }
+
+      term_info->history[slot] = entry;
+      if (index < term_info->history_packed)
+        ++num_packed;
+    }
+  }
+
+  term_info->num_history = num_history;
+  term_info->history_packed = num_packed;
+  term_info->num_erased = 0;
+  HistoryIndexReset(term_info);
+}
+
+/* Rebuilds the hash table used to find duplicates, sized for the capacity,
+holding the newest copy of each line in history. Older copies are erased if
+erasing duplicates. The table is freed when history has no capacity. */
+static int HistoryTableRebuild(TermInfo *term_info) {
+  size_t table_size = 8;
+  size_t index;
+  if (term_info->history_table) {
+    term_info->free_in(term_info->alloc_info, term_info->history_table);
+    term_info->history_table = NULL;
+  }
+
+  if (!term_info->history_capacity)
+    return 0;
+
+  while (table_size < 2*term_info->history_capacity)
+    table_size *= 2;
+
+  term_info->history_table = term_info->malloc_in(term_info->alloc_info,
+    sizeof(size_t)*table_size);
+  if (!term_info->history_table) {
+    /* Out of memory */
+    return -1;
+  }
+
+  term_info->history_table_size = table_size;
+  for (index = 0; index < table_size; ++index)
+    term_info->history_table[index] = 0;
+
+  /* Add entries newest first, so older duplicates are the ones left out, or
+  erased if erasing duplicates. Older duplicates saved while there was no
+  table give up their frecency, so each line is ranked once. */
+  for (index = term_info->num_history; index-- > 0; ) {
+    HistoryEntry *entry = HistoryAt(term_info, index);
+    if (entry) {
+      if (HistoryTableMatch(term_info, entry)) {
+        entry->frecency = 0;
+        if (term_info->erase_duplicates)
+          HistoryErase(term_info, term_info->first_sequence + index);
+      } else
+        HistoryTableInsert(term_info, entry->hash,
+          term_info->first_sequence + index);
+    }
+  }
+
+  return 0;
+}
+
+/* Returns the frecency of a history entry decayed to the history clock. It
+halves every SLINPUT_FRECENCY_HALF_LIFE uses, falling linearly in between. */
+static unsigned long FrecencyNow(const TermInfo *term_info,
+    const HistoryEntry *entry) {
+  const unsigned long elapsed = term_info->history_clock - entry->last_use;
+  unsigned long frecency = entry->frecency;
+  if (elapsed/SLINPUT_FRECENCY_HALF_LIFE >= 16)
+    return 0;
+
+  frecency >>= elapsed/SLINPUT_FRECENCY_HALF_LIFE;
+  return frecency - frecency*(elapsed % SLINPUT_FRECENCY_HALF_LIFE)/
+    (2*SLINPUT_FRECENCY_HALF_LIFE);
+}
+
+/* Records a use of a history entry, adding to its decayed frecency */
+static void FrecencyUse(TermInfo *term_info, HistoryEntry *entry,
+    unsigned long frecency) {
+  frecency += FRECENCY_USE;
+  entry->frecency = (sli_ushort) (frecency < 0xFFFF ? frecency : 0xFFFF);
+  entry->last_use = ++term_info->history_clock;
+}
+
+/* Stores a line in the history ring with '\r' and '\n' characters removed,
+deleting the oldest line when full. Returns 1 if stored, 2 if the line is
+too long to keep within the budget, or 0 if the line is empty or the same as
+the newest. */
+static int HistorySave(TermInfo *term_info, const sli_char *line) {
+  sli_ushort encoding = term_info->history_encoding;
+  size_t num_chars = 0;
+  size_t num_bytes = 0;
+  const sli_char *ptr;
+  unsigned long frecency = 0;
+  unsigned long ordinal;
+  size_t index;
+  HistoryEntry *newest;
+  HistoryEntry *entry;
+  unsigned char *text;
+
+  /* Work out how long the line is with newlines removed, and the bytes
+  needed to store it */
+  for (ptr = line; *ptr; ++ptr) {
+    if (*ptr != '\r' && *ptr != '\n') {
+      size_t char_bytes = HistoryCharBytes(encoding, *ptr);
+      if (!char_bytes) {
+        /* Not representable in the encoding, so store the line natively */
+        encoding = SLINPUT_HE_NATIVE;
+        num_bytes = sizeof(sli_char)*num_chars;
+        char_bytes = sizeof(sli_char);
+      }
+
+      ++num_chars;
+      num_bytes += char_bytes;
+    }
+  }
+
+  if (num_chars == 0 || !term_info->history_capacity)
+    return 0;
+
+  if (!term_info->history) {
+    term_info->history = term_info->malloc_in(term_info->alloc_info,
+      sizeof(HistoryEntry *)*term_info->history_capacity);
+    if (!term_info->history) {
+      /* Out of memory */
+      return -1;
+    }
+  }
+
+  /* Lines saved before the first context have none */
+  if (term_info->history_context && !term_info->history_contexts) {
+    term_info->history_contexts = term_info->malloc_in(term_info->alloc_info,
+      sizeof(unsigned long)*term_info->history_capacity);
+    if (!term_info->history_contexts) {
+      /* Out of memory */
+      return -1;
+    }
+
+    for (index = 0; index < term_info->history_capacity; ++index)
+      term_info->history_contexts[index] = 0;
+  }
+
+  /* Without memory for the table, a line is saved without the frecency of
+  an older copy, unless erasing duplicates needs the table to find it */
+  if (!term_info->history_table && HistoryTableRebuild(term_info) < 0 &&
+      term_info->erase_duplicates)
+    return -1;
+
+  /* A line that can't fit the budget, even alone beside decoders grown for
+  the lines packed next and itself, is not kept in memory, though it is still
+  appended to the history file */
+  num_bytes += HistoryCharBytes(encoding, '\0');
+  if (term_info->history_budget) {
+    size_t fixed_bytes = HistoryFixedBytes(term_info);
+    if (term_info->front_coding) {
+      const size_t decode_size = term_info->history_decode ?
+        term_info->history_decode->size : 0;
+      size_t max_bytes = HistoryPackBytes(term_info);
+      if (max_bytes < num_bytes - HistoryCharBytes(encoding, '\0'))
+        max_bytes = num_bytes - HistoryCharBytes(encoding, '\0');
+      if (max_bytes > decode_size || !term_info->history_decode) {
+        fixed_bytes += HistoryDecodeBytes(max_bytes) -
+          (term_info->history_decode ? HistoryDecodeBytes(decode_size) : 0);
+      }
+    }
+
+    if (term_info->history_budget < fixed_bytes + sizeof(HistoryChunk) +
+        HistoryAlign(sizeof(HistoryEntry) + num_bytes))
+      return 2;
+  }
+
+  /* Allocate the entry and store the line with newlines removed */
+  entry = HistoryAlloc(term_info, sizeof(HistoryEntry) + num_bytes);
+  if (!entry) {
+    /* Out of memory */
+    return -1;
+  }
+
+  entry->num_bytes = num_bytes;
+  entry->line = 0;
+  entry->hash = HistoryHashStart;
+  entry->char_mask = 0;
+  entry->encoding = encoding;
+  text = (unsigned char *) (entry + 1);
+  for (ptr = line; *ptr; ++ptr) {
+    if (*ptr != '\r' && *ptr != '\n') {
+      text = HistoryWriteChar(encoding, text, *ptr);
+      entry->hash = HistoryHashChar(entry->hash, *ptr);
+      entry->char_mask = (sli_ushort) (entry->char_mask | FuzzyMaskBit(*ptr));
+    }
+  }
+  HistoryWriteChar(encoding, text, '\0');
+
+  /* Don't save the line if it is identical to the previous one */
+  newest = term_info->num_history ?
+    HistoryAt(term_info, term_info->num_history - 1) : NULL;
+  if (newest && newest->hash == entry->hash &&
+      HistoryIsSame(term_info, entry, newest)) {
+    HistoryRelease(term_info, entry);
+    FrecencyUse(term_info, newest, FrecencyNow(term_info, newest));
+    return 0;
+  }
+
+  /* Take the frecency of an older copy of the line, which leaves the table.
+  It is erased, so it is only kept as the newest, if erasing duplicates. */
+  if (term_info->history_table) {
+    const size_t match = HistoryTableMatch(term_info, entry);
+    if (match) {
+      HistoryEntry *older = HistorySequenceEntry(term_info, match - 1);
+      frecency = FrecencyNow(term_info, older);
+      older->frecency = 0;
+      HistoryTableRemove(term_info, older, match - 1);
+      if (term_info->erase_duplicates)
+        HistoryErase(term_info, match - 1);
+    }
+  }
+
+  FrecencyUse(term_info, entry, frecency);
+
+  /* If history is full, then squeeze out erased slots once they take a
+  quarter of it, otherwise delete the oldest */
+  if (term_info->num_history == term_info->history_capacity) {
+    if (term_info->num_erased*4 >= term_info->history_capacity) {
+      HistorySqueeze(term_info);
+      HistoryTableRebuild(term_info);
+    } else {
+      HistoryDropOldest(term_info);
+    }
+  }
+
+  /* Store the new history */
+  HistoryTableInsert(term_info, entry->hash,
+    term_info->first_sequence + term_info->num_history);
+  if (term_info->history_contexts) {
+    term_info->history_contexts[(term_info->first_history +
+      term_info->num_history) % term_info->history_capacity] =
+      term_info->history_context;
+  }
+  term_info->history[(term_info->first_history + term_info->num_history++) %
+    term_info->history_capacity] = entry;
+  HistoryPack(term_info);
+  HistoryFitBudget(term_info);
+  HistoryCompact(term_info);
+
+  /* Only the newest line is left to remove once the others are, so the line
+  is not kept if no line is */
+  if (!term_info->num_history)
+    return 2;
+
+  /* The indexes are discarded if they can't be kept up to date. The entry
+  may have been moved by compaction. */
+  entry = HistoryAt(term_info, term_info->num_history - 1);
+  ordinal = term_info->history_file_end + term_info->first_sequence +
+    term_info->num_history;
+  if ((term_info->prefix_index && PrefixAdd(term_info, HistoryText(entry),
+      HistoryText(entry) + num_bytes - HistoryCharBytes(encoding, '\0'),
+      encoding, ordinal, 0) < 0) ||
+      (term_info->context_indexed && ContextAdd(term_info,
+      term_info->history_context, ordinal) < 0))
+    HistoryIndexReset(term_info);
+
+  return 1;
+}
+
+/* Returns the 32 bit little endian value stored at bytes */
+static unsigned long GetLong32(const unsigned char *bytes) {
+  return (unsigned long) bytes[0] | (unsigned long) bytes[1] << 8 |
+    (unsigned long) bytes[2] << 16 | (unsigned long) bytes[3] << 24;
+}
+
+/* Stores a 32 bit little endian value. Returns pointer to the following
+byte. */
+static unsigned char *PutLong32(unsigned long value, unsigned char *bytes) {
+  bytes[0] = (unsigned char) (value & 0xFF);
+  bytes[1] = (unsigned char) (value >> 8 & 0xFF);
+  bytes[2] = (unsigned char) (value >> 16 & 0xFF);
+  bytes[3] = (unsigned char) (value >> 24 & 0xFF);
+  return bytes + 4;
+}
+
+/* Returns the 32 bit FNV-1a hash of bytes, checking history file records */
+static unsigned long Checksum(const unsigned char *bytes, size_t num_bytes) {
+  unsigned long hash = HistoryHashStart;
+  while (num_bytes--)
+    hash = ((hash ^ *bytes++) * 16777619UL) & 0xFFFFFFFFUL;
+
+  return hash;
+}
+
+/* Returns the start offset of the history file record ending at end, or zero
+if there is no intact record there */
+static unsigned long HistoryFileRecordStart(const TermInfo *term_info,
+    unsigned long end) {
+  const unsigned char *contents = term_info->history_file.contents;
+  unsigned long num_bytes;
+  unsigned long start;
+  if (end < sizeof(HistoryFileMagic) + HISTORY_RECORD_HEAD +
+      HISTORY_RECORD_TAIL)
+    return 0;
+
+  num_bytes = GetLong32(contents + end - HISTORY_RECORD_TAIL);
+  if (num_bytes > end - sizeof(HistoryFileMagic) - HISTORY_RECORD_HEAD -
+      HISTORY_RECORD_TAIL)
+    return 0;
+
+  start = end - HISTORY_RECORD_TAIL - num_bytes - HISTORY_RECORD_HEAD;
+  if (GetLong32(contents + start) != num_bytes ||
+      GetLong32(contents + end - 4) !=
+      Checksum(contents + start + HISTORY_RECORD_HEAD, (size_t) num_bytes))
+    return 0;
+
+  return start;
+}
+
+/* Returns the end of the last intact history file record ending at or before
+end, or zero if there is none. Bytes torn from a record are skipped. */
+static unsigned long HistoryFileRecover(const TermInfo *term_info,
+    unsigned long end) {
+  while (end > sizeof(HistoryFileMagic) &&
+      !HistoryFileRecordStart(term_info, end))
+    --end;
+
+  return end > sizeof(HistoryFileMagic) ? end : 0;
+}
+
+/* Returns the end of the first intact history file record starting at or
+after start, within the records that were in the file when attached */
+static unsigned long HistoryFileNextEnd(const TermInfo *term_info,
+    unsigned long start) {
+  const unsigned long file_end = term_info->history_file_end;
+  for (; start + HISTORY_RECORD_HEAD + HISTORY_RECORD_TAIL <= file_end;
+      ++start) {
+    const unsigned long num_bytes =
+      GetLong32(term_info->history_file.contents + start);
+    if (num_bytes <= file_end - start - HISTORY_RECORD_HEAD -
+        HISTORY_RECORD_TAIL) {
+      const unsigned long end =
+        start + HISTORY_RECORD_HEAD + num_bytes + HISTORY_RECORD_TAIL;
+      if (HistoryFileRecordStart(term_info, end) == start)
+        return end;
+    }
+  }
+
+  return 0;
+}
+
+/* Returns the number of intact history file records ending after start and
+at or before end */
+static size_t HistoryFileCount(const TermInfo *term_info, unsigned long start,
+    unsigned long end) {
+  size_t num_records = 0;
+  for (end = HistoryFileRecover(term_info, end); end > start;
+      end = HistoryFileRecover(term_info,
+      HistoryFileRecordStart(term_info, end)))
+    ++num_records;
+
+  return num_records;
+}
+
+/* Returns non-zero if the history file records ending at end1 and end2 hold
+the same text. The records may be in different copies of the file. */
+static int HistoryRecordIsSame(const unsigned char *end1,
+    const unsigned char *end2) {
+  unsigned long num_bytes = GetLong32(end1 - HISTORY_RECORD_TAIL);
+  const unsigned char *text1;
+  const unsigned char *text2;
+  if (num_bytes != GetLong32(end2 - HISTORY_RECORD_TAIL))
+    return 0;
+
+  text1 = end1 - HISTORY_RECORD_TAIL - num_bytes;
+  text2 = end2 - HISTORY_RECORD_TAIL - num_bytes;
+  while (num_bytes--) {
+    if (*text1++ != *text2++)
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Allocates a cleared hash table with room for num_records history file
+record ends, storing its size. Returns NULL if out of memory. */
+static unsigned long *HistoryRecordTable(TermInfo *term_info,
+    size_t num_records, size_t *table_size) {
+  unsigned long *table;
+  size_t size = 1;
+  if (num_records > ((size_t) -1)/4/sizeof(unsigned long))
+    return NULL;
+
+  while (size < num_records*2)
+    size <<= 1;
+  table = term_info->malloc_in(term_info->alloc_info,
+    sizeof(unsigned long)*size);
+  if (table)
+    MemorySet(table, 0, sizeof(unsigned long)*size);
+  *table_size = size;
+  return table;
+}
+
+/* Returns the slot of a hash table of record ends, as offsets from base, that
+holds a record with the same text as the record ending at end, or else the
+empty slot for it */
+static size_t HistoryRecordSlot(const unsigned long *table, size_t table_size,
+    const unsigned char *base, const unsigned char *end) {
+  size_t slot = (size_t) GetLong32(end - 4) & (table_size - 1);
+  while (table[slot] && !HistoryRecordIsSame(base + table[slot], end))
+    slot = (slot + 1) & (table_size - 1);
+
+  return slot;
+}
+
+/* Returns the character a history file holds for a character, replacing
+one the file cannot hold */
+static sli_char HistoryFileChar(sli_char character) {
+  return HistoryCharBytes(HISTORY_FILE_ENCODING, character) ? character :
+    (sli_char) (SLI_CHAR_SIZE > 1 ? 0xFFFD : '?');
+}
+
+/* Adds a line to the history log as a history file record, with '\r' and
+'\n' characters removed. Characters the file cannot hold are replaced. */
+static int HistoryFileAppend(TermInfo *term_info, const sli_char *line) {
+  const sli_ushort encoding = HISTORY_FILE_ENCODING;
+  size_t num_bytes = 0;
+  size_t log_bytes;
+  const sli_char *ptr;
+  unsigned char *record;
+  unsigned char *text;
+  for (ptr = line; *ptr; ++ptr) {
+    if (*ptr != '\r' && *ptr != '\n')
+      num_bytes += HistoryCharBytes(encoding, HistoryFileChar(*ptr));
+  }
+
+  /* Grow the log to hold the record */
+  log_bytes = term_info->history_log_bytes +
+    HISTORY_RECORD_HEAD + num_bytes + HISTORY_RECORD_TAIL;
+  if (log_bytes > term_info->history_log_size) {
+    size_t log_size = term_info->history_log_size*2;
+    if (log_size < log_bytes)
+      log_size = log_bytes;
+    record = term_info->malloc_in(term_info->alloc_info, log_size);
+    if (!record) {
+      /* Out of memory */
+      return -1;
+    }
+
+    if (term_info->history_log) {
+      MemoryCopy(record, term_info->history_log,
+        term_info->history_log_bytes);
+      term_info->free_in(term_info->alloc_info, term_info->history_log);
+    }
+    term_info->history_log = record;
+    term_info->history_log_size = log_size;
+  }
+
+  if (!term_info->history_log_bytes)
+    term_info->history_log_time = SLINPUT_Seconds_Default();
+
+  record = term_info->history_log + term_info->history_log_bytes;
+  text = PutLong32(num_bytes, record);
+  for (ptr = line; *ptr; ++ptr) {
+    if (*ptr != '\r' && *ptr != '\n')
+      text = HistoryWriteChar(encoding, text, HistoryFileChar(*ptr));
+  }
+  text = PutLong32(num_bytes, text);
+  PutLong32(Checksum(record + HISTORY_RECORD_HEAD, num_bytes), text);
+  term_info->history_log_bytes = log_bytes;
+  return 0;
+}
+
+/* Follows a history file that another process replaced with a compacted
+copy, once the records appended to the replaced file have been read. The copy
+holds the newest occurrence of each line, oldest first, so it starts with the
+lines that do not occur in the records read into the ring, which are browsed
+from the file, and ends with the newest record of the replaced file. Returns a
+negative value on error. */
+static int HistoryReplaced(TermInfo *term_info, const SLINPUT_State *state) {
+  HistoryFile *history_file = &term_info->history_file;
+  const unsigned long file_end = term_info->history_file_end ?
+    term_info->history_file_end : sizeof(HistoryFileMagic);
+  const unsigned long newest =
+    HistoryFileRecover(term_info, history_file->num_bytes);
+  unsigned long first = file_end;
+  unsigned long start;
+  unsigned long end;
+  unsigned long *table = NULL;
+  size_t table_size = 0;
+  unsigned char *copy = NULL;
+  int in_ring = 0;
+  int result = 0;
+
+  /* Copy the records read into the ring, and the newest record, with a hash
+  table of their ends as offsets from the first */
+  if (newest) {
+    start = HistoryFileRecordStart(term_info, newest);
+    if (start < first)
+      first = start;
+    table = HistoryRecordTable(term_info,
+      HistoryFileCount(term_info, file_end, newest), &table_size);
+    copy = term_info->malloc_in(term_info->alloc_info,
+      (size_t) (newest - first));
+    if (!table || !copy) {
+      /* Out of memory */
+      result = -1;
+    } else {
+      MemoryCopy(copy, history_file->contents + first,
+        (size_t) (newest - first));
+      for (end = newest; end > file_end; end = HistoryFileRecover(term_info,
+          HistoryFileRecordStart(term_info, end))) {
+        const size_t slot = HistoryRecordSlot(table, table_size, copy,
+          copy + (end - first));
+        if (!table[slot])
+          table[slot] = end - first;
+      }
+    }
+  }
+
+  if (result >= 0)
+    result = SLINPUT_ReopenHistoryFile_Default(state, history_file);
+
+  if (result >= 0) {
+    HistoryIndexReset(term_info);
+    term_info->history_file_end = 0;
+    term_info->history_file_read = sizeof(HistoryFileMagic);
+    for (start = sizeof(HistoryFileMagic); newest && start +
+        HISTORY_RECORD_HEAD + HISTORY_RECORD_TAIL <= history_file->num_bytes;
+        start = end) {
+      const unsigned long num_bytes = GetLong32(history_file->contents + start);
+      if (num_bytes > history_file->num_bytes - start - HISTORY_RECORD_HEAD -
+          HISTORY_RECORD_TAIL)
+        break;
+
+      end = start + HISTORY_RECORD_HEAD + num_bytes + HISTORY_RECORD_TAIL;
+      if (HistoryFileRecordStart(term_info, end) != start)
+        break;
+
+      if (!in_ring && table[HistoryRecordSlot(table, table_size, copy,
+          history_file->contents + end)])
+        in_ring = 1;
+      if (!in_ring)
+        term_info->history_file_end = end;
+      if (HistoryRecordIsSame(copy + (newest - first),
+          history_file->contents + end)) {
+        term_info->history_file_read = end;
+        break;
+      }
+    }
+
+    if (newest && term_info->history_file_read == sizeof(HistoryFileMagic)) {
+      /* Not a compacted copy, so all of it is browsed from the file */
+      term_info->history_file_end =
+        HistoryFileRecover(term_info, history_file->num_bytes);
+      if (history_file->num_bytes > sizeof(HistoryFileMagic))
+        term_info->history_file_read = history_file->num_bytes;
+    }
+  }
+
+  if (copy)
+    term_info->free_in(term_info->alloc_info, copy);
+  if (table)
+    term_info->free_in(term_info->alloc_info, table);
+  return result;
+}
+
+/* Saves into history the intact records that were appended to the history
+file by other processes since it was last read. Bytes after the last intact
+record may be a record still being written, so are left to be read next time,
+while bytes torn from a record before it are skipped. If another process
+replaced the file, then the records appended to it are read before following
+the replacement. */
+static int HistoryImport(TermInfo *term_info, const SLINPUT_State *state) {
+  const HistoryFile *history_file = &term_info->history_file;
+  unsigned long start;
+  unsigned long last;
+  int replaced;
+  int result;
+  do {
+    result = SLINPUT_RefreshHistoryFile_Default(state,
+      &term_info->history_file);
+    if (result < 0)
+      return result;
+
+    replaced = result;
+    start = term_info->history_file_read;
+
+    /* Find the end of the last intact record */
+    last = history_file->num_bytes;
+    while (last >= start + HISTORY_RECORD_HEAD + HISTORY_RECORD_TAIL &&
+        HistoryFileRecordStart(term_info, last) < start)
+      --last;
+
+    while (result >= 0 && start + HISTORY_RECORD_HEAD + HISTORY_RECORD_TAIL <=
+        last) {
+      const unsigned long num_bytes =
+        GetLong32(history_file->contents + start);
+      const unsigned char *text =
+        history_file->contents + start + HISTORY_RECORD_HEAD;
+      const unsigned char *text_end = text + num_bytes;
+      sli_char *line;
+      size_t num_chars = 0;
+      if (num_bytes > last - start - HISTORY_RECORD_HEAD -
+          HISTORY_RECORD_TAIL || HistoryFileRecordStart(term_info,
+          start + HISTORY_RECORD_HEAD + num_bytes + HISTORY_RECORD_TAIL) !=
+          start) {
+        /* Skip bytes torn from a record */
+        ++start;
+        continue;
+      }
+
+      /* Each character takes at least one byte */
+      line = term_info->malloc_in(term_info->alloc_info,
+        sizeof(sli_char)*((size_t) num_bytes + 1));
+      if (!line) {
+        /* Out of memory */
+        return -1;
+      }
+
+      while (text < text_end) {
+        text = HistoryReadChar(HISTORY_FILE_ENCODING, text,
+          &line[num_chars++]);
+      }
+      line[num_chars] = '\0';
+
+      result = HistorySave(term_info, line);
+      term_info->free_in(term_info->alloc_info, line);
+      start += HISTORY_RECORD_HEAD + num_bytes + HISTORY_RECORD_TAIL;
+      term_info->history_file_read = start;
+    }
+
+    if (result >= 0 && start < last)
+      term_info->history_file_read = last;
+    if (result >= 0 && replaced)
+      result = HistoryReplaced(term_info, state);
+  } while (result >= 0 && replaced);
+
+  return result;
+}
+
+/* Follows a history file that another process replaced, without reading
+the lines appended to it into history, as the file is not shared. Returns a
+negative value on error. */
+static int HistoryFollow(TermInfo *term_info, const SLINPUT_State *state) {
+  int result;
+  do {
+    result = SLINPUT_RefreshHistoryFile_Default(state,
+      &term_info->history_file);
+    if (result > 0 && HistoryReplaced(term_info, state) < 0)
+      return -1;
+  } while (result > 0);
+
+  return result;
+}
+
+/* Writes the records waiting in the history log to the history file, as one
+commit. The file is locked, and followed if another process replaced it, so
+that no commit goes to a replaced file. If the file is shared, then lines
+other processes appended first are read into history. If the commit fails,
+then the records are kept in the log and written by the next commit. */
+static int HistoryCommit(TermInfo *term_info, const SLINPUT_State *state) {
+  const size_t num_bytes = term_info->history_log_bytes;
+  int result;
+  if (!num_bytes)
+    return 0;
+
+  result = SLINPUT_LockHistoryFile_Default(state, &term_info->history_file,
+    HISTORY_LOCK_EXCLUSIVE);
+  if (result < 0)
+    return result;
+
+  result = term_info->share_history ? HistoryImport(term_info, state) :
+    HistoryFollow(term_info, state);
+
+  /* No other process is writing, so bytes after the last intact record
+  were torn by an interrupted commit */
+  if (result >= 0)
+    term_info->history_file_read = term_info->history_file.num_bytes;
+
+  if (result >= 0) {
+    result = SLINPUT_AppendHistoryFile_Default(state,
+      &term_info->history_file, term_info->history_log, num_bytes);
+  }
+
+  /* The records stay in the log for the next commit if not written */
+  if (result >= 0) {
+    term_info->history_log_bytes = 0;
+    term_info->history_file_read += num_bytes;
+  }
+
+  SLINPUT_LockHistoryFile_Default(state, &term_info->history_file,
+    HISTORY_LOCK_NONE);
+  return result;
+}
+
+/* Reads into history the lines other processes appended to a shared history
+file since it was last read */
+static int HistorySync(TermInfo *term_info, const SLINPUT_State *state) {
+  int result;
+  if (!term_info->share_history || !term_info->history_file.file_data)
+    return 0;
+
+  result = SLINPUT_LockHistoryFile_Default(state, &term_info->history_file,
+    HISTORY_LOCK_SHARED);
+  if (result < 0)
+    return result;
+
+  result = HistoryImport(term_info, state);
+  SLINPUT_LockHistoryFile_Default(state, &term_info->history_file,
+    HISTORY_LOCK_NONE);
+  return result;
+}
+
+/* Returns non-zero if the history log has reached a commit threshold */
+static int HistoryCommitDue(const TermInfo *term_info) {
+  return term_info->history_log_bytes &&
+    (term_info->history_log_bytes >= term_info->history_commit_bytes ||
+    SLINPUT_Seconds_Default() - term_info->history_log_time >=
+    term_info->history_commit_seconds);
+}
+
+/* Moves to the previous line in history, skipping erased slots and then
+continuing back through the history file. Returns zero if there is none. */
+static int HistoryPrevious(const TermInfo *term_info,
+    HistoryPosition *position) {
+  size_t index = position->index;
+  unsigned long end;
+  if (!position->file_end) {
+    while (index > 0) {
+      if (HistoryAt(term_info, --index)) {
+        position->index = index;
+        return 1;
+      }
+    }
+
+    /* The ring index is kept for returning from the history file */
+    if (!term_info->history_file_end)
+      return 0;
+
+    position->file_end = term_info->history_file_end;
+    return 1;
+  }
+
+  end = HistoryFileRecover(term_info,
+    HistoryFileRecordStart(term_info, position->file_end));
+  if (!end)
+    return 0;
+
+  position->file_end = end;
+  return 1;
+}
+
+/* Moves to the next line in history. Returns zero if already at the empty
+line following the newest. */
+static int HistoryNext(const TermInfo *term_info, HistoryPosition *position) {
+  if (position->file_end) {
+    position->file_end = position->file_end < term_info->history_file_end ?
+      HistoryFileNextEnd(term_info, position->file_end) : 0;
+
+    return 1;
+  }
+
+  if (position->index == term_info->num_history)
+    return 0;
+
+  do {
+    ++position->index;
+  } while (position->index < term_info->num_history &&
+    !HistoryAt(term_info, position->index));
+
+  return 1;
+}
+
+/* Finds the text of the line at a history position, other than the empty
+line. Returns the encoding of the text. */
+static sli_ushort HistoryLineText(const TermInfo *term_info,
+    const HistoryPosition *position, const unsigned char **text,
+    const unsigned char **text_end) {
+  const HistoryEntry *entry;
+  if (position->file_end) {
+    *text = term_info->history_file.contents + HISTORY_RECORD_HEAD +
+      HistoryFileRecordStart(term_info, position->file_end);
+    *text_end = term_info->history_file.contents + position->file_end -
+      HISTORY_RECORD_TAIL;
+    return HISTORY_FILE_ENCODING;
+  }
+
+  entry = HistoryAt(term_info, position->index);
+  return HistoryEntryText(term_info->history_decode, entry, text, text_end);
+}
+
+/* Returns non-zero if history position1 holds an older line than position2 */
+static int HistoryIsOlder(const HistoryPosition *position1,
+    const HistoryPosition *position2) {
+  if (position1->file_end || position2->file_end) {
+    return position1->file_end &&
+      (!position2->file_end || position1->file_end < position2->file_end);
+  }
+
+  return position1->index < position2->index;
+}
+
+/* Returns the ordinal of the line at a history position in the prefix
+index, with the empty line following the newest */
+static unsigned long HistoryOrdinal(const TermInfo *term_info,
+    const HistoryPosition *position) {
+  if (position->file_end)
+    return position->file_end;
+
+  return term_info->history_file_end + 1 + term_info->first_sequence +
+    position->index;
+}
+
+/* Finds the history position of a line by its ordinal in the prefix index.
+Returns zero if the line is no longer in history. */
+static int HistoryOrdinalPosition(const TermInfo *term_info,
+    unsigned long ordinal, HistoryPosition *position) {
+  if (ordinal <= term_info->history_file_end) {
+    /* The ring index is kept at the oldest line, for returning from the
+    history file */
+    position->index = 0;
+    while (position->index < term_info->num_history &&
+        !HistoryAt(term_info, position->index))
+      ++position->index;
+
+    position->file_end = ordinal;
+    return 1;
+  }
+
+  ordinal -= term_info->history_file_end + 1;
+  if (ordinal < term_info->first_sequence ||
+      ordinal - term_info->first_sequence >= term_info->num_history)
+    return 0;
+
+  position->index = (size_t) (ordinal - term_info->first_sequence);
+  position->file_end = 0;
+  return HistoryAt(term_info, position->index) != NULL;
+}
+
+/* Returns non-zero if the line at a history position starts with prefix */
+static int HistoryStartsWith(const TermInfo *term_info,
+    const HistoryPosition *position, const sli_char *prefix,
+    size_t prefix_length) {
+  const unsigned char *text;
+  const unsigned char *text_end;
+  const sli_ushort encoding =
+    HistoryLineText(term_info, position, &text, &text_end);
+  size_t index;
+  for (index = 0; index < prefix_length; ++index) {
+    sli_char character;
+    if (text >= text_end)
+      return 0;
+
+    text = HistoryReadChar(encoding, text, &character);
+    if (character != prefix[index])
+      return 0;
+  }
+
+  return 1;
+}
+
+/* Builds the prefix index from the lines in the ring, oldest first.
+SLINPUT_Save keeps it up to date after that. The records of the history file
+are left for PrefixIndexLoad, so a long history file does not hold up the
+first keystroke. */
+static int PrefixIndexBuild(TermInfo *term_info) {
+  HistoryPosition position;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  sli_ushort encoding;
+  term_info->prefix_index = term_info->malloc_in(term_info->alloc_info,
+    sizeof(PrefixNode));
+  if (!term_info->prefix_index) {
+    /* Out of memory */
+    return -1;
+  }
+
+  term_info->index_bytes += sizeof(PrefixNode);
+
+  term_info->prefix_index->child = NULL;
+  term_info->prefix_index->sibling = NULL;
+  OrdinalListInit(&term_info->prefix_index->lines);
+  term_info->prefix_index->character = '\0';
+  position.file_end = 0;
+  for (position.index = 0; position.index < term_info->num_history;
+      ++position.index) {
+    if (HistoryAt(term_info, position.index)) {
+      encoding = HistoryLineText(term_info, &position, &text, &text_end);
+      if (PrefixAdd(term_info, text, text_end, encoding,
+          HistoryOrdinal(term_info, &position), 0) < 0) {
+        PrefixIndexReset(term_info);
+        return -1;
+      }
+    }
+  }
+
+  /* The records of shared history are in its own index */
+  term_info->prefix_file_next = term_info->shared_history &&
+    term_info->shared_history->prefix_index ? 0 :
+    term_info->history_file_end;
+  return 0;
+}
+
+/* Adds up to num_lines more intact records of the history file to the
+prefix index, newest first, each older than the lines already listed */
+static int PrefixIndexLoad(TermInfo *term_info, size_t num_lines) {
+  HistoryPosition position;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  sli_ushort encoding;
+  position.index = 0;
+  for (; num_lines && term_info->prefix_file_next; --num_lines) {
+    position.file_end =
+      HistoryFileRecover(term_info, term_info->prefix_file_next);
+    if (!position.file_end) {
+      term_info->prefix_file_next = 0;
+      break;
+    }
+
+    encoding = HistoryLineText(term_info, &position, &text, &text_end);
+    if (PrefixAdd(term_info, text, text_end, encoding, position.file_end,
+        1) < 0) {
+      PrefixIndexReset(term_info);
+      return -1;
+    }
+
+    term_info->prefix_file_next =
+      HistoryFileRecordStart(term_info, position.file_end);
+  }
+
+  return 0;
+}
+
+/* Returns the node of a prefix index for the leading characters of prefix,
+or NULL if no line starts with them or prefix is empty */
+static const PrefixNode *PrefixNodeFind(const PrefixNode *node,
+    const sli_char *prefix, size_t prefix_length) {
+  size_t depth;
+  for (depth = 0; node && depth < prefix_length &&
+      depth < SLINPUT_PREFIX_CHARS; ++depth) {
+    node = node->child;
+    while (node && node->character != prefix[depth])
+      node = node->sibling;
+  }
 
-/* Check pointers are within expected ranges */
-static void CheckState(SLINPUT_State *state) {
-  assert(state->line_info.end_ptr >= state->line_info.buffer);
-  assert(state->line_info.cursor_ptr >= state->line_info.buffer);
-  assert(state->line_info.scroll_ptr >= state->line_info.buffer);
+  return depth ? node : NULL;
+}
 
-  assert(state->line_info.end_ptr <= state->line_info.buffer +
-    state->line_info.max_chars);
-  assert(state->line_info.cursor_ptr <= state->line_info.end_ptr);
-  assert(state->line_info.scroll_ptr <= state->line_info.cursor_ptr);
+/* Moves to the previous, or next, line in history listed at a node of a
+prefix index and starting with prefix. At most num_probes lines are
+examined, and num_probes is reduced by the number examined. Returns zero if
+there is none. */
+static int PrefixNodeStep(const TermInfo *term_info, const PrefixNode *node,
+    const sli_char *prefix, size_t prefix_length, HistoryPosition *position,
+    int older, size_t *num_probes) {
+  HistoryPosition found;
+  size_t index;
+  if (!node)
+    return 0;
+
+  /* Lines no longer in history, or only sharing the leading characters
+  indexed, are passed over */
+  index = OrdinalLowerBound(&node->lines,
+    HistoryOrdinal(term_info, position) + (older ? 0 : 1));
+  for (;;) {
+    if ((older ? !index : index == node->lines.num_ordinals) ||
+        !*num_probes)
+      return 0;
+
+    --*num_probes;
+
+    if (HistoryOrdinalPosition(term_info,
+        node->lines.ordinals[older ? --index : index++], &found) &&
+        (prefix_length <= SLINPUT_PREFIX_CHARS ||
+        HistoryStartsWith(term_info, &found, prefix, prefix_length))) {
+      *position = found;
+      return 1;
+    }
+  }
 }
 
-/* Minimum of two integer values, used when checking for negative error
-values. */
-static int Minimum(int value1, int value2) {
-  return value1 < value2 ? value1 : value2;
+/* Moves to the previous, or next, line in history starting with prefix,
+found by a binary search of the prefix index. The records of shared history
+are found in its own index, and are older than the lines of the state's.
+At most num_probes lines are examined, and num_probes is reduced by the
+number examined. Returns zero if there is none. */
+static int PrefixStep(const TermInfo *term_info, const sli_char *prefix,
+    size_t prefix_length, HistoryPosition *position, int older,
+    size_t *num_probes) {
+  const PrefixNode *node =
+    PrefixNodeFind(term_info->prefix_index, prefix, prefix_length);
+  const PrefixNode *shared_node = term_info->shared_history ?
+    PrefixNodeFind(term_info->shared_history->prefix_index, prefix,
+    prefix_length) : NULL;
+  if (older) {
+    return PrefixNodeStep(term_info, node, prefix, prefix_length, position,
+      older, num_probes) || PrefixNodeStep(term_info, shared_node, prefix,
+      prefix_length, position, older, num_probes);
+  }
+
+  return PrefixNodeStep(term_info, shared_node, prefix, prefix_length,
+    position, older, num_probes) || PrefixNodeStep(term_info, node, prefix,
+    prefix_length, position, older, num_probes);
 }
 
-/* Finds the start of a word by searching leftwards, using spaces as the
-delimeter. */
-static sli_char *FindStartOfWord(SLINPUT_State *state,
-    const sli_char *buffer, sli_char *cursor_ptr) {
-  const TermInfo *term_info = &state->term_info;
-  while (cursor_ptr > buffer) {
-    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr) &&
-        term_info->is_space_in(state, term_info->stream_in,
-          *(cursor_ptr - 1))) {
-      break;
+/* Builds the context index from the lines in the ring, oldest first.
+SLINPUT_Save keeps it up to date after that. */
+static int ContextIndexBuild(TermInfo *term_info) {
+  HistoryPosition position;
+  position.file_end = 0;
+  for (position.index = 0; position.index < term_info->num_history;
+      ++position.index) {
+    if (HistoryAt(term_info, position.index) && ContextAdd(term_info,
+        HistoryContextAt(term_info, position.index),
+        HistoryOrdinal(term_info, &position)) < 0) {
+      HistoryIndexReset(term_info);
+      return -1;
     }
-    --cursor_ptr;
   }
-  return cursor_ptr;
+
+  term_info->context_lines =
+    ContextFind(term_info, term_info->history_context, 0);
+  term_info->context_indexed = 1;
+  return 0;
 }
 
-/* Skips spaces leftwards */
-static sli_char *SkipSpacesLeft(SLINPUT_State *state,
-    const sli_char *buffer, sli_char *cursor_ptr) {
-  const TermInfo *term_info = &state->term_info;
-  while (cursor_ptr > buffer) {
-    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
-      break;
-    --cursor_ptr;
+/* Returns non-zero if the line at a history position was saved in the
+current context */
+static int ContextHolds(const TermInfo *term_info,
+    const HistoryPosition *position) {
+  return !position->file_end && position->index < term_info->num_history &&
+    HistoryContextAt(term_info, position->index) ==
+    term_info->history_context;
+}
+
+/* Finds the newest line of the current context older than the ordinal
+given, or the oldest line newer than it. Returns zero if there is none. */
+static int ContextListStep(const TermInfo *term_info, unsigned long ordinal,
+    HistoryPosition *position, int older) {
+  const OrdinalList *lines = &term_info->context_lines->lines;
+  HistoryPosition found;
+  size_t index = OrdinalLowerBound(lines, ordinal + (older ? 0 : 1));
+  while (older ? index > 0 : index < lines->num_ordinals) {
+    if (HistoryOrdinalPosition(term_info,
+        lines->ordinals[older ? --index : index++], &found)) {
+      *position = found;
+      return 1;
+    }
   }
-  return cursor_ptr;
+
+  return 0;
 }
 
-/* Skips rightwards until a space is found */
-static sli_char *SkipWordRight(SLINPUT_State *state,
-    const sli_char *end_ptr, sli_char *cursor_ptr) {
-  const TermInfo *term_info = &state->term_info;
-  while (cursor_ptr < end_ptr) {
-    if (term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
-      break;
-    ++cursor_ptr;
+/* Moves to the previous, or next, line in history, browsing the lines saved
+in the current context first, newest first, and then the rest of history.
+The lines of the context are found by a binary search of the context index.
+Returns zero if there is none. */
+static int ContextStep(const TermInfo *term_info, HistoryPosition *position,
+    int older) {
+  HistoryPosition found = *position;
+  const int at_empty = !found.file_end &&
+    found.index == term_info->num_history;
+  if (at_empty || ContextHolds(term_info, &found)) {
+    if (at_empty && !older)
+      return 0;
+
+    if (term_info->context_lines && ContextListStep(term_info,
+        HistoryOrdinal(term_info, &found), position, older))
+      return 1;
+
+    /* The rest of history follows the oldest line of the context, starting
+    from the newest line, and the newest line of the context leads back to
+    the empty line */
+    position->index = term_info->num_history;
+    position->file_end = 0;
+    if (!older)
+      return 1;
+
+    found = *position;
   }
-  return cursor_ptr;
+
+  do {
+    if (older ? !HistoryPrevious(term_info, &found) :
+        !HistoryNext(term_info, &found))
+      return 0;
+  } while (ContextHolds(term_info, &found));
+
+  /* Moving down from the newest line of the rest leads to the oldest line
+  of the context */
+  if (!older && !found.file_end && found.index == term_info->num_history &&
+      term_info->context_lines)
+    ContextListStep(term_info, 0, &found, 0);
+
+  *position = found;
+  return 1;
 }
 
-/* Skips spaces rightwards */
-static sli_char *SkipSpacesRight(SLINPUT_State *state,
-    const sli_char *end_ptr, sli_char *cursor_ptr) {
-  const TermInfo *term_info = &state->term_info;
-  while (cursor_ptr < end_ptr) {
-    if (!term_info->is_space_in(state, term_info->stream_in, *cursor_ptr))
-      break;
-    ++cursor_ptr;
+/* Returns the undo log record at index, counting from the oldest record */
+static EditRecord *UndoLogRecord(UndoLog *undo_log, sli_ushort index) {
+  return &undo_log->records[(undo_log->first_record + index) %
+    SLINPUT_UNDO_RECORDS];
+}
+
+/* Empties the undo log */
+static void UndoReset(UndoLog *undo_log) {
+  undo_log->first_record = 0;
+  undo_log->num_records = 0;
+  undo_log->num_undo = 0;
+  undo_log->text_used = 0;
+}
+
+/* Returns the text ring index following the text of the newest record */
+static sli_ushort UndoTextEnd(const UndoLog *undo_log) {
+  if (!undo_log->num_records)
+    return 0;
+
+  return (sli_ushort) ((undo_log->records[undo_log->first_record].text_index +
+    undo_log->text_used) % SLINPUT_UNDO_CHARS);
+}
+
+/* Appends characters to the text ring. The caller ensures there is room. */
+static void UndoPushText(UndoLog *undo_log, const sli_char *text,
+    sli_ushort num_chars) {
+  sli_ushort text_index = UndoTextEnd(undo_log);
+  undo_log->text_used = (sli_ushort) (undo_log->text_used + num_chars);
+  while (num_chars--) {
+    undo_log->text[text_index] = *text++;
+    text_index = (sli_ushort) ((text_index + 1) % SLINPUT_UNDO_CHARS);
   }
-  return cursor_ptr;
 }
 
-/* Outputs characters until a nil or the max_chars count is reached */
-static int OutputMaxChars(SLINPUT_State *state,
-    ptrdiff_t max_chars, const sli_char *str) {
-  SLINPUT_Stream stream = state->term_info.stream_out;
-  SLINPUT_Putchar *putchar_out = state->term_info.putchar_out;
-  int result = 0;
-  while (max_chars-- > 0 && *str)
-    result = Minimum(result, (*putchar_out)(state, stream, *str++));
+/* Copies characters out of the text ring */
+static void UndoCopyText(const UndoLog *undo_log, unsigned long text_index,
+    sli_ushort num_chars, sli_char *dst_ptr) {
+  while (num_chars--)
+    *dst_ptr++ = undo_log->text[text_index++ % SLINPUT_UNDO_CHARS];
+}
 
-  return result;
+/* Discards the oldest record and its text */
+static void UndoDropOldest(UndoLog *undo_log) {
+  const EditRecord *record = UndoLogRecord(undo_log, 0);
+  undo_log->text_used = (sli_ushort) (undo_log->text_used -
+    record->num_deleted - record->num_inserted);
+  undo_log->first_record =
+    (sli_ushort) ((undo_log->first_record + 1) % SLINPUT_UNDO_RECORDS);
+  --undo_log->num_records;
+  if (undo_log->num_undo)
+    --undo_log->num_undo;
 }
 
-/* Outputs characters until a nil is reached */
-static int OutputChars(SLINPUT_State *state, const sli_char *str) {
-  SLINPUT_Stream stream = state->term_info.stream_out;
-  SLINPUT_Putchar *putchar_out = state->term_info.putchar_out;
-  int result = 0;
-  while (*str)
-    result = Minimum(result, (*putchar_out)(state, stream, *str++));
+/* Records an edit before it is applied to the line. The deleted characters
+are taken from the line at position. Consecutive character inputs, and
+consecutive history browses, are coalesced into a single record. Older records
+are discarded to make room. An edit too large for the log empties it, as
+earlier records could no longer be applied. */
+static void UndoRecordEdit(SLINPUT_State *state, EditKind kind,
+    sli_ushort position, sli_ushort num_deleted, const sli_char *inserted,
+    sli_ushort num_inserted) {
+  UndoLog *undo_log = &state->undo_log;
+  const sli_char *deleted = state->line_info.buffer + position;
+  const unsigned long num_chars = (unsigned long) num_deleted + num_inserted;
+  EditRecord *record;
+
+  /* A new edit discards the records that could have been redone */
+  while (undo_log->num_records > undo_log->num_undo) {
+    record = UndoLogRecord(undo_log, (sli_ushort) (undo_log->num_records - 1));
+    undo_log->text_used = (sli_ushort) (undo_log->text_used -
+      record->num_deleted - record->num_inserted);
+    --undo_log->num_records;
+  }
 
-  return result;
+  if (undo_log->num_undo) {
+    record = UndoLogRecord(undo_log, (sli_ushort) (undo_log->num_undo - 1));
+    if (record->kind == (sli_ushort) kind && ((kind == EDIT_HISTORY) ||
+        (kind == EDIT_INSERT_CHAR && !num_deleted && !record->num_deleted &&
+        record->position + record->num_inserted == position))) {
+      /* Coalesce. The newest record's text is at the end of the text ring,
+      so its inserted text can be extended or, when browsing, replaced. */
+      if (kind == EDIT_HISTORY) {
+        undo_log->text_used =
+          (sli_ushort) (undo_log->text_used - record->num_inserted);
+        record->num_inserted = 0;
+      }
+
+      while (undo_log->text_used + num_inserted > SLINPUT_UNDO_CHARS &&
+          undo_log->num_records > 1)
+        UndoDropOldest(undo_log);
+
+      if (undo_log->text_used + num_inserted <= SLINPUT_UNDO_CHARS) {
+        UndoPushText(undo_log, inserted, num_inserted);
+        record->num_inserted =
+          (sli_ushort) (record->num_inserted + num_inserted);
+        return;
+      }
+
+      UndoReset(undo_log);
+      return;
+    }
+  }
+
+  if (num_chars > SLINPUT_UNDO_CHARS) {
+    UndoReset(undo_log);
+    return;
+  }
+
+  while (undo_log->num_records == SLINPUT_UNDO_RECORDS ||
+      undo_log->text_used + num_chars > SLINPUT_UNDO_CHARS)
+    UndoDropOldest(undo_log);
+
+  record = UndoLogRecord(undo_log, undo_log->num_records);
+  record->position = position;
+  record->cursor =
+    (sli_ushort) (state->line_info.cursor_ptr - state->line_info.buffer);
+  record->num_deleted = 0;
+  record->num_inserted = 0;
+  record->text_index = UndoTextEnd(undo_log);
+  record->kind = (sli_ushort) kind;
+  ++undo_log->num_records;
+  ++undo_log->num_undo;
+
+  UndoPushText(undo_log, deleted, num_deleted);
+  record->num_deleted = num_deleted;
+  UndoPushText(undo_log, inserted, num_inserted);
+  record->num_inserted = num_inserted;
 }
 
-/* Copies characters until a nil or the max_chars count is reached. Returns
-pointer to the destination terminating nil character. */
-static sli_char *CopyChars(sli_ushort max_chars, const sli_char *str,
-    sli_char *dst_ptr) {
-  while (max_chars-- > 0 && *str)
-    *dst_ptr++ = *str++;
-  *dst_ptr = '\0';
-  return dst_ptr;
+/* Returns the number of blocks of widths the column sums cover, which is
+those holding the line up to and including the terminating nil */
+static unsigned int ColumnBlocks(const LineInfo *line_info) {
+  return (unsigned int)
+    ((line_info->end_ptr - line_info->buffer) >> SLINPUT_COLUMN_BLOCK_BITS) + 1;
+}
+
+/* Adds delta to the column sum of the block containing position */
+static void ColumnSumsAdd(LineInfo *line_info, sli_ushort position,
+    long delta) {
+  const unsigned int num_blocks = ColumnBlocks(line_info);
+  unsigned int node =
+    (unsigned int) (position >> SLINPUT_COLUMN_BLOCK_BITS) + 1;
+  while (node <= num_blocks) {
+    line_info->column_sums[node - 1] += (unsigned long) delta;
+    node += node & (~node + 1);
+  }
+}
+
+/* Returns the number of columns occupied by the first num_blocks blocks */
+static unsigned long ColumnSumsPrefix(const LineInfo *line_info,
+    unsigned int num_blocks) {
+  unsigned long num_columns = 0;
+  while (num_blocks > 0) {
+    num_columns += line_info->column_sums[num_blocks - 1];
+    num_blocks &= num_blocks - 1;
+  }
+
+  return num_columns;
+}
+
+/* Recalculates the column sums of the blocks from the one containing
+position onwards, after the characters there have moved. Each tree node holds
+the block's own columns plus those of the nodes it covers below it. */
+static void ColumnSumsRebuild(LineInfo *line_info, sli_ushort position) {
+  const unsigned int num_blocks = ColumnBlocks(line_info);
+  const ptrdiff_t line_len = line_info->end_ptr - line_info->buffer;
+  unsigned int node =
+    (unsigned int) (position >> SLINPUT_COLUMN_BLOCK_BITS) + 1;
+  for (; node <= num_blocks; ++node) {
+    const ptrdiff_t first = (ptrdiff_t) (node - 1) << SLINPUT_COLUMN_BLOCK_BITS;
+    const ptrdiff_t last = first + (1 << SLINPUT_COLUMN_BLOCK_BITS) < line_len ?
+      first + (1 << SLINPUT_COLUMN_BLOCK_BITS) : line_len;
+    const unsigned int low_bit = node & (~node + 1);
+    unsigned long num_columns = 0;
+    unsigned int child;
+    ptrdiff_t index;
+
+    for (index = first; index < last; ++index)
+      num_columns += line_info->widths[index];
+    for (child = 1; child < low_bit; child <<= 1)
+      num_columns += line_info->column_sums[node - child - 1];
+
+    line_info->column_sums[node - 1] = num_columns;
+  }
+}
+
+/* Removes num_removed characters at position, opening a gap of num_inserted
+characters in their place. The line remains nil terminated. Returns a pointer
+to the gap. */
+static sli_char *LineSplice(LineInfo *line_info, sli_ushort position,
+    sli_ushort num_removed, sli_ushort num_inserted) {
+  sli_char *gap_ptr = line_info->buffer + position;
+  sli_char *src_ptr = gap_ptr + num_removed;
+  sli_char *dst_ptr = gap_ptr + num_inserted;
+  const unsigned char *src_width =
+    line_info->widths + position + num_removed;
+  unsigned char *dst_width = line_info->widths + position + num_inserted;
+  const ptrdiff_t tail_len = line_info->end_ptr - src_ptr + 1;
+  ptrdiff_t index;
+
+  /* The widths of the tail move with the characters */
+  if (dst_ptr > src_ptr) {
+    for (index = tail_len - 1; index >= 0; --index) {
+      dst_ptr[index] = src_ptr[index];
+      dst_width[index] = src_width[index];
+    }
+  } else if (dst_ptr < src_ptr) {
+    for (index = 0; index < tail_len; ++index) {
+      dst_ptr[index] = src_ptr[index];
+      dst_width[index] = src_width[index];
+    }
+  }
+
+  line_info->end_ptr = dst_ptr + tail_len - 1;
+
+  /* The gap has no width until it is measured */
+  for (index = 0; index < num_inserted; ++index)
+    line_info->widths[position + index] = 0;
+  if (num_removed || num_inserted)
+    ColumnSumsRebuild(line_info, position);
+
+  return gap_ptr;
+}
+
+/* Returns non-zero if a grapheme cluster starts at ptr, following the
+extended grapheme cluster boundary rules of Unicode UAX #29 */
+static int IsClusterStart(const LineInfo *line_info, const sli_char *ptr) {
+  const sli_char *buffer = line_info->buffer;
+  GraphemeBreak before;
+  GraphemeBreak after;
+  sli_ushort num_indicators;
+
+  if (ptr <= buffer || ptr >= line_info->end_ptr)
+    return 1;
+
+  before = CharBreak(*(ptr - 1));
+  after = CharBreak(*ptr);
+
+  /* Carriage return and line feed stay together, other controls stand
+  alone */
+  if (before == BREAK_CR && after == BREAK_LF)
+    return 0;
+  if (before == BREAK_CR || before == BREAK_LF || before == BREAK_CONTROL ||
+      after == BREAK_CR || after == BREAK_LF || after == BREAK_CONTROL) {
+    return 1;
+  }
+
+  /* Hangul syllable sequences */
+  if (before == BREAK_L && (after == BREAK_L || after == BREAK_V ||
+      after == BREAK_LV || after == BREAK_LVT)) {
+    return 0;
+  }
+  if ((before == BREAK_LV || before == BREAK_V) &&
+      (after == BREAK_V || after == BREAK_T)) {
+    return 0;
+  }
+  if ((before == BREAK_LVT || before == BREAK_T) && after == BREAK_T)
+    return 0;
+
+  /* Extending characters, spacing marks and prepended characters */
+  if (after == BREAK_EXTEND || after == BREAK_ZWJ ||
+      after == BREAK_SPACING_MARK || before == BREAK_PREPEND) {
+    return 0;
+  }
+
+  /* Emoji joined by a zero width joiner, possibly after extending
+  characters */
+  if (before == BREAK_ZWJ && after == BREAK_PICTOGRAPHIC) {
+    --ptr;
+    while (ptr > buffer && CharBreak(*(ptr - 1)) == BREAK_EXTEND)
+      --ptr;
+    return !(ptr > buffer && CharBreak(*(ptr - 1)) == BREAK_PICTOGRAPHIC);
+  }
+
+  /* Regional indicators pair up as flags */
+  if (before == BREAK_REGIONAL_INDICATOR &&
+      after == BREAK_REGIONAL_INDICATOR) {
+    num_indicators = 0;
+    while (ptr > buffer &&
+        CharBreak(*(ptr - 1)) == BREAK_REGIONAL_INDICATOR) {
+      --ptr;
+      ++num_indicators;
+    }
+    return !(num_indicators & 1);
+  }
+
+  return 1;
+}
+
+/* Finds the start of the grapheme cluster before ptr */
+static sli_char *ClusterLeft(const LineInfo *line_info, sli_char *ptr) {
+  if (ptr > line_info->buffer)
+    --ptr;
+  while (!IsClusterStart(line_info, ptr))
+    --ptr;
+
+  return ptr;
+}
+
+/* Finds the start of the grapheme cluster after the one at ptr */
+static sli_char *ClusterRight(const LineInfo *line_info, sli_char *ptr) {
+  if (ptr < line_info->end_ptr)
+    ++ptr;
+  while (!IsClusterStart(line_info, ptr))
+    ++ptr;
+
+  return ptr;
+}
+
+/* Measures the display width of num_chars characters at position. A grapheme
+cluster occupies the width of its first character, the rest having zero
+width. Cluster boundaries after the characters can depend on them, so
+following characters are measured while the character before them extends or
+joins a cluster or is a regional indicator. */
+static void LineMeasure(LineInfo *line_info, sli_ushort position,
+    sli_ushort num_chars) {
+  const sli_char *ptr = line_info->buffer + position;
+  const sli_char *measured_ptr = ptr + num_chars;
+  unsigned char *width = line_info->widths + position;
+  unsigned char new_width;
+  GraphemeBreak previous;
+
+  while (ptr < line_info->end_ptr) {
+    if (ptr > measured_ptr) {
+      previous = CharBreak(*(ptr - 1));
+      if (previous != BREAK_EXTEND && previous != BREAK_ZWJ &&
+          previous != BREAK_REGIONAL_INDICATOR) {
+        break;
+      }
+    }
+
+    new_width = (unsigned char)
+      (IsClusterStart(line_info, ptr) ? CharWidth(*ptr) : 0);
+    if (new_width != *width) {
+      ColumnSumsAdd(line_info, (sli_ushort) (ptr - line_info->buffer),
+        (long) new_width - *width);
+      *width = new_width;
+    }
+    ++width;
+    ++ptr;
+  }
+}
+
+/* Returns the number of columns occupied by the characters before ptr */
+static unsigned long LinePrefixColumns(const LineInfo *line_info,
+    const sli_char *ptr) {
+  const ptrdiff_t position = ptr - line_info->buffer;
+  const unsigned int block =
+    (unsigned int) (position >> SLINPUT_COLUMN_BLOCK_BITS);
+  const unsigned char *width =
+    line_info->widths + ((ptrdiff_t) block << SLINPUT_COLUMN_BLOCK_BITS);
+  const unsigned char *end_width = line_info->widths + position;
+  unsigned long num_columns = ColumnSumsPrefix(line_info, block);
+  while (width < end_width)
+    num_columns += *width++;
+
+  return num_columns;
+}
+
+/* Returns the number of columns occupied by the characters from from_ptr up
+to to_ptr */
+static ptrdiff_t LineColumns(const LineInfo *line_info,
+    const sli_char *from_ptr, const sli_char *to_ptr) {
+  const unsigned char *width;
+  const unsigned char *end_width;
+  ptrdiff_t num_columns = 0;
+
+  /* Long ranges use the column sums */
+  if (to_ptr - from_ptr > (1 << SLINPUT_COLUMN_BLOCK_BITS)) {
+    return (ptrdiff_t) (LinePrefixColumns(line_info, to_ptr) -
+      LinePrefixColumns(line_info, from_ptr));
+  }
+
+  width = line_info->widths + (from_ptr - line_info->buffer);
+  end_width = width + (to_ptr - from_ptr);
+  while (width < end_width)
+    num_columns += *width++;
+
+  return num_columns;
+}
+
+/* Finds the leftmost position at or before ptr where the characters up to ptr
+fit within num_columns */
+static sli_char *LineColumnsLeft(const LineInfo *line_info, sli_char *ptr,
+    ptrdiff_t num_columns) {
+  const sli_char *start_ptr = ptr;
+  const unsigned int num_blocks = ColumnBlocks(line_info);
+  const unsigned long end_columns = LinePrefixColumns(line_info, ptr);
+  unsigned long target;
+  unsigned long remaining;
+  unsigned int node = 0;
+  unsigned int step = 1;
+  const unsigned char *width;
+
+  if (num_columns < 0)
+    num_columns = 0;
+  if (end_columns <= (unsigned long) num_columns)
+    return line_info->buffer;
+
+  /* Find the whole blocks occupying fewer columns than the target by
+  descending the tree, then find the first character reaching the target */
+  target = end_columns - (unsigned long) num_columns;
+  remaining = target;
+  while (step <= num_blocks / 2)
+    step <<= 1;
+  for (; step; step >>= 1) {
+    if (node + step <= num_blocks &&
+        line_info->column_sums[node + step - 1] < remaining) {
+      node += step;
+      remaining -= line_info->column_sums[node - 1];
+    }
+  }
+
+  ptr = line_info->buffer + ((ptrdiff_t) node << SLINPUT_COLUMN_BLOCK_BITS);
+  width = line_info->widths + (ptr - line_info->buffer);
+  while (remaining > 0) {
+    remaining -= *width < remaining ? *width : remaining;
+    ++width;
+    ++ptr;
+  }
+
+  /* Don't start part way through a grapheme cluster */
+  while (ptr < start_ptr && !IsClusterStart(line_info, ptr))
+    ++ptr;
+
+  return ptr;
+}
+
+/* Adjusts the scroll pointer so the cursor is displayed, keeping the cursor
+margin where possible */
+static void ScrollToCursor(LineInfo *line_info) {
+  sli_char *end_scroll_ptr;
+
+  if (line_info->cursor_ptr < line_info->scroll_ptr ||
+      LineColumns(line_info, line_info->scroll_ptr, line_info->cursor_ptr) <
+      line_info->cursor_margin) {
+    line_info->scroll_ptr = LineColumnsLeft(line_info, line_info->cursor_ptr,
+      line_info->cursor_margin);
+  } else if (LineColumns(line_info, line_info->scroll_ptr,
+      line_info->cursor_ptr) > line_info->fit_len - line_info->cursor_margin) {
+    line_info->scroll_ptr = LineColumnsLeft(line_info, line_info->cursor_ptr,
+      line_info->fit_len - line_info->cursor_margin);
+  }
+
+  /* Don't leave columns unused when the end of the line is displayed */
+  end_scroll_ptr = LineColumnsLeft(line_info, line_info->end_ptr,
+    line_info->fit_len);
+  if (line_info->scroll_ptr > end_scroll_ptr)
+    line_info->scroll_ptr = end_scroll_ptr;
+}
+
+/* Finds the text of the line at a history position following its first
+num_chars characters. Returns the encoding of the text. */
+static sli_ushort HistoryLineSuffix(const TermInfo *term_info,
+    const HistoryPosition *position, size_t num_chars,
+    const unsigned char **text, const unsigned char **text_end) {
+  const sli_ushort encoding =
+    HistoryLineText(term_info, position, text, text_end);
+  sli_char character;
+  while (num_chars-- > 0 && *text < *text_end)
+    *text = HistoryReadChar(encoding, *text, &character);
+
+  return encoding;
+}
+
+/* Finds the newest line in history that extends the line being input, while
+the cursor is at the end of it, preferring the newest saved in the current
+context. The lines examined are limited to SLINPUT_SUGGEST_PROBES, bounding
+the time taken after each keystroke. Returns zero if there is none. */
+static int SuggestFind(SLINPUT_State *state) {
+  const TermInfo *term_info = &state->term_info;
+  const LineInfo *line_info = &state->line_info;
+  HistoryPosition *position = &state->history_suggestion.position;
+  const size_t num_chars = (size_t) (line_info->end_ptr - line_info->buffer);
+  size_t num_probes = SLINPUT_SUGGEST_PROBES;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  HistoryPosition newest;
+  int found = 0;
+  if (!term_info->suggest_history || !term_info->prefix_index ||
+      !num_chars || line_info->cursor_ptr != line_info->end_ptr ||
+      state->history_search.active)
+    return 0;
+
+  position->index = term_info->num_history;
+  position->file_end = 0;
+  while (PrefixStep(term_info, line_info->buffer, num_chars, position, 1,
+      &num_probes)) {
+    HistoryLineSuffix(term_info, position, num_chars, &text, &text_end);
+    if (text < text_end) {
+      if (!term_info->history_context || ContextHolds(term_info, position))
+        return 1;
+
+      if (!found)
+        newest = *position;
+      found = 1;
+    }
+  }
+
+  if (found)
+    *position = newest;
+
+  return found;
+}
+
+/* Outputs the line suggested from history dimmed, following the end of the
+line in the columns left */
+static int OutputSuggestion(SLINPUT_State *state) {
+  const TermInfo *term_info = &state->term_info;
+  const LineInfo *line_info = &state->line_info;
+  ptrdiff_t num_columns;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  sli_ushort encoding;
+  int result;
+
+  state->history_suggestion.shown = (sli_ushort) SuggestFind(state);
+  if (!state->history_suggestion.shown)
+    return 0;
+
+  num_columns = line_info->fit_len -
+    LineColumns(line_info, line_info->scroll_ptr, line_info->end_ptr);
+  encoding = HistoryLineSuffix(term_info, &state->history_suggestion.position,
+    (size_t) (line_info->end_ptr - line_info->buffer), &text, &text_end);
+  result = term_info->cursor_control_out(state, term_info->stream_out,
+    SLINPUT_CCC_DIM_ON);
+  while (text < text_end) {
+    sli_char character;
+    text = HistoryReadChar(encoding, text, &character);
+    if (CharWidth(character) > num_columns)
+      break;
+
+    num_columns -= CharWidth(character);
+    result = Minimum(result,
+      term_info->putchar_out(state, term_info->stream_out, character));
+  }
+
+  result = Minimum(result,
+    term_info->cursor_control_out(state, term_info->stream_out,
+    SLINPUT_CCC_DIM_OFF));
+
+  return result;
 }
 
 /* Complete input of the line, if nothing was entered then produce a single
 newline */
 static int LineEnter(SLINPUT_State *state) {
   SLINPUT_Stream stream = state->term_info.stream_out;
-  const int result = (*state->term_info.putchar_out)(state, stream, '\n');
   LineInfo *line_info = &state->line_info;
+  int result = 0;
+
+  /* Clear the suggestion, which is not part of the line entered */
+  if (state->history_suggestion.shown &&
+      line_info->cursor_ptr == line_info->end_ptr) {
+    result = state->term_info.cursor_control_out(state, stream,
+      SLINPUT_CCC_CLEAR_TO_END_OF_LINE);
+  }
+
+  result = Minimum(result,
+    (*state->term_info.putchar_out)(state, stream, '\n'));
   if (line_info->end_ptr == line_info->buffer && line_info->max_chars) {
     *line_info->end_ptr++ = '\n';
     *line_info->end_ptr = '\0';
@@ -127,7 +3035,7 @@ static int LineEnter(SLINPUT_State *state) {
 static int RedrawLine(SLINPUT_State *state) {
   const TermInfo *term_info = &state->term_info;
   const LineInfo *line_info = &state->line_info;
-  ptrdiff_t num_chars;
+  const sli_char *next_ptr;
   /* Clear line and place cursor on left, output the prompt,
   output text up to cursor, save cursor position, output the
   buffer, restore cursor position */
@@ -151,15 +3059,16 @@ static int RedrawLine(SLINPUT_State *state) {
   result = Minimum(result,
     term_info->cursor_control_out(state, term_info->stream_out,
     SLINPUT_CCC_SAVE_CURSOR));
-  num_chars = line_info->fit_len + line_info->scroll_ptr -
-    line_info->cursor_ptr;
   result = Minimum(result,
-    OutputMaxChars(state, num_chars, line_info->cursor_ptr));
+    OutputColumns(state, line_info->fit_len - LineColumns(line_info,
+    line_info->scroll_ptr, line_info->cursor_ptr), line_info->cursor_ptr,
+    &next_ptr));
+  result = Minimum(result, OutputSuggestion(state));
 
   /* Right continuation character */
   result = Minimum(result,
     term_info->putchar_out(state, term_info->stream_out,
-    line_info->scroll_ptr + line_info->fit_len < line_info->end_ptr ?
+    next_ptr < line_info->end_ptr ?
     term_info->continuation_character_right : ' '));
 
   result = Minimum(result,
@@ -177,7 +3086,7 @@ position */
 static int RedrawLineFromCursor(SLINPUT_State *state) {
   const TermInfo *term_info = &state->term_info;
   const LineInfo *line_info = &state->line_info;
-  ptrdiff_t num_chars;
+  const sli_char *next_ptr;
   /* Clear to end of line, save cursor position,
   output string at cursor_ptr, restore cursor position. */
   int result = term_info->cursor_control_out(state, term_info->stream_out,
@@ -188,15 +3097,16 @@ static int RedrawLineFromCursor(SLINPUT_State *state) {
   result = Minimum(result,
     term_info->cursor_control_out(state, term_info->stream_out,
     SLINPUT_CCC_SAVE_CURSOR));
-  num_chars = line_info->fit_len + line_info->scroll_ptr -
-    line_info->cursor_ptr;
   result = Minimum(result,
-    OutputMaxChars(state, num_chars, line_info->cursor_ptr));
+    OutputColumns(state, line_info->fit_len - LineColumns(line_info,
+    line_info->scroll_ptr, line_info->cursor_ptr), line_info->cursor_ptr,
+    &next_ptr));
+  result = Minimum(result, OutputSuggestion(state));
 
   /* Right continuation character */
   result = Minimum(result,
     term_info->putchar_out(state, term_info->stream_out,
-    line_info->scroll_ptr + line_info->fit_len < line_info->end_ptr ?
+    next_ptr < line_info->end_ptr ?
     term_info->continuation_character_right : ' '));
 
   result = Minimum(result,
@@ -216,22 +3126,30 @@ static int LineBackspace(SLINPUT_State *state) {
 
   int result = 0;
   if (line_info->cursor_ptr > line_info->buffer)  {
-    sli_char *ptr;
-    for (ptr = --line_info->cursor_ptr; ptr < line_info->end_ptr;
-        ++ptr) {
-      *ptr = *(ptr+1);
-    }
-    --line_info->end_ptr;
-
-    if (line_info->cursor_ptr < line_info->scroll_ptr +
+    /* Delete the grapheme cluster before the cursor */
+    sli_char *cluster_ptr = ClusterLeft(line_info, line_info->cursor_ptr);
+    const sli_ushort position =
+      (sli_ushort) (cluster_ptr - line_info->buffer);
+    const sli_ushort num_chars =
+      (sli_ushort) (line_info->cursor_ptr - cluster_ptr);
+    ptrdiff_t width =
+      LineColumns(line_info, cluster_ptr, line_info->cursor_ptr);
+    UndoRecordEdit(state, EDIT_DELETE, position, num_chars, EmptyString, 0);
+    LineSplice(line_info, position, num_chars, 0);
+    LineMeasure(line_info, position, 0);
+    line_info->cursor_ptr = cluster_ptr;
+
+    if (line_info->cursor_ptr < line_info->scroll_ptr ||
+        LineColumns(line_info, line_info->scroll_ptr, line_info->cursor_ptr) <
         line_info->cursor_margin) {
-      if (line_info->scroll_ptr > line_info->buffer)
-        --line_info->scroll_ptr;
+      ScrollToCursor(line_info);
       result = RedrawLine(state);
     } else {
-      /* Backspace */
-      result = Minimum(result,
-        term_info->putchar_out(state, term_info->stream_out, '\b'));
+      /* Backspace over the columns of the deleted cluster */
+      while (width-- > 0) {
+        result = Minimum(result,
+          term_info->putchar_out(state, term_info->stream_out, '\b'));
+      }
       result = Minimum(result,
         RedrawLineFromCursor(state));
     }
@@ -255,10 +3173,15 @@ static int LineTab(SLINPUT_State *state) {
 /* Clear the input line and place cursor at start of line */
 static int LineEscape(SLINPUT_State *state) {
   LineInfo *line_info = &state->line_info;
+  if (line_info->end_ptr > line_info->buffer) {
+    UndoRecordEdit(state, EDIT_DELETE, 0,
+      (sli_ushort) (line_info->end_ptr - line_info->buffer), EmptyString, 0);
+  }
   line_info->end_ptr = line_info->buffer;
   line_info->cursor_ptr = line_info->buffer;
   line_info->scroll_ptr = line_info->buffer;
   *line_info->end_ptr = '\0';
+  ColumnSumsRebuild(line_info, 0);
 
   return RedrawLine(state);
 }
@@ -276,28 +3199,112 @@ static int LineDelete(SLINPUT_State *state) {
   LineInfo *line_info = &state->line_info;
   int result = 0;
   if (line_info->cursor_ptr < line_info->end_ptr) {
-    sli_char *ptr;
-    for (ptr = line_info->cursor_ptr; ptr < line_info->end_ptr; ++ptr)
-      *ptr = *(ptr+1);
-    --line_info->end_ptr;
+    /* Delete the grapheme cluster at the cursor */
+    const sli_ushort position =
+      (sli_ushort) (line_info->cursor_ptr - line_info->buffer);
+    const sli_ushort num_chars = (sli_ushort)
+      (ClusterRight(line_info, line_info->cursor_ptr) - line_info->cursor_ptr);
+    UndoRecordEdit(state, EDIT_DELETE, position, num_chars, EmptyString, 0);
+    LineSplice(line_info, position, num_chars, 0);
+    LineMeasure(line_info, position, 0);
     result = RedrawLineFromCursor(state);
   }
 
   return result;
 }
 
-/* Replaces the line with another string. Line is scrolled to display the end
-of the string. */
-static int LineReplace(SLINPUT_State *state, const sli_char *str, int redraw) {
-  LineInfo *line_info = &state->line_info;
-  line_info->end_ptr = CopyChars(line_info->max_chars, str,
-    line_info->buffer);
-  line_info->cursor_ptr = line_info->end_ptr;
-  line_info->scroll_ptr = line_info->end_ptr - line_info->fit_len;
-  if (line_info->scroll_ptr < line_info->buffer)
-    line_info->scroll_ptr = line_info->buffer;
+/* Replaces the line with num_chars characters of str, up to the buffer size.
+Line is scrolled to display the end of the string. The replacement is recorded
+in the undo log as the edit kind. */
+static int LineReplaceChars(SLINPUT_State *state, const sli_char *str,
+    size_t num_chars, EditKind kind, int redraw) {
+  LineInfo *line_info = &state->line_info;
+  sli_char *gap_ptr;
+  sli_ushort index;
+  if (num_chars > line_info->max_chars)
+    num_chars = line_info->max_chars;
+
+  UndoRecordEdit(state, kind, 0,
+    (sli_ushort) (line_info->end_ptr - line_info->buffer), str,
+    (sli_ushort) num_chars);
+  gap_ptr = LineSplice(line_info, 0,
+    (sli_ushort) (line_info->end_ptr - line_info->buffer),
+    (sli_ushort) num_chars);
+  for (index = 0; index < num_chars; ++index)
+    gap_ptr[index] = str[index];
+  LineMeasure(line_info, 0, (sli_ushort) num_chars);
+  line_info->cursor_ptr = line_info->end_ptr;
+  line_info->scroll_ptr = LineColumnsLeft(line_info, line_info->end_ptr,
+    line_info->fit_len);
+
+  return redraw ? RedrawLine(state) : 0;
+}
+
+/* Replaces the line with another string */
+static int LineReplace(SLINPUT_State *state, const sli_char *str,
+    EditKind kind, int redraw) {
+  sli_ushort num_chars = 0;
+  while (num_chars < state->line_info.max_chars && str[num_chars])
+    ++num_chars;
+
+  return LineReplaceChars(state, str, num_chars, kind, redraw);
+}
+
+/* Replaces the line with the line at a history position, or empties it at
+the empty line. A line not stored natively, in the ring or in the history
+file, is decoded into a temporary buffer, so only the line recalled is ever
+decoded. */
+static int LineRecall(SLINPUT_State *state, const HistoryPosition *position,
+    int redraw) {
+  const TermInfo *term_info = &state->term_info;
+  const size_t max_chars = state->line_info.max_chars;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  sli_ushort encoding;
+  sli_char *decoded;
+  size_t num_chars = 0;
+  int result;
+  if (!position->file_end && position->index == term_info->num_history)
+    return LineReplaceChars(state, EmptyString, 0, EDIT_HISTORY, redraw);
+
+  encoding = HistoryLineText(term_info, position, &text, &text_end);
+  if (encoding == SLINPUT_HE_NATIVE) {
+    return LineReplaceChars(state, (const sli_char *) text,
+      (size_t) (text_end - text) / sizeof(sli_char), EDIT_HISTORY, redraw);
+  }
+
+  /* Each character takes at least one byte */
+  decoded = term_info->malloc_in(term_info->alloc_info, sizeof(sli_char)*
+    ((size_t) (text_end - text) < max_chars ?
+    (size_t) (text_end - text) + 1 : max_chars + 1));
+  if (!decoded) {
+    /* Out of memory */
+    return -1;
+  }
+
+  while (text < text_end && num_chars < max_chars)
+    text = HistoryReadChar(encoding, text, &decoded[num_chars++]);
+
+  result = LineReplaceChars(state, decoded, num_chars, EDIT_HISTORY, redraw);
+  term_info->free_in(term_info->alloc_info, decoded);
+  return result;
+}
+
+/* Finds the position leftwards of cursor_ptr at the first letter of a word */
+static sli_char *WarpLeft(SLINPUT_State *state, sli_char *cursor_ptr) {
+  const TermInfo *term_info = &state->term_info;
+  sli_char *buffer = state->line_info.buffer;
+
+  if (cursor_ptr <= buffer + 1)
+    return buffer;
+
+  if (term_info->is_space_in(state, term_info->stream_in, *cursor_ptr) ||
+      term_info->is_space_in(state, term_info->stream_in, *(cursor_ptr - 1))) {
+    return FindStartOfWord(state, buffer,
+      SkipSpacesLeft(state, buffer, cursor_ptr - 1));
+  }
 
-  return redraw ? RedrawLine(state) : 0;
+  return FindStartOfWord(state, buffer, cursor_ptr);
 }
 
 /* Move the cursor to the left. If cursor_warp_enabled is set then move cursor
@@ -308,23 +3315,12 @@ static int LineKeyLeft(SLINPUT_State *state, int cursor_warp_enabled) {
   const sli_char *orig_cursor_ptr = line_info->cursor_ptr;
   const sli_char *orig_scroll_ptr;
   int result = 0;
-  ptrdiff_t left_delta;
+  ptrdiff_t num_columns;
 
-  if (!cursor_warp_enabled ||
-      line_info->cursor_ptr <= line_info->buffer + 1) {
-    if (line_info->cursor_ptr > line_info->buffer)
-      --line_info->cursor_ptr;
+  if (!cursor_warp_enabled) {
+    line_info->cursor_ptr = ClusterLeft(line_info, line_info->cursor_ptr);
   } else {
-    if (term_info->is_space_in(state, term_info->stream_in,
-          *line_info->cursor_ptr) ||
-        term_info->is_space_in(state, term_info->stream_in,
-          *(line_info->cursor_ptr - 1))) {
-      line_info->cursor_ptr = FindStartOfWord(state, line_info->buffer,
-        SkipSpacesLeft(state, line_info->buffer, line_info->cursor_ptr - 1));
-    } else {
-      line_info->cursor_ptr = FindStartOfWord(state, line_info->buffer,
-        line_info->cursor_ptr);
-    }
+    line_info->cursor_ptr = WarpLeft(state, line_info->cursor_ptr);
   }
 
   if (line_info->cursor_ptr == orig_cursor_ptr) {
@@ -334,20 +3330,16 @@ static int LineKeyLeft(SLINPUT_State *state, int cursor_warp_enabled) {
 
   /* Adjust scroll pointer if necessary */
   orig_scroll_ptr = line_info->scroll_ptr;
-  left_delta = line_info->scroll_ptr + line_info->cursor_margin -
-    line_info->cursor_ptr;
-  if (left_delta > 0) {
-    line_info->scroll_ptr -= left_delta;
-    if (line_info->scroll_ptr < line_info->buffer)
-      line_info->scroll_ptr = line_info->buffer;
-  }
+  ScrollToCursor(line_info);
 
   if (line_info->scroll_ptr != orig_scroll_ptr) {
     /* Scroll pointer has changed so redraw the line */
     result = RedrawLine(state);
   } else {
-    /* Move cursor leftwards */
-    while (line_info->cursor_ptr < orig_cursor_ptr--) {
+    /* Move cursor leftwards over the columns passed */
+    num_columns =
+      LineColumns(line_info, line_info->cursor_ptr, orig_cursor_ptr);
+    while (num_columns-- > 0) {
       result = Minimum(result,
         term_info->cursor_control_out(state, term_info->stream_out,
         SLINPUT_CCC_CURSOR_LEFT));
@@ -365,12 +3357,11 @@ static int LineKeyRight(SLINPUT_State *state, int cursor_warp_enabled) {
   const sli_char *orig_cursor_ptr = line_info->cursor_ptr;
   const sli_char *orig_scroll_ptr;
   int result = 0;
-  ptrdiff_t right_delta;
+  ptrdiff_t num_columns;
 
   if (!cursor_warp_enabled ||
       line_info->cursor_ptr >= line_info->end_ptr - 1) {
-    if (line_info->cursor_ptr < line_info->end_ptr)
-      ++line_info->cursor_ptr;
+    line_info->cursor_ptr = ClusterRight(line_info, line_info->cursor_ptr);
   } else {
     if (term_info->is_space_in(state, term_info->stream_in,
           *line_info->cursor_ptr) ||
@@ -391,23 +3382,16 @@ static int LineKeyRight(SLINPUT_State *state, int cursor_warp_enabled) {
 
   /* Adjust scroll pointer if necessary */
   orig_scroll_ptr = line_info->scroll_ptr;
-  right_delta = line_info->cursor_ptr - line_info->scroll_ptr -
-    line_info->fit_len + line_info->cursor_margin;
-  if (right_delta > 0) {
-    line_info->scroll_ptr += right_delta;
-    if (line_info->scroll_ptr + line_info->fit_len > line_info->end_ptr) {
-      line_info->scroll_ptr = line_info->end_ptr - line_info->fit_len;
-      if (line_info->scroll_ptr < line_info->buffer)
-        line_info->scroll_ptr = line_info->buffer;
-    }
-  }
+  ScrollToCursor(line_info);
 
   if (line_info->scroll_ptr != orig_scroll_ptr) {
     /* Scroll pointer has changed so redraw the line */
     result = RedrawLine(state);
   } else {
-    /* Move cursor rightwards */
-    while (line_info->cursor_ptr > orig_cursor_ptr++) {
+    /* Move cursor rightwards over the columns passed */
+    num_columns =
+      LineColumns(line_info, orig_cursor_ptr, line_info->cursor_ptr);
+    while (num_columns-- > 0) {
       result = Minimum(result,
         term_info->cursor_control_out(state, term_info->stream_out,
         SLINPUT_CCC_CURSOR_RIGHT));
@@ -429,9 +3413,8 @@ static int LineHome(SLINPUT_State *state) {
 static int LineEnd(SLINPUT_State *state) {
   LineInfo *line_info = &state->line_info;
   line_info->cursor_ptr = line_info->end_ptr;
-  line_info->scroll_ptr = line_info->end_ptr - line_info->fit_len;
-  if (line_info->scroll_ptr < line_info->buffer)
-    line_info->scroll_ptr = line_info->buffer;
+  line_info->scroll_ptr = LineColumnsLeft(line_info, line_info->end_ptr,
+    line_info->fit_len);
   return RedrawLine(state);
 }
 
@@ -442,21 +3425,27 @@ static int LineCharIn(SLINPUT_State *state, sli_char char_in) {
 
   int result = 0;
   if (line_info->end_ptr - line_info->buffer < line_info->max_chars) {
+    const sli_ushort position =
+      (sli_ushort) (line_info->cursor_ptr - line_info->buffer);
+    const sli_char *next_ptr;
     ptrdiff_t working_margin;
-    sli_char *ptr;
-    for (ptr = line_info->end_ptr; ptr > line_info->cursor_ptr; --ptr)
-      *ptr = *(ptr-1);
-    *line_info->cursor_ptr++ = char_in;
-    *++line_info->end_ptr = '\0';
-
-    working_margin = line_info->end_ptr - line_info->cursor_ptr;
+    UndoRecordEdit(state, EDIT_INSERT_CHAR, position, 0, &char_in, 1);
+    *LineSplice(line_info, position, 0, 1) = char_in;
+    LineMeasure(line_info, position, 1);
+    ++line_info->cursor_ptr;
+
+    /* Columns after the cursor, limited to the cursor margin */
+    working_margin = LineColumns(line_info, line_info->cursor_ptr,
+      line_info->end_ptr - line_info->cursor_ptr > line_info->cursor_margin ?
+      line_info->cursor_ptr + line_info->cursor_margin : line_info->end_ptr);
     if (working_margin > line_info->cursor_margin)
       working_margin = line_info->cursor_margin;
 
-    if (line_info->cursor_ptr - line_info->scroll_ptr > line_info->fit_len -
-        working_margin) {
+    if (LineColumns(line_info, line_info->scroll_ptr, line_info->cursor_ptr) >
+        line_info->fit_len - working_margin) {
       /* Scroll and redraw the line */
-      ++line_info->scroll_ptr;
+      line_info->scroll_ptr = LineColumnsLeft(line_info,
+        line_info->cursor_ptr, line_info->fit_len - working_margin);
       result = RedrawLine(state);
     } else {
       result = Minimum(result,
@@ -464,21 +3453,29 @@ static int LineCharIn(SLINPUT_State *state, sli_char char_in) {
         SLINPUT_CCC_DISABLE_CURSOR));
 
       /* Output char_in, save cursor position, output string at
-      cursor_ptr, restore cursor position. */
+      cursor_ptr, restore cursor position. A suggestion shown before is
+      cleared first. */
       result = Minimum(result,
         term_info->putchar_out(state, term_info->stream_out, char_in));
+      if (state->history_suggestion.shown) {
+        result = Minimum(result,
+          term_info->cursor_control_out(state, term_info->stream_out,
+          SLINPUT_CCC_CLEAR_TO_END_OF_LINE));
+      }
       result = Minimum(result,
         term_info->cursor_control_out(state, term_info->stream_out,
         SLINPUT_CCC_SAVE_CURSOR));
 
       result = Minimum(result,
-        OutputMaxChars(state, line_info->fit_len + line_info->scroll_ptr -
-        line_info->cursor_ptr, line_info->cursor_ptr));
+        OutputColumns(state, line_info->fit_len - LineColumns(line_info,
+        line_info->scroll_ptr, line_info->cursor_ptr), line_info->cursor_ptr,
+        &next_ptr));
+      result = Minimum(result, OutputSuggestion(state));
 
       /* Right continuation character */
       result = Minimum(result,
         term_info->putchar_out(state, term_info->stream_out,
-          line_info->scroll_ptr + line_info->fit_len < line_info->end_ptr ?
+          next_ptr < line_info->end_ptr ?
           term_info->continuation_character_right : ' '));
 
       result = Minimum(result,
@@ -494,13 +3491,177 @@ static int LineCharIn(SLINPUT_State *state, sli_char char_in) {
   return result;
 }
 
-/* Determine the length of the string in characters */
-static size_t StringLength(const sli_char *str) {
-  const sli_char *ptr = str;
-  while (*ptr)
-    ++ptr;
+/* Undoes the most recent edit, restoring the text and cursor position */
+static int LineUndo(SLINPUT_State *state) {
+  UndoLog *undo_log = &state->undo_log;
+  LineInfo *line_info = &state->line_info;
+  const EditRecord *record;
+
+  if (!undo_log->num_undo)
+    return 0;
+
+  record = UndoLogRecord(undo_log, --undo_log->num_undo);
+  UndoCopyText(undo_log, record->text_index, record->num_deleted,
+    LineSplice(line_info, record->position, record->num_inserted,
+    record->num_deleted));
+  LineMeasure(line_info, record->position, record->num_deleted);
+  line_info->cursor_ptr = line_info->buffer + record->cursor;
+  ScrollToCursor(line_info);
+
+  return RedrawLine(state);
+}
+
+/* Redoes the most recently undone edit */
+static int LineRedo(SLINPUT_State *state) {
+  UndoLog *undo_log = &state->undo_log;
+  LineInfo *line_info = &state->line_info;
+  const EditRecord *record;
+
+  if (undo_log->num_undo == undo_log->num_records)
+    return 0;
+
+  record = UndoLogRecord(undo_log, undo_log->num_undo++);
+  UndoCopyText(undo_log,
+    (unsigned long) record->text_index + record->num_deleted,
+    record->num_inserted, LineSplice(line_info, record->position,
+    record->num_deleted, record->num_inserted));
+  LineMeasure(line_info, record->position, record->num_inserted);
+  line_info->cursor_ptr =
+    line_info->buffer + record->position + record->num_inserted;
+  ScrollToCursor(line_info);
+
+  return RedrawLine(state);
+}
+
+/* Saves killed text as the newest kill ring entry, discarding the oldest
+entry when the ring is full. Returns a negative value if out of memory. */
+static int KillRingPush(SLINPUT_State *state, const sli_char *text,
+    sli_ushort num_chars) {
+  const TermInfo *term_info = &state->term_info;
+  KillRing *kill_ring = &state->kill_ring;
+  sli_char *entry = term_info->malloc_in(term_info->alloc_info,
+    sizeof(sli_char)*((size_t) num_chars + 1));
+  if (!entry)
+    return -1;
+
+  CopyChars(num_chars, text, entry);
+
+  kill_ring->newest =
+    (sli_ushort) ((kill_ring->newest + 1) % SLINPUT_KILL_RING_SIZE);
+  if (kill_ring->num_entries == SLINPUT_KILL_RING_SIZE) {
+    term_info->free_in(term_info->alloc_info,
+      kill_ring->entries[kill_ring->newest]);
+  } else {
+    ++kill_ring->num_entries;
+  }
+
+  kill_ring->entries[kill_ring->newest] = entry;
+  return 0;
+}
+
+/* Replaces num_removed characters at position with text, clipping the text
+to the space available in the buffer. The cursor is placed after the text and
+the line is redrawn. The number of characters inserted is stored in
+num_inserted. */
+static int LineSpliceText(SLINPUT_State *state, sli_ushort position,
+    sli_ushort num_removed, const sli_char *text, sli_ushort num_chars,
+    sli_ushort *num_inserted) {
+  LineInfo *line_info = &state->line_info;
+  const ptrdiff_t available = line_info->max_chars -
+    (line_info->end_ptr - line_info->buffer) + num_removed;
+  sli_char *gap_ptr;
+  sli_ushort index;
+
+  if (num_chars > available)
+    num_chars = (sli_ushort) available;
+
+  *num_inserted = num_chars;
+  if (!num_chars && !num_removed)
+    return 0;
+
+  UndoRecordEdit(state, EDIT_INSERT, position, num_removed, text, num_chars);
+  gap_ptr = LineSplice(line_info, position, num_removed, num_chars);
+  for (index = 0; index < num_chars; ++index)
+    gap_ptr[index] = text[index];
+  LineMeasure(line_info, position, num_chars);
+
+  line_info->cursor_ptr = line_info->buffer + position + num_chars;
+  ScrollToCursor(line_info);
+
+  return RedrawLine(state);
+}
+
+/* Kills the characters between from_ptr and to_ptr, saving them in the kill
+ring. The cursor is placed at from_ptr. */
+static int LineKill(SLINPUT_State *state, sli_char *from_ptr,
+    sli_char *to_ptr) {
+  LineInfo *line_info = &state->line_info;
+  const sli_char *orig_cursor_ptr = line_info->cursor_ptr;
+  const sli_char *orig_scroll_ptr = line_info->scroll_ptr;
+  const sli_ushort position = (sli_ushort) (from_ptr - line_info->buffer);
+  const sli_ushort num_chars = (sli_ushort) (to_ptr - from_ptr);
+
+  if (!num_chars)
+    return 0;
+
+  /* If the kill ring is out of memory, the text is still deleted as it can
+  be recovered by undo */
+  KillRingPush(state, from_ptr, num_chars);
+
+  UndoRecordEdit(state, EDIT_DELETE, position, num_chars, EmptyString, 0);
+  LineSplice(line_info, position, num_chars, 0);
+  LineMeasure(line_info, position, 0);
+  line_info->cursor_ptr = from_ptr;
+  ScrollToCursor(line_info);
+
+  if (line_info->cursor_ptr == orig_cursor_ptr &&
+      line_info->scroll_ptr == orig_scroll_ptr) {
+    /* Only the text from the cursor onwards has changed */
+    return RedrawLineFromCursor(state);
+  }
+
+  return RedrawLine(state);
+}
 
-  return (size_t) (ptr - str);
+/* Inserts the newest kill ring entry at the cursor */
+static int LineYank(SLINPUT_State *state) {
+  KillRing *kill_ring = &state->kill_ring;
+  LineInfo *line_info = &state->line_info;
+  const sli_char *entry;
+  sli_ushort num_chars = 0;
+
+  if (!kill_ring->num_entries)
+    return 0;
+
+  entry = kill_ring->entries[kill_ring->newest];
+  while (entry[num_chars])
+    ++num_chars;
+
+  kill_ring->yank_age = 0;
+  kill_ring->yank_position =
+    (sli_ushort) (line_info->cursor_ptr - line_info->buffer);
+  return LineSpliceText(state, kill_ring->yank_position, 0, entry, num_chars,
+    &kill_ring->yank_length);
+}
+
+/* Replaces the text just yanked with the next older kill ring entry */
+static int LineYankPop(SLINPUT_State *state) {
+  KillRing *kill_ring = &state->kill_ring;
+  const sli_char *entry;
+  sli_ushort num_chars = 0;
+
+  if (!kill_ring->yank_length || kill_ring->num_entries < 2)
+    return 0;
+
+  kill_ring->yank_age =
+    (sli_ushort) ((kill_ring->yank_age + 1) % kill_ring->num_entries);
+  entry = kill_ring->entries[(kill_ring->newest + SLINPUT_KILL_RING_SIZE -
+    kill_ring->yank_age) % SLINPUT_KILL_RING_SIZE];
+  while (entry[num_chars])
+    ++num_chars;
+
+  return LineSpliceText(state, kill_ring->yank_position,
+    kill_ring->yank_length, entry, num_chars, &kill_ring->yank_length);
 }
 
 /* Applies dimension constraints derived from available columns */
@@ -544,7 +3705,7 @@ static int ApplyDimension(SLINPUT_State *state) {
   priority. Secondly we then prioritise the prompt. Thirdly, the cursor
   margin, as this just provides a scrolling convenience. */
 
-  prompt_length = StringLength(line_info->prompt_in);
+  prompt_length = StringColumns(line_info->prompt_in);
   cursor_margin = term_info->cursor_margin_in;
 
   /* First, can we fit in the prompt and cursor margin? */
@@ -583,45 +3744,775 @@ static int ApplyDimension(SLINPUT_State *state) {
   scroll ptr so the cursor remains on screen. */
   line_info->columns = (sli_sshort) columns;
 
-  line_info->scroll_ptr = line_info->cursor_ptr - line_info->fit_len;
-  if (line_info->scroll_ptr < line_info->buffer)
-    line_info->scroll_ptr = line_info->buffer;
+  line_info->scroll_ptr = LineColumnsLeft(line_info, line_info->cursor_ptr,
+    line_info->fit_len);
+
+  /* Return 1 to indicate a redraw needs to take place. */
+  return 1;
+}
+
+/* Flushes the input stream */
+static int FlushInput(SLINPUT_State *state) {
+  const TermInfo *term_info = &state->term_info;
+
+  /* Flush input */
+  int result = 0;
+  while (result >= 0 && (result =
+      term_info->is_char_available_in(state, term_info->stream_in)) > 0) {
+    /* A character is available so get it */
+    result =
+      term_info->get_char_in_in(state, term_info->stream_in, NULL, NULL);
+  }
+
+  return result;
+}
+
+/* Moves to the previous, or next, line in history starting with the text
+before the cursor, keeping the cursor after that text. Moving down past the
+newest line leaves just that text. */
+static int LinePrefixBrowse(SLINPUT_State *state,
+    HistoryPosition *history_position, int older) {
+  TermInfo *term_info = &state->term_info;
+  LineInfo *line_info = &state->line_info;
+  const sli_ushort prefix_length =
+    (sli_ushort) (line_info->cursor_ptr - line_info->buffer);
+  size_t num_probes = (size_t) -1;
+  sli_ushort num_inserted;
+  int result;
+  if (!term_info->prefix_index && PrefixIndexBuild(term_info) < 0)
+    return -1;
+
+  /* Records of the history file not yet loaded are older than any listed */
+  while (!(result = PrefixStep(term_info, line_info->buffer, prefix_length,
+      history_position, older, &num_probes)) && older &&
+      term_info->prefix_file_next) {
+    if (PrefixIndexLoad(term_info, SLINPUT_PREFIX_LOAD_LINES) < 0)
+      return -1;
+  }
+
+  if (!result) {
+    if (older || (!history_position->file_end &&
+        history_position->index == term_info->num_history))
+      return 0;
+
+    history_position->index = term_info->num_history;
+    history_position->file_end = 0;
+    return LineSpliceText(state, prefix_length,
+      (sli_ushort) (line_info->end_ptr - line_info->cursor_ptr),
+      line_info->buffer, 0, &num_inserted);
+  }
+
+  result = LineRecall(state, history_position, 0);
+  if (result < 0)
+    return result;
+
+  line_info->cursor_ptr = line_info->buffer + prefix_length;
+  ScrollToCursor(line_info);
+  return RedrawLine(state);
+}
+
+/* Decodes the line at a history position for searching, unless it is stored
+natively. Returns the characters of the line, or NULL if out of memory. */
+static const sli_char *SearchText(SLINPUT_State *state,
+    const HistoryPosition *position, size_t *num_chars) {
+  const TermInfo *term_info = &state->term_info;
+  HistorySearch *search = &state->history_search;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  const sli_ushort encoding =
+    HistoryLineText(term_info, position, &text, &text_end);
+  if (encoding == SLINPUT_HE_NATIVE) {
+    *num_chars = (size_t) (text_end - text) / sizeof(sli_char);
+    return (const sli_char *) text;
+  }
+
+  /* Each character takes at least one byte */
+  if (search->text_size < (size_t) (text_end - text)) {
+    if (search->text)
+      term_info->free_in(term_info->alloc_info, search->text);
+    search->text_size = 0;
+    search->text = term_info->malloc_in(term_info->alloc_info,
+      sizeof(sli_char)*(size_t) (text_end - text));
+    if (!search->text)
+      return NULL;
+    search->text_size = (size_t) (text_end - text);
+  }
+
+  *num_chars = 0;
+  while (text < text_end)
+    text = HistoryReadChar(encoding, text, &search->text[(*num_chars)++]);
+
+  return search->text;
+}
+
+/* Returns the index of the first occurrence of the query in text, or
+num_chars if there is none */
+static size_t SearchFind(const HistorySearch *search, const sli_char *text,
+    size_t num_chars) {
+  size_t index;
+  size_t query_index;
+  for (index = 0; index + search->query_length <= num_chars; ++index) {
+    for (query_index = 0; query_index < search->query_length &&
+        text[index + query_index] == search->query[query_index];
+        ++query_index) {
+    }
+
+    if (query_index == search->query_length)
+      return index;
+  }
+
+  return num_chars;
+}
+
+/* Returns non-zero if a character of text matches a character of a fuzzy
+query. A lower case query character also matches its capital. */
+static int FuzzyEqual(sli_char query_char, sli_char text_char) {
+  return text_char == query_char ||
+    (query_char >= 'a' && query_char <= 'z' &&
+    FuzzyLower(text_char) == query_char);
+}
+
+/* Returns non-zero if a character separates words, for fuzzy match scoring.
+Tasks may score lines concurrently, so no callback is used. */
+static int FuzzyIsBoundary(sli_char character) {
+  static const char separators[] = " \t/\\-_.:,;=";
+  size_t index;
+  for (index = 0; separators[index]; ++index) {
+    if (character == (sli_char) separators[index])
+      return 1;
+  }
+
+  return 0;
+}
+
+/* Scores the text of a line, stored using the history encoding, as a fuzzy
+match of the query, whose characters must appear in the text in order. The
+shortest window of text ending where the query is first matched is scored,
+and the number of characters before it stored in start. Returns a positive
+score, or zero if the text does not match. */
+static long FuzzyScore(const sli_char *query, size_t query_length,
+    sli_ushort encoding, const unsigned char *text,
+    const unsigned char *text_end, size_t *start) {
+  const unsigned char *window;
+  const unsigned char *end;
+  size_t query_index = 0;
+  sli_char previous = ' ';
+  sli_char character;
+  long score = 0;
+  int matched = 0;
+  if (!query_length)
+    return 0;
+
+  /* Forwards to where the query is first matched */
+  *start = 0;
+  for (end = text; end < text_end && query_index < query_length;
+      ++*start) {
+    end = HistoryReadChar(encoding, end, &character);
+    if (FuzzyEqual(query[query_index], character))
+      ++query_index;
+  }
+
+  if (query_index < query_length)
+    return 0;
+
+  /* Backwards to the latest start of a match ending there */
+  window = end;
+  while (query_index > 0) {
+    window = HistoryReadCharBack(encoding, window, &character);
+    --*start;
+    if (FuzzyEqual(query[query_index - 1], character))
+      --query_index;
+  }
+
+  if (window > text)
+    HistoryReadCharBack(encoding, window, &previous);
+
+  while (window < end) {
+    window = HistoryReadChar(encoding, window, &character);
+    if (query_index < query_length &&
+        FuzzyEqual(query[query_index], character)) {
+      score += FUZZY_SCORE_MATCH;
+      if (matched)
+        score += FUZZY_BONUS_CONSECUTIVE;
+      if (FuzzyIsBoundary(previous))
+        score += FUZZY_BONUS_BOUNDARY;
+      matched = 1;
+      ++query_index;
+    } else {
+      score -= matched ? FUZZY_PENALTY_GAP_START : FUZZY_PENALTY_GAP;
+      matched = 0;
+    }
+
+    previous = character;
+  }
+
+  return score > 0 ? score : 1;
+}
+
+/* Returns non-zero if fuzzy match1 ranks above match2, by score and then by
+being newer */
+static int FuzzyBetter(const FuzzyMatch *match1, const FuzzyMatch *match2) {
+  return match1->score > match2->score ||
+    (match1->score == match2->score && match1->ordinal > match2->ordinal);
+}
+
+/* Places a match at the root of a heap of ranked matches, whose worst match
+is at the root, and sifts it down to its place */
+static void FuzzySiftDown(FuzzyMatch *ranked, size_t num_ranked,
+    const FuzzyMatch *match) {
+  size_t index = 0;
+  size_t child;
+  while ((child = 2*index + 1) < num_ranked) {
+    if (child + 1 < num_ranked && FuzzyBetter(&ranked[child],
+        &ranked[child + 1]))
+      ++child;
+    if (!FuzzyBetter(match, &ranked[child]))
+      break;
+
+    ranked[index] = ranked[child];
+    index = child;
+  }
+
+  ranked[index] = *match;
+}
+
+/* Offers a match to a heap of at most max_matches ranked matches, keeping
+the best of those offered with the worst at the root */
+static void FuzzyOffer(FuzzyMatch *ranked, size_t *num_ranked,
+    size_t max_matches, const FuzzyMatch *match) {
+  size_t index;
+  if (*num_ranked < max_matches) {
+    index = (*num_ranked)++;
+    while (index && FuzzyBetter(&ranked[(index - 1)/2], match)) {
+      ranked[index] = ranked[(index - 1)/2];
+      index = (index - 1)/2;
+    }
+
+    ranked[index] = *match;
+  } else if (max_matches && FuzzyBetter(match, &ranked[0])) {
+    FuzzySiftDown(ranked, *num_ranked, match);
+  }
+}
+
+/* Sorts a heap of ranked matches best first, by moving the worst to the end
+in turn */
+static void FuzzySort(FuzzyMatch *ranked, size_t num_ranked) {
+  for (; num_ranked > 1; --num_ranked) {
+    const FuzzyMatch worst = ranked[0];
+    FuzzySiftDown(ranked, num_ranked - 1, &ranked[num_ranked - 1]);
+    ranked[num_ranked - 1] = worst;
+  }
+}
+
+/* Runs the tasks in turn on the calling thread */
+static int RunTasksSerial(const SLINPUT_State *state,
+    SLINPUT_TaskInfo task_info, SLINPUT_Task *task, void *task_data,
+    size_t num_tasks) {
+  size_t task_index;
+  (void) state;
+  (void) task_info;
+  for (task_index = 0; task_index < num_tasks; ++task_index)
+    task(task_data, task_index);
+
+  return 0;
+}
+
+/* Scores a line as a fuzzy match for a shard, returning non-zero if the
+search has been cancelled. Input is polled every SLINPUT_SEARCH_POLL_LINES
+lines when the tasks run on the calling thread. */
+static int FuzzyShardLine(FuzzyRun *run, FuzzyShard *shard,
+    FuzzyMatch *match) {
+  const SLINPUT_State *state = run->state;
+  const TermInfo *term_info = &state->term_info;
+  const HistoryEntry *entry = match->position.file_end ? NULL :
+    HistoryAt(term_info, match->position.index);
+  const unsigned char *text;
+  const unsigned char *text_end;
+  const sli_ushort encoding = entry ?
+    HistoryEntryText(&shard->decode, entry, &text, &text_end) :
+    HistoryLineText(term_info, &match->position, &text, &text_end);
+  size_t start;
+  match->score = FuzzyScore(run->query, run->query_length, encoding, text,
+    text_end, &start);
+  if (match->score) {
+    /* Lines in the ring used often and lately rank higher, as do lines saved
+    in the current context */
+    if (entry) {
+      match->score += (long) (FrecencyNow(term_info, entry)/
+        FUZZY_FRECENCY_SCALE);
+      if (term_info->history_context && HistoryContextAt(term_info,
+          match->position.index) == term_info->history_context)
+        match->score += FUZZY_BONUS_CONTEXT;
+    }
+
+    match->ordinal = HistoryOrdinal(term_info, &match->position);
+    FuzzyOffer(shard->ranked, &shard->num_ranked, run->max_matches, match);
+  }
+
+  if (run->poll && !(++shard->num_scanned % SLINPUT_SEARCH_POLL_LINES) &&
+      term_info->is_char_available_in(state, term_info->stream_in) > 0)
+    run->cancelled = 1;
+
+  return run->cancelled;
+}
+
+/* Scores the lines in one shard of history as fuzzy matches, keeping the
+best in the shard's heap. Shards may run concurrently as tasks, so history is
+only read. */
+static void FuzzyShardTask(void *task_data, size_t task_index) {
+  FuzzyRun *run = (FuzzyRun *) task_data;
+  FuzzyShard *shard = &run->shards[run->first_shard + task_index];
+  const TermInfo *term_info = &run->state->term_info;
+  const unsigned char *contents = term_info->history_file.contents;
+  FuzzyMatch match;
+  shard->num_ranked = 0;
+  shard->num_scanned = 0;
+  if (shard->file_stop) {
+    /* Records starting in the range of file offsets. A shard starting part
+    way through a record skips to the next intact one, as recovery does. */
+    unsigned long end = HistoryFileNextEnd(term_info, shard->file_start);
+    match.position.index = run->oldest_index;
+    while (end && end - HISTORY_RECORD_TAIL - HISTORY_RECORD_HEAD -
+        GetLong32(contents + end - HISTORY_RECORD_TAIL) < shard->file_stop) {
+      match.position.file_end = end;
+      if (FuzzyShardLine(run, shard, &match))
+        return;
+
+      end = HistoryFileNextEnd(term_info, end);
+    }
+
+    return;
+  }
+
+  /* Lines in the range of ring indexes, ruled out first by their masks */
+  match.position.file_end = 0;
+  for (match.position.index = shard->first_index;
+      match.position.index < shard->end_index; ++match.position.index) {
+    const HistoryEntry *entry = HistoryAt(term_info, match.position.index);
+    if (entry && (entry->char_mask & run->query_mask) == run->query_mask &&
+        FuzzyShardLine(run, shard, &match))
+      return;
+  }
+}
+
+/* Ranks the lines in history as fuzzy matches of the query, keeping the best
+max_matches, best first. History is split into shards of the ring, and of
+the history file if whole_history is non-zero, which are scored as tasks by
+the task runner in batches and then merged. If cancellable is non-zero, the
+search is abandoned when a key is pressed, checked between batches on the
+calling thread. Tasks run by the default runner are on the calling thread, so
+also check as they go. Returns 1 if the search was cancelled. */
+static int FuzzyRank(SLINPUT_State *state, const sli_char *query,
+    size_t query_length, int whole_history, int cancellable,
+    FuzzyMatch *ranked, size_t max_matches, size_t *num_ranked) {
+  const TermInfo *term_info = &state->term_info;
+  const unsigned long file_start = sizeof(HistoryFileMagic);
+  const unsigned long file_end = whole_history ?
+    term_info->history_file_end : 0;
+  const size_t num_ring_shards = (term_info->num_history +
+    SLINPUT_SEARCH_SHARD_LINES - 1)/SLINPUT_SEARCH_SHARD_LINES;
+  const size_t num_shards = num_ring_shards + (file_end ? (size_t)
+    ((file_end - file_start + SLINPUT_SEARCH_SHARD_BYTES - 1)/
+    SLINPUT_SEARCH_SHARD_BYTES) : 0);
+  const size_t decode_size = term_info->history_decode ?
+    HistoryAlign(term_info->history_decode->size) : 0;
+  FuzzyMatch *shard_ranked;
+  unsigned char *decode_bytes;
+  FuzzyRun run;
+  size_t index;
+  int result;
+  *num_ranked = 0;
+  if (!max_matches || !num_shards)
+    return 0;
+
+  if (num_shards > ((size_t) -1)/sizeof(FuzzyShard) ||
+      max_matches > ((size_t) -1)/sizeof(FuzzyMatch)/num_shards ||
+      (decode_size && num_ring_shards > (((size_t) -1) -
+      sizeof(FuzzyMatch)*num_shards*max_matches)/decode_size)) {
+    /* Too large to allocate */
+    return -1;
+  }
+
+  run.shards = term_info->malloc_in(term_info->alloc_info,
+    sizeof(FuzzyShard)*num_shards);
+  shard_ranked = term_info->malloc_in(term_info->alloc_info,
+    sizeof(FuzzyMatch)*num_shards*max_matches +
+    decode_size*num_ring_shards);
+  if (!run.shards || !shard_ranked) {
+    /* Out of memory */
+    if (run.shards)
+      term_info->free_in(term_info->alloc_info, run.shards);
+    if (shard_ranked)
+      term_info->free_in(term_info->alloc_info, shard_ranked);
+    return -1;
+  }
+
+  run.state = state;
+  run.query = query;
+  run.query_length = query_length;
+  run.query_mask = 0;
+  for (index = 0; index < query_length; ++index) {
+    run.query_mask = (sli_ushort) (run.query_mask |
+      FuzzyMaskBit(query[index]));
+  }
+  run.max_matches = max_matches;
+  run.poll = (sli_ushort) (cancellable &&
+    term_info->run_tasks == RunTasksSerial);
+  run.cancelled = 0;
+
+  /* History file records follow the ring, which is left at its oldest */
+  run.oldest_index = 0;
+  while (run.oldest_index < term_info->num_history &&
+      !HistoryAt(term_info, run.oldest_index))
+    ++run.oldest_index;
+
+  /* Each ring shard decodes packed lines into bytes of its own */
+  decode_bytes = (unsigned char *) (shard_ranked + num_shards*max_matches);
+  for (index = 0; index < num_shards; ++index) {
+    FuzzyShard *shard = &run.shards[index];
+    shard->ranked = shard_ranked + index*max_matches;
+    shard->num_ranked = 0;
+    shard->decode.block = NULL;
+    shard->decode.offset = 0;
+    shard->decode.bytes = index < num_ring_shards ?
+      decode_bytes + index*decode_size : NULL;
+    shard->decode.size = decode_size;
+    shard->decode.line = 0;
+    if (index < num_ring_shards) {
+      shard->first_index = index*SLINPUT_SEARCH_SHARD_LINES;
+      shard->end_index = shard->first_index + SLINPUT_SEARCH_SHARD_LINES <
+        term_info->num_history ? shard->first_index +
+        SLINPUT_SEARCH_SHARD_LINES : term_info->num_history;
+      shard->file_start = 0;
+      shard->file_stop = 0;
+    } else {
+      shard->file_start = file_start +
+        (unsigned long) (index - num_ring_shards)*SLINPUT_SEARCH_SHARD_BYTES;
+      shard->file_stop = shard->file_start + SLINPUT_SEARCH_SHARD_BYTES <
+        file_end ? shard->file_start + SLINPUT_SEARCH_SHARD_BYTES : file_end;
+    }
+  }
+
+  result = 0;
+  for (run.first_shard = 0; result == 0 && run.first_shard < num_shards;
+      run.first_shard += SLINPUT_SEARCH_BATCH_SHARDS) {
+    result = term_info->run_tasks(state, term_info->task_info,
+      FuzzyShardTask, &run, num_shards - run.first_shard <
+      SLINPUT_SEARCH_BATCH_SHARDS ? num_shards - run.first_shard :
+      SLINPUT_SEARCH_BATCH_SHARDS);
+    if (result >= 0 && !run.cancelled && cancellable &&
+        run.first_shard + SLINPUT_SEARCH_BATCH_SHARDS < num_shards &&
+        term_info->is_char_available_in(state, term_info->stream_in) > 0)
+      run.cancelled = 1;
+    if (result >= 0 && run.cancelled)
+      result = 1;
+  }
+
+  /* Merge the best of each shard */
+  for (index = 0; result == 0 && index < num_shards; ++index) {
+    size_t match_index;
+    for (match_index = 0; match_index < run.shards[index].num_ranked;
+        ++match_index) {
+      FuzzyOffer(ranked, num_ranked, max_matches,
+        &run.shards[index].ranked[match_index]);
+    }
+  }
+
+  FuzzySort(ranked, *num_ranked);
+  term_info->free_in(term_info->alloc_info, run.shards);
+  term_info->free_in(term_info->alloc_info, shard_ranked);
+  return result;
+}
+
+/* Adds a history position to the matches of the longest query */
+static int SearchAddMatch(SLINPUT_State *state,
+    const HistoryPosition *position) {
+  const TermInfo *term_info = &state->term_info;
+  HistorySearch *search = &state->history_search;
+  size_t *level_end = &search->level_ends[search->query_length];
+  if (*level_end == search->matches_size) {
+    const size_t matches_size =
+      search->matches_size ? search->matches_size*2 : 64;
+    HistoryPosition *matches = term_info->malloc_in(term_info->alloc_info,
+      sizeof(HistoryPosition)*matches_size);
+    if (!matches) {
+      /* Out of memory */
+      return -1;
+    }
+
+    if (search->matches) {
+      MemoryCopy(matches, search->matches,
+        sizeof(HistoryPosition)*search->matches_size);
+      term_info->free_in(term_info->alloc_info, search->matches);
+    }
+    search->matches = matches;
+    search->matches_size = matches_size;
+  }
+
+  search->matches[(*level_end)++] = *position;
+  return 0;
+}
+
+/* Finds the lines matching the query, which has just had a character added.
+They are taken from the lines matching the shorter query, so that history is
+only scanned in full for the first character. */
+static int SearchNarrow(SLINPUT_State *state) {
+  const TermInfo *term_info = &state->term_info;
+  HistorySearch *search = &state->history_search;
+  const sli_ushort level = search->query_length;
+  HistoryPosition position;
+  const sli_char *text;
+  size_t num_chars;
+  size_t index;
+  search->level_ends[level] = search->level_ends[level - 1];
+  if (level == 1) {
+    position.index = term_info->num_history;
+    position.file_end = 0;
+    while (HistoryPrevious(term_info, &position)) {
+      text = SearchText(state, &position, &num_chars);
+      if (!text)
+        return -1;
+      if (SearchFind(search, text, num_chars) < num_chars &&
+          SearchAddMatch(state, &position) < 0)
+        return -1;
+    }
+
+    return 0;
+  }
+
+  for (index = search->level_ends[level - 2];
+      index < search->level_ends[level - 1]; ++index) {
+    position = search->matches[index];
+    text = SearchText(state, &position, &num_chars);
+    if (!text)
+      return -1;
+    if (SearchFind(search, text, num_chars) < num_chars &&
+        SearchAddMatch(state, &position) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+/* Shows the search prompt with the query, and redraws the line */
+static int SearchRedraw(SLINPUT_State *state) {
+  HistorySearch *search = &state->history_search;
+  static const char failing[] = "(failing ";
+  static const char reverse[] = "reverse-i-search)`";
+  static const char fuzzy[] = "fuzzy-search)`";
+  static const char end[] = "': ";
+  const char *start = search->fuzzy ? fuzzy : reverse;
+  sli_char *ptr = search->prompt;
+  size_t index;
+  int result;
+  if (search->failing) {
+    for (index = 0; failing[index]; ++index)
+      *ptr++ = (sli_char) failing[index];
+  } else {
+    *ptr++ = '(';
+  }
+  for (index = 0; start[index]; ++index)
+    *ptr++ = (sli_char) start[index];
+  for (index = 0; index < search->query_length; ++index)
+    *ptr++ = search->query[index];
+  for (index = 0; end[index]; ++index)
+    *ptr++ = (sli_char) end[index];
+  *ptr = '\0';
+
+  state->line_info.prompt_in = search->prompt;
+  result = ApplyDimension(state);
+  if (result < 0)
+    return result;
+
+  ScrollToCursor(&state->line_info);
+  return RedrawLine(state);
+}
+
+/* Replaces the line with the text of a match, placing the cursor at offset,
+and redraws it with the search prompt */
+static int SearchRecall(SLINPUT_State *state, const sli_char *text,
+    size_t num_chars, size_t offset) {
+  LineInfo *line_info = &state->line_info;
+  const int result =
+    LineReplaceChars(state, text, num_chars, EDIT_HISTORY, 0);
+  if (result < 0)
+    return result;
+
+  line_info->cursor_ptr = line_info->buffer +
+    (offset < (size_t) (line_info->end_ptr - line_info->buffer) ?
+    offset : (size_t) (line_info->end_ptr - line_info->buffer));
+  while (!IsClusterStart(line_info, line_info->cursor_ptr))
+    --line_info->cursor_ptr;
+
+  return SearchRedraw(state);
+}
+
+/* Shows the fuzzy match at a rank, wrapping round to the best after the
+last. The history position moves to the line shown. If there are none the
+search is failing. */
+static int FuzzyShow(SLINPUT_State *state, HistoryPosition *history_position,
+    sli_ushort rank) {
+  HistorySearch *search = &state->history_search;
+  const unsigned char *line;
+  const unsigned char *line_end;
+  const sli_char *text;
+  size_t num_chars;
+  size_t start = 0;
+  sli_ushort encoding;
+  search->failing = (sli_ushort) !search->num_ranked;
+  if (search->failing)
+    return SearchRedraw(state);
+
+  search->rank = (sli_ushort) (rank < search->num_ranked ? rank : 0);
+  *history_position = search->ranked[search->rank].position;
+  text = SearchText(state, history_position, &num_chars);
+  if (!text)
+    return -1;
+
+  /* Place the cursor at the start of the characters matched */
+  encoding = HistoryLineText(&state->term_info, history_position, &line,
+    &line_end);
+  FuzzyScore(search->query, search->query_length, encoding, line, line_end,
+    &start);
+  return SearchRecall(state, text, num_chars, start);
+}
+
+/* Shows the newest line matching the query that is older than the line at the
+history position, or at it if at is non-zero. The history position moves to
+the line shown. If there is none the search is failing. */
+static int SearchShow(SLINPUT_State *state, HistoryPosition *history_position,
+    int at) {
+  HistorySearch *search = &state->history_search;
+  const size_t level_end = search->level_ends[search->query_length];
+  const sli_char *text;
+  size_t num_chars;
+  size_t index;
+  for (index = search->level_ends[search->query_length - 1];
+      index < level_end; ++index) {
+    const HistoryPosition *match = &search->matches[index];
+    if (at ? !HistoryIsOlder(history_position, match) :
+        HistoryIsOlder(match, history_position))
+      break;
+  }
+
+  search->failing = (sli_ushort) (index == level_end);
+  if (search->failing)
+    return SearchRedraw(state);
+
+  *history_position = search->matches[index];
+  text = SearchText(state, history_position, &num_chars);
+  if (!text)
+    return -1;
+
+  return SearchRecall(state, text, num_chars,
+    SearchFind(search, text, num_chars));
+}
+
+/* Ranks the fuzzy matches of the query afresh, and shows the best. A search
+cancelled by a key being pressed leaves the line shown until that key is
+processed. */
+static int FuzzyUpdate(SLINPUT_State *state,
+    HistoryPosition *history_position) {
+  HistorySearch *search = &state->history_search;
+  size_t num_ranked;
+  int result = FuzzyRank(state, search->query, search->query_length, 1, 1,
+    search->ranked, SLINPUT_FUZZY_MATCHES, &num_ranked);
+  search->num_ranked = (sli_ushort) num_ranked;
+  if (result)
+    return result < 0 ? result : 0;
+
+  return FuzzyShow(state, history_position, 0);
+}
+
+/* Starts an incremental reverse search of history, or a fuzzy search, with
+an empty query */
+static int SearchStart(SLINPUT_State *state, int fuzzy) {
+  HistorySearch *search = &state->history_search;
+  search->active = 1;
+  search->fuzzy = (sli_ushort) fuzzy;
+  search->failing = 0;
+  search->num_ranked = 0;
+  search->query_length = 0;
+  search->level_ends[0] = 0;
+  search->prompt_in = state->line_info.prompt_in;
+  return SearchRedraw(state);
+}
+
+/* Adds a character to the search query and shows the newest matching line,
+starting from the line shown */
+static int SearchChar(SLINPUT_State *state, HistoryPosition *history_position,
+    sli_char char_in) {
+  HistorySearch *search = &state->history_search;
+  int result;
+  if (search->query_length == SLINPUT_SEARCH_CHARS)
+    return 0;
 
-  /* Return 1 to indicate a redraw needs to take place. */
-  return 1;
-}
+  search->query[search->query_length++] = char_in;
+  if (search->fuzzy)
+    return FuzzyUpdate(state, history_position);
 
-/* Sets memory bytes to a value */
-static void MemorySet(void *memory, unsigned char value, size_t num_values) {
-  unsigned char *ptr = (unsigned char *) memory;
-  const unsigned char *end_ptr = ptr + num_values;
-  while (ptr < end_ptr)
-    *ptr++ = value;
+  result = SearchNarrow(state);
+  if (result < 0) {
+    --search->query_length;
+    return result;
+  }
+
+  return SearchShow(state, history_position, 1);
 }
 
-/* Flushes the input stream */
-static int FlushInput(SLINPUT_State *state) {
-  const TermInfo *term_info = &state->term_info;
+/* Removes the last character of the search query, returning to the lines
+that matched the shorter query */
+static int SearchBackspace(SLINPUT_State *state,
+    HistoryPosition *history_position) {
+  HistorySearch *search = &state->history_search;
+  if (!search->query_length)
+    return 0;
 
-  /* Flush input */
-  int result = 0;
-  while (result >= 0 && (result =
-      term_info->is_char_available_in(state, term_info->stream_in)) > 0) {
-    /* A character is available so get it */
-    result =
-      term_info->get_char_in_in(state, term_info->stream_in, NULL, NULL);
+  if (!--search->query_length) {
+    search->failing = 0;
+    search->num_ranked = 0;
+    return SearchRedraw(state);
   }
 
-  return result;
+  if (search->fuzzy)
+    return FuzzyUpdate(state, history_position);
+
+  return SearchShow(state, history_position, 1);
+}
+
+/* Ends the search, keeping the line shown and restoring the prompt */
+static int SearchEnd(SLINPUT_State *state) {
+  HistorySearch *search = &state->history_search;
+  int result;
+  search->active = 0;
+  state->line_info.prompt_in = search->prompt_in;
+  result = ApplyDimension(state);
+  if (result < 0)
+    return result;
+
+  ScrollToCursor(&state->line_info);
+  return RedrawLine(state);
 }
 
 /* Processes input until enter is pressed or end of transmission */
 static int ProcessInput(SLINPUT_State *state) {
   const TermInfo *term_info = &state->term_info;
-  const sli_sshort max_history_index = term_info->num_history - 1;
-  sli_sshort history_index = -1;
+  const LineInfo *line_info = &state->line_info;
+  HistoryPosition history_position;
+  int browsing = 0;
   int result;
 
+  /* Browsing starts at the empty line following the newest */
+  history_position.index = term_info->num_history;
+  history_position.file_end = 0;
+  state->history_search.active = 0;
+  state->history_suggestion.shown = 0;
+
+  /* Lines are suggested using the prefix index, built from the ring before
+  the first keystroke. Without memory, no lines are suggested. */
+  if (term_info->suggest_history && !term_info->prefix_index)
+    PrefixIndexBuild(&state->term_info);
+
   /* Disable line wrap */
   term_info->cursor_control_out(state, state->term_info.stream_out,
     SLINPUT_CCC_WRAP_OFF);
@@ -640,6 +4531,12 @@ static int ProcessInput(SLINPUT_State *state) {
     if (result < 0)
       break;
 
+    /* Records of the history file are added to the prefix index while
+    waiting for a key. Without memory, the index is discarded. */
+    while (term_info->prefix_file_next &&
+        !term_info->is_char_available_in(state, term_info->stream_in))
+      PrefixIndexLoad(&state->term_info, SLINPUT_PREFIX_LOAD_LINES);
+
     result = term_info->get_char_in_in(state, term_info->stream_in, &key_code,
       &char_in);
     if (result < 0)
@@ -658,6 +4555,45 @@ static int ProcessInput(SLINPUT_State *state) {
     printf("key_code: 0x%x char_in: 0x%x\n", key_code, char_in);
 #endif
 
+    /* Yank pop only follows a yank */
+    if (key_code != SLINPUT_KC_YANK && key_code != SLINPUT_KC_YANK_POP)
+      state->kill_ring.yank_length = 0;
+
+    /* Browsing all of history continues until another key is pressed */
+    if (key_code != SLINPUT_KC_UP && key_code != SLINPUT_KC_DOWN)
+      browsing = 0;
+
+    if (state->history_search.active) {
+      /* While searching, characters edit the query and the key that
+      started the search finds an older line, or the next fuzzy match. Any
+      other key ends the search, keeping the line found, and then has its
+      usual effect, apart from escape. */
+      if (key_code == SLINPUT_KC_SEARCH_BACKWARD &&
+          !state->history_search.fuzzy) {
+        if (state->history_search.query_length)
+          result = SearchShow(state, &history_position, 0);
+        continue;
+      } else if (key_code == SLINPUT_KC_SEARCH_FUZZY &&
+          state->history_search.fuzzy) {
+        if (state->history_search.num_ranked) {
+          result = FuzzyShow(state, &history_position,
+            (sli_ushort) (state->history_search.rank + 1));
+        }
+        continue;
+      } else if (key_code == SLINPUT_KC_BACKSPACE) {
+        result = SearchBackspace(state, &history_position);
+        continue;
+      } else if (key_code == SLINPUT_KC_NUL && char_in != '\0' &&
+          char_in != '\r' && char_in != '\n') {
+        result = SearchChar(state, &history_position, char_in);
+        continue;
+      }
+
+      result = SearchEnd(state);
+      if (result < 0 || key_code == SLINPUT_KC_ESCAPE)
+        continue;
+    }
+
     if (key_code == SLINPUT_KC_END_OF_TRANSMISSION) {
       /* Finish with an empty buffer */
       result = LineEndOfTransmission(state);
@@ -681,29 +4617,31 @@ static int ProcessInput(SLINPUT_State *state) {
     } else if (key_code == SLINPUT_KC_UP ||
         key_code == SLINPUT_KC_DOWN) {
       /* Key: up or down */
-      /* Purpose: History browsing */
-      if (key_code == SLINPUT_KC_UP && history_index < 0) {
-        /* Start history browsing */
-        history_index = max_history_index;
+      /* Purpose: History browsing, by the text before the cursor if any */
+      if (term_info->prefix_browse && !browsing &&
+          line_info->cursor_ptr > line_info->buffer) {
+        result = LinePrefixBrowse(state, &history_position,
+          key_code == SLINPUT_KC_UP);
       } else {
-        if (key_code == SLINPUT_KC_UP && history_index > 0) {
-          /* Move earlier */
-          --history_index;
-        } else if (key_code == SLINPUT_KC_DOWN &&
-            history_index >= 0) {
-          if (history_index < max_history_index) {
-            /* Move later */
-            ++history_index;
-          } else {
-            /* Finish browsing */
-            history_index = -1;
-          }
-        }
+        if (term_info->history_context && (term_info->context_indexed ||
+            ContextIndexBuild(&state->term_info) >= 0))
+          ContextStep(term_info, &history_position,
+            key_code == SLINPUT_KC_UP);
+        else if (key_code == SLINPUT_KC_UP)
+          HistoryPrevious(term_info, &history_position);
+        else
+          HistoryNext(term_info, &history_position);
+
+        /* Update the buffer with the browsing result */
+        result = LineRecall(state, &history_position, 1);
+        browsing = 1;
       }
-
-      /* Update the buffer with the browsing result */
-      result = LineReplace(state, history_index < 0 ? EmptyString :
-        term_info->history[history_index], 1);
+    } else if ((key_code == SLINPUT_KC_RIGHT ||
+        key_code == SLINPUT_KC_END) && state->history_suggestion.shown &&
+        line_info->cursor_ptr == line_info->end_ptr) {
+      /* Key: right or End at the end of the line */
+      /* Purpose: Accept the line suggested from history */
+      result = LineRecall(state, &state->history_suggestion.position, 1);
     } else if (key_code == SLINPUT_KC_LEFT) {
       /* Key: left */
       result = LineKeyLeft(state, 0);
@@ -722,6 +4660,34 @@ static int ProcessInput(SLINPUT_State *state) {
     } else if (key_code == SLINPUT_KC_END) {
       /* Key: End */
       result = LineEnd(state);
+    } else if (key_code == SLINPUT_KC_UNDO) {
+      /* Key: Undo */
+      result = LineUndo(state);
+    } else if (key_code == SLINPUT_KC_REDO) {
+      /* Key: Redo */
+      result = LineRedo(state);
+    } else if (key_code == SLINPUT_KC_KILL_TO_START) {
+      /* Key: Kill to start of line */
+      result = LineKill(state, line_info->buffer, line_info->cursor_ptr);
+    } else if (key_code == SLINPUT_KC_KILL_TO_END) {
+      /* Key: Kill to end of line */
+      result = LineKill(state, line_info->cursor_ptr, line_info->end_ptr);
+    } else if (key_code == SLINPUT_KC_KILL_WORD) {
+      /* Key: Kill word leftwards */
+      result = LineKill(state, WarpLeft(state, line_info->cursor_ptr),
+        line_info->cursor_ptr);
+    } else if (key_code == SLINPUT_KC_YANK) {
+      /* Key: Yank */
+      result = LineYank(state);
+    } else if (key_code == SLINPUT_KC_YANK_POP) {
+      /* Key: Yank pop */
+      result = LineYankPop(state);
+    } else if (key_code == SLINPUT_KC_SEARCH_BACKWARD) {
+      /* Key: Search history backward */
+      result = SearchStart(state, 0);
+    } else if (key_code == SLINPUT_KC_SEARCH_FUZZY) {
+      /* Key: Fuzzy search of history */
+      result = SearchStart(state, 1);
     } else if (char_in != '\0') {
       /* Key: any printable character */
       /* Purpose: input a character and move the cursor to the right */
@@ -751,6 +4717,14 @@ int SLINPUT_Get(SLINPUT_State *state, const sli_char *prompt,
   term_info = &state->term_info;
   line_info = &state->line_info;
 
+  /* Commit lines saved into history that have waited long enough, and read
+  lines other processes have shared. Lines not committed are kept and
+  committed again by the next SLINPUT_Save, SLINPUT_CommitHistory or
+  SLINPUT_Get. */
+  if (HistoryCommitDue(term_info))
+    HistoryCommit(&state->term_info, state);
+  HistorySync(&state->term_info, state);
+
   line_info->prompt_in = prompt;
   line_info->prompt = prompt;
   line_info->max_chars = buffer_chars - 1;
@@ -760,11 +4734,34 @@ int SLINPUT_Get(SLINPUT_State *state, const sli_char *prompt,
   line_info->scroll_ptr = buffer;
   *buffer = '\0';
 
+  /* Make room for the display width of each character in the buffer, after
+  the column sums of each block of widths */
+  if (line_info->max_widths < buffer_chars) {
+    const size_t num_blocks =
+      ((size_t) buffer_chars >> SLINPUT_COLUMN_BLOCK_BITS) + 1;
+    if (line_info->column_sums)
+      term_info->free_in(term_info->alloc_info, line_info->column_sums);
+    line_info->column_sums = term_info->malloc_in(term_info->alloc_info,
+      num_blocks * sizeof(unsigned long) + buffer_chars);
+    if (!line_info->column_sums) {
+      line_info->widths = NULL;
+      line_info->max_widths = 0;
+      return -1;
+    }
+    line_info->widths = (unsigned char *) (line_info->column_sums + num_blocks);
+    line_info->max_widths = buffer_chars;
+  }
+  ColumnSumsRebuild(line_info, 0);
+
   if (initial) {
     /* Copy in the initial string, without a redraw */
-    LineReplace(state, initial, 0);
+    LineReplace(state, initial, EDIT_REPLACE, 0);
   }
 
+  /* Edits of a previous line can't be undone */
+  UndoReset(&state->undo_log);
+  state->kill_ring.yank_length = 0;
+
   /* Enter raw mode */
   result = term_info->enter_raw_in(state, term_info->stream_in,
     &state->term_info.saved_term_attr_in);
@@ -790,72 +4787,579 @@ int SLINPUT_Get(SLINPUT_State *state, const sli_char *prompt,
   return result;
 }
 
-/* Returns non-zero if both strings are identical */
-static int StringIsSame(const sli_char *string1, const sli_char *string2) {
-  while (*string1 && *string2 && *string1 == *string2) {
-    ++string1;
-    ++string2;
-  }
-
-  return *string1 == *string2;
+/* Returns the number of lines in history, as returned to the application,
+which is at most INT_MAX */
+static int HistoryCount(const TermInfo *term_info) {
+  const size_t num_lines = term_info->num_history - term_info->num_erased;
+  return num_lines > INT_MAX ? INT_MAX : (int) num_lines;
 }
 
 /* Saves a single line into history. '\r' and '\n' characters are removed. Up
-to SLINPUT_MAX_HISTORY lines can be stored, with the oldest line being removed
+to the history capacity lines can be stored, with the oldest line being removed
 when the limit is reached. */
 int SLINPUT_Save(SLINPUT_State *state, const sli_char *line) {
-  /* Work out how long the line is with newlines removed */
   TermInfo *term_info = &state->term_info;
-  const size_t line_length = StringLength(line);
-  const sli_char *line_end = line + line_length;
-  size_t reduced_line_length = 0;
-  const sli_char *ptr;
-  sli_char *save_line;
-  sli_char *dest_ptr;
-  for (ptr = line; ptr < line_end; ++ptr) {
-    if (*ptr != '\r' && *ptr != '\n')
-      ++reduced_line_length;
+  int result = HistorySave(term_info, line);
+  if (result > 0 && term_info->history_file.file_data) {
+    result = HistoryFileAppend(term_info, line);
+    if (result >= 0 && HistoryCommitDue(term_info))
+      result = HistoryCommit(term_info, state);
+  }
+
+  return result < 0 ? result : HistoryCount(term_info);
+}
+
+/* Closes the history file, dropping the lines waiting to be committed to it */
+static void HistoryDetach(TermInfo *term_info, const SLINPUT_State *state) {
+  HistoryFile *history_file = &term_info->history_file;
+  if (history_file->file_data)
+    SLINPUT_CloseHistoryFile_Default(state, history_file);
+  if (term_info->history_log)
+    term_info->free_in(term_info->alloc_info, term_info->history_log);
+  term_info->history_log = NULL;
+  term_info->history_log_bytes = 0;
+  term_info->history_log_size = 0;
+  if (term_info->shared_history)
+    SLINPUT_ReleaseSharedHistory(term_info->shared_history);
+  term_info->shared_history = NULL;
+  MemorySet(history_file, 0, sizeof(HistoryFile));
+  HistoryIndexReset(term_info);
+  term_info->history_file_end = 0;
+}
+
+/* Attaches a history file, after detaching any attached */
+int SLINPUT_AttachHistory(SLINPUT_State *state, const char *path) {
+  TermInfo *term_info = &state->term_info;
+  HistoryFile *history_file = &term_info->history_file;
+  size_t index;
+  int result = HistoryCommit(term_info, state);
+  if (result < 0) {
+    /* The file stays attached, with the lines not committed */
+    return result;
   }
 
-  if (reduced_line_length == 0)
-    return term_info->num_history;
+  HistoryDetach(term_info, state);
+  if (!path)
+    return 0;
+
+  result = SLINPUT_OpenHistoryFile_Default(state, path, history_file);
+  if (result < 0)
+    return result;
+
+  /* Another process may be writing the magic bytes or appending to a shared
+  file */
+  if (term_info->share_history) {
+    result = SLINPUT_LockHistoryFile_Default(state, history_file,
+      HISTORY_LOCK_EXCLUSIVE);
+    if (result >= 0)
+      result = SLINPUT_RefreshHistoryFile_Default(state, history_file);
+    if (result > 0)
+      result = SLINPUT_ReopenHistoryFile_Default(state, history_file);
+  }
+
+  if (result < 0) {
+    /* Not locked or refreshed */
+  } else if (!history_file->num_bytes) {
+    /* A new file starts with the magic bytes */
+    result = SLINPUT_AppendHistoryFile_Default(state, history_file,
+      HistoryFileMagic, sizeof(HistoryFileMagic));
+  } else if (history_file->num_bytes < sizeof(HistoryFileMagic)) {
+    /* Not a history file */
+    result = -1;
+  } else {
+    for (index = 0; index < sizeof(HistoryFileMagic); ++index) {
+      if (history_file->contents[index] != HistoryFileMagic[index])
+        result = -1;
+    }
+  }
+
+  if (term_info->share_history)
+    SLINPUT_LockHistoryFile_Default(state, history_file, HISTORY_LOCK_NONE);
+
+  if (result < 0) {
+    SLINPUT_CloseHistoryFile_Default(state, history_file);
+    MemorySet(history_file, 0, sizeof(HistoryFile));
+    return result;
+  }
+
+  /* Records after the last intact one were torn by an interrupted commit */
+  term_info->history_file_end =
+    HistoryFileRecover(term_info, history_file->num_bytes);
+  term_info->history_file_read = history_file->num_bytes ?
+    history_file->num_bytes : sizeof(HistoryFileMagic);
+  return 0;
+}
+
+/* Commits lines waiting to be written to the history file */
+int SLINPUT_CommitHistory(SLINPUT_State *state) {
+  TermInfo *term_info = &state->term_info;
+  return HistoryCommit(term_info, state);
+}
+
+/* Builds the prefix index of the records of shared history, once for all
+the states attached. The records are read as the history file of a copy of
+the state's information with an empty ring. Without memory, shared history
+has no index and each state attached indexes the records itself. */
+static void SharedPrefixIndexBuild(const TermInfo *term_info,
+    SLINPUT_SharedHistory *shared_history) {
+  TermInfo shared_info = *term_info;
+  shared_info.num_history = 0;
+  shared_info.shared_history = NULL;
+  shared_info.history_file.contents =
+    (const unsigned char *) (shared_history + 1);
+  shared_info.history_file.num_bytes = shared_history->num_bytes;
+  shared_info.history_file_end =
+    shared_history->num_bytes > sizeof(HistoryFileMagic) ?
+    shared_history->num_bytes : 0;
+  if (PrefixIndexBuild(&shared_info) >= 0)
+    PrefixIndexLoad(&shared_info, (size_t) -1);
+
+  shared_history->prefix_index = shared_info.prefix_index;
+}
+
+/* Creates shared history holding the records of the attached history file
+that were there when attached, followed by records of the lines in the
+ring */
+SLINPUT_SharedHistory *SLINPUT_CreateSharedHistory(SLINPUT_State *state) {
+  const TermInfo *term_info = &state->term_info;
+  const sli_ushort file_encoding = HISTORY_FILE_ENCODING;
+  const unsigned long file_end = term_info->history_file_end ?
+    term_info->history_file_end : sizeof(HistoryFileMagic);
+  SLINPUT_SharedHistory *shared_history;
+  unsigned long num_bytes = file_end;
+  HistoryPosition position;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  unsigned char *record;
+  sli_ushort encoding;
+  sli_char character;
+  position.file_end = 0;
+  for (position.index = 0; position.index < term_info->num_history;
+      ++position.index) {
+    if (HistoryAt(term_info, position.index)) {
+      encoding = HistoryLineText(term_info, &position, &text, &text_end);
+      num_bytes += HISTORY_RECORD_HEAD + HISTORY_RECORD_TAIL;
+      while (text < text_end) {
+        text = HistoryReadChar(encoding, text, &character);
+        num_bytes += HistoryCharBytes(file_encoding,
+          HistoryFileChar(character));
+      }
+    }
+  }
+
+  shared_history = term_info->malloc_in(term_info->alloc_info,
+    sizeof(SLINPUT_SharedHistory) + (size_t) num_bytes);
+  if (!shared_history) {
+    /* Out of memory */
+    return NULL;
+  }
+
+  shared_history->alloc_info = term_info->alloc_info;
+  shared_history->free_in = term_info->free_in;
+  shared_history->num_refs = 1;
+  shared_history->num_bytes = num_bytes;
+  record = (unsigned char *) (shared_history + 1);
+  if (term_info->history_file_end) {
+    MemoryCopy(record, term_info->history_file.contents,
+      (size_t) file_end);
+  } else {
+    MemoryCopy(record, HistoryFileMagic, sizeof(HistoryFileMagic));
+  }
+
+  record += file_end;
+  for (position.index = 0; position.index < term_info->num_history;
+      ++position.index) {
+    if (HistoryAt(term_info, position.index)) {
+      unsigned char *record_text = record + HISTORY_RECORD_HEAD;
+      unsigned long text_bytes;
+      encoding = HistoryLineText(term_info, &position, &text, &text_end);
+      for (text_bytes = 0; text < text_end; ) {
+        text = HistoryReadChar(encoding, text, &character);
+        text_bytes = (unsigned long) (HistoryWriteChar(file_encoding,
+          record_text + text_bytes, HistoryFileChar(character)) -
+          record_text);
+      }
+
+      PutLong32(text_bytes, record);
+      record = PutLong32(text_bytes, record_text + text_bytes);
+      record = PutLong32(Checksum(record_text, (size_t) text_bytes), record);
+    }
+  }
+
+  SharedPrefixIndexBuild(term_info, shared_history);
+  return shared_history;
+}
+
+/* Attaches shared history, read as the history file */
+int SLINPUT_AttachSharedHistory(SLINPUT_State *state,
+    SLINPUT_SharedHistory *shared_history) {
+  TermInfo *term_info = &state->term_info;
+  const int result = SLINPUT_AttachHistory(state, NULL);
+  if (!shared_history || result < 0)
+    return result;
+
+  /* The records are intact, so need no recovery */
+  ++shared_history->num_refs;
+  term_info->shared_history = shared_history;
+  term_info->history_file.contents =
+    (const unsigned char *) (shared_history + 1);
+  term_info->history_file.num_bytes = shared_history->num_bytes;
+  term_info->history_file_end =
+    shared_history->num_bytes > sizeof(HistoryFileMagic) ?
+    shared_history->num_bytes : 0;
+  term_info->history_file_read = shared_history->num_bytes;
+  return result;
+}
+
+/* Releases a reference to shared history */
+void SLINPUT_ReleaseSharedHistory(SLINPUT_SharedHistory *shared_history) {
+  TermInfo shared_info;
+  if (shared_history && !--shared_history->num_refs) {
+    /* Only the allocation information is needed to free the index */
+    shared_info.alloc_info = shared_history->alloc_info;
+    shared_info.free_in = shared_history->free_in;
+    shared_info.index_bytes = 0;
+    PrefixFree(&shared_info, shared_history->prefix_index);
+    shared_history->free_in(shared_history->alloc_info, shared_history);
+  }
+}
+
+/* Stores the ages and scores of ranked lines in the ring */
+static void HistoryMatchesOut(const TermInfo *term_info,
+    const FuzzyMatch *ranked, size_t num_ranked,
+    SLINPUT_HistoryMatch *matches) {
+  size_t index;
+  for (index = 0; index < num_ranked; ++index) {
+    /* Lines erased from the ring are not counted as newer */
+    const size_t ring_index = ranked[index].position.index;
+    size_t newer;
+    matches[index].age = term_info->num_history - 1 - ring_index;
+    for (newer = ring_index + 1; term_info->num_erased &&
+        newer < term_info->num_history; ++newer) {
+      if (!HistoryAt(term_info, newer))
+        --matches[index].age;
+    }
+
+    matches[index].score = ranked[index].score;
+  }
+}
+
+/* Finds the best fuzzy matches of the query among the lines in the ring */
+int SLINPUT_MatchHistory(SLINPUT_State *state, const sli_char *query,
+    size_t max_matches, SLINPUT_HistoryMatch *matches) {
+  TermInfo *term_info = &state->term_info;
+  FuzzyMatch *ranked = NULL;
+  size_t query_length = 0;
+  size_t num_ranked = 0;
+  int result = 0;
+  while (query[query_length])
+    ++query_length;
+
+  if (max_matches) {
+    ranked = term_info->malloc_in(term_info->alloc_info,
+      sizeof(FuzzyMatch)*max_matches);
+    if (!ranked) {
+      /* Out of memory */
+      return -1;
+    }
+
+    result = FuzzyRank(state, query, query_length, 0, 0, ranked,
+      max_matches, &num_ranked);
+  }
+
+  HistoryMatchesOut(term_info, ranked, num_ranked, matches);
+  if (ranked)
+    term_info->free_in(term_info->alloc_info, ranked);
+  return result < 0 ? result : (int) num_ranked;
+}
+
+/* Finds the lines in the ring with the highest frecency */
+int SLINPUT_FrecentHistory(SLINPUT_State *state, size_t max_matches,
+    SLINPUT_HistoryMatch *matches) {
+  TermInfo *term_info = &state->term_info;
+  FuzzyMatch *ranked;
+  FuzzyMatch match;
+  size_t num_ranked = 0;
+  if (!max_matches)
+    return 0;
 
-  /* Allocate and copy the line with newlines removed */
-  save_line = term_info->malloc_in(term_info->alloc_info,
-    sizeof(sli_char)*(reduced_line_length + 1));
-  if (!save_line) {
+  ranked = term_info->malloc_in(term_info->alloc_info,
+    sizeof(FuzzyMatch)*max_matches);
+  if (!ranked) {
     /* Out of memory */
     return -1;
   }
 
-  dest_ptr = save_line;
-  for (ptr = line; ptr < line_end; ++ptr) {
-    if (*ptr != '\r' && *ptr != '\n')
-      *dest_ptr++ = *ptr;
+  /* Older copies of lines have no frecency of their own */
+  match.position.file_end = 0;
+  for (match.position.index = 0;
+      match.position.index < term_info->num_history; ++match.position.index) {
+    const HistoryEntry *entry = HistoryAt(term_info, match.position.index);
+    if (entry && entry->frecency) {
+      match.score = (long) FrecencyNow(term_info, entry);
+      match.ordinal = HistoryOrdinal(term_info, &match.position);
+      if (match.score)
+        FuzzyOffer(ranked, &num_ranked, max_matches, &match);
+    }
   }
-  save_line[reduced_line_length] = '\0';
 
-  /* Don't save the line if it is identical to the previous one */
-  if (term_info->num_history && StringIsSame(save_line,
-      term_info->history[term_info->num_history - 1])) {
-    term_info->free_in(term_info->alloc_info, save_line);
-    return term_info->num_history;
+  FuzzySort(ranked, num_ranked);
+  HistoryMatchesOut(term_info, ranked, num_ranked, matches);
+  term_info->free_in(term_info->alloc_info, ranked);
+  return (int) num_ranked;
+}
+
+/* Copies the line in the ring with the given number of newer lines */
+int SLINPUT_GetHistory(SLINPUT_State *state, size_t age,
+    sli_ushort buffer_chars, sli_char *buffer) {
+  const TermInfo *term_info = &state->term_info;
+  HistoryPosition position;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  sli_ushort encoding;
+  sli_ushort num_chars = 0;
+  if (!buffer_chars)
+    return -1;
+
+  position.index = term_info->num_history;
+  position.file_end = 0;
+  do {
+    if (!HistoryPrevious(term_info, &position) || position.file_end)
+      return -1;
+  } while (age--);
+
+  encoding = HistoryLineText(term_info, &position, &text, &text_end);
+  while (text < text_end && num_chars < buffer_chars - 1)
+    text = HistoryReadChar(encoding, text, &buffer[num_chars++]);
+
+  buffer[num_chars] = '\0';
+  return num_chars;
+}
+
+/* Views the next line in history, oldest first */
+int SLINPUT_ViewHistory(SLINPUT_State *state, size_t *iterator,
+    SLINPUT_HistoryView *view) {
+  const TermInfo *term_info = &state->term_info;
+  HistoryPosition position;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  while (*iterator < term_info->num_history &&
+      !HistoryAt(term_info, *iterator))
+    ++*iterator;
+
+  if (*iterator >= term_info->num_history)
+    return 0;
+
+  position.index = (*iterator)++;
+  position.file_end = 0;
+  view->encoding = (SLINPUT_HistoryEncoding)
+    HistoryLineText(term_info, &position, &text, &text_end);
+  view->text = text;
+  view->num_bytes = (size_t) (text_end - text);
+  return 1;
+}
+
+/* Returns the nil terminating a line stored using the history encoding,
+counting its characters, or NULL if the nil is not reached before end or a
+character is not correctly encoded */
+static const unsigned char *HistoryLineEnd(sli_ushort encoding,
+    const unsigned char *text, const unsigned char *end, size_t *num_chars) {
+  *num_chars = 0;
+  if (encoding != SLINPUT_HE_UTF8) {
+    for (; (size_t) (end - text) >= sizeof(sli_char);
+        text += sizeof(sli_char)) {
+      if (!*(const sli_char *) text)
+        return text;
+
+      ++*num_chars;
+    }
+
+    return NULL;
+  }
+
+  while (text < end && *text) {
+    const unsigned int num_trail =
+      *text >= 0xF0 ? 3 : *text >= 0xE0 ? 2 : *text >= 0xC0 ? 1 : 0;
+    unsigned int index;
+    if ((*text >= 0x80 && *text < 0xC0) || *text >= 0xF8 ||
+        (size_t) (end - text) <= num_trail)
+      return NULL;
+
+    for (index = 1; index <= num_trail; ++index) {
+      if ((text[index] & 0xC0) != 0x80)
+        return NULL;
+    }
+
+    text += 1 + num_trail;
+    ++*num_chars;
   }
 
-  /* If history is full, then delete the oldest */
-  if (term_info->num_history == SLINPUT_MAX_HISTORY) {
-    sli_ushort index;
-    term_info->free_in(term_info->alloc_info, term_info->history[0]);
-    for (index = 1; index < SLINPUT_MAX_HISTORY; ++index)
-      term_info->history[index - 1] = term_info->history[index];
+  return text < end ? text : NULL;
+}
+
+/* Saves the lines in a buffer into history */
+int SLINPUT_ImportHistory(SLINPUT_State *state, const void *lines,
+    size_t num_bytes, SLINPUT_HistoryEncoding encoding) {
+  TermInfo *term_info = &state->term_info;
+  const unsigned char *end = (const unsigned char *) lines + num_bytes;
+  const unsigned char *text;
+  const unsigned char *text_end;
+  const sli_ushort line_encoding = SLI_CHAR_SIZE > 1 ?
+    (sli_ushort) encoding : (sli_ushort) SLINPUT_HE_NATIVE;
+  const size_t nil_bytes = HistoryCharBytes(line_encoding, '\0');
+  sli_char *line = NULL;
+  size_t max_chars = 0;
+  size_t num_chars;
+  int result = 0;
 
-    term_info->num_history--;
-  } 
+  /* Check every line before saving any, finding the longest */
+  for (text = lines; result >= 0 && text < end; text = text_end + nil_bytes) {
+    text_end = HistoryLineEnd(line_encoding, text, end, &num_chars);
+    if (!text_end)
+      result = -1;
+    else if (num_chars > max_chars)
+      max_chars = num_chars;
+  }
 
-  /* Store the new history */
-  term_info->history[term_info->num_history++] = save_line;
+  if (result >= 0) {
+    line = term_info->malloc_in(term_info->alloc_info,
+      sizeof(sli_char)*(max_chars + 1));
+    if (!line) {
+      /* Out of memory */
+      result = -1;
+    }
+  }
+
+  for (text = lines; result >= 0 && text < end; text = text_end + nil_bytes) {
+    text_end = HistoryLineEnd(line_encoding, text, end, &num_chars);
+    for (num_chars = 0; text < text_end; )
+      text = HistoryReadChar(line_encoding, text, &line[num_chars++]);
+
+    line[num_chars] = '\0';
+    result = HistorySave(term_info, line);
+  }
+
+  if (line)
+    term_info->free_in(term_info->alloc_info, line);
+
+  return result < 0 ? result : HistoryCount(term_info);
+}
+
+/* Returns the bytes of memory allocated for history */
+size_t SLINPUT_GetHistoryBytes(const SLINPUT_State *state) {
+  return HistoryBytes(&state->term_info) + state->term_info.index_bytes;
+}
+
+/* Rewrites the history file with the newest occurrence of up to max_lines
+distinct lines, in a new file renamed over it */
+int SLINPUT_CompactHistory(SLINPUT_State *state, size_t max_lines) {
+  TermInfo *term_info = &state->term_info;
+  HistoryFile *history_file = &term_info->history_file;
+  size_t table_size = 0;
+  unsigned long *table = NULL;
+  unsigned long *ends = NULL;
+  unsigned char *contents = NULL;
+  unsigned char *ptr;
+  size_t num_lines = 0;
+  unsigned long num_bytes = sizeof(HistoryFileMagic);
+  unsigned long file_end = 0;
+  unsigned long end;
+  int result;
+  if (!history_file->file_data)
+    return -1;
+
+  result = HistoryCommit(term_info, state);
+  if (result < 0)
+    return result;
+
+  /* Appends by other processes wait until the new file is in place */
+  result = SLINPUT_LockHistoryFile_Default(state, history_file,
+    HISTORY_LOCK_EXCLUSIVE);
+  if (result < 0)
+    return result;
+
+  result = HistoryImport(term_info, state);
+
+  /* Hash table of the record ends kept, by checksum */
+  if (result >= 0) {
+    const size_t num_records =
+      HistoryFileCount(term_info, 0, history_file->num_bytes);
+    if (max_lines > num_records)
+      max_lines = num_records;
+    table = HistoryRecordTable(term_info, max_lines, &table_size);
+    ends = term_info->malloc_in(term_info->alloc_info,
+      sizeof(unsigned long)*(max_lines + 1));
+    if (!table || !ends)
+      result = -1;
+  }
+
+  /* Walk back from the newest record, keeping the first of each line */
+  if (result >= 0) {
+    end = HistoryFileRecover(term_info, history_file->num_bytes);
+    while (end && num_lines < max_lines) {
+      const unsigned long start = HistoryFileRecordStart(term_info, end);
+      const size_t slot = HistoryRecordSlot(table, table_size,
+        history_file->contents, history_file->contents + end);
+      if (!table[slot]) {
+        table[slot] = end;
+        ends[num_lines++] = end;
+        num_bytes += end - start;
+      }
+
+      end = HistoryFileRecover(term_info, start);
+    }
+
+    contents = term_info->malloc_in(term_info->alloc_info,
+      (size_t) num_bytes);
+    if (!contents)
+      result = -1;
+  }
 
-  return term_info->num_history;
+  /* Write the records kept from the oldest. Those read into the ring since
+  the file was attached are not browsed from the file as well. */
+  if (result >= 0) {
+    MemoryCopy(contents, HistoryFileMagic, sizeof(HistoryFileMagic));
+    ptr = contents + sizeof(HistoryFileMagic);
+    while (num_lines) {
+      const unsigned long start =
+        HistoryFileRecordStart(term_info, ends[--num_lines]);
+      MemoryCopy(ptr, history_file->contents + start,
+        (size_t) (ends[num_lines] - start));
+      ptr += ends[num_lines] - start;
+      if (ends[num_lines] <= term_info->history_file_end)
+        file_end = (unsigned long) (ptr - contents);
+    }
+
+    result = SLINPUT_ReplaceHistoryFile_Default(state, history_file,
+      contents, (size_t) num_bytes);
+  }
+
+  if (result >= 0) {
+    HistoryIndexReset(term_info);
+    term_info->history_file_end = file_end;
+    term_info->history_file_read = history_file->num_bytes;
+  }
+
+  SLINPUT_LockHistoryFile_Default(state, history_file, HISTORY_LOCK_NONE);
+  if (contents)
+    term_info->free_in(term_info->alloc_info, contents);
+  if (ends)
+    term_info->free_in(term_info->alloc_info, ends);
+  if (table)
+    term_info->free_in(term_info->alloc_info, table);
+  return result;
+}
+
+/* Sets whether lines other processes append to the history file are read */
+void SLINPUT_Set_HistoryShared(SLINPUT_State *state, int share_history) {
+  state->term_info.share_history = (sli_ushort) !!share_history;
+}
+
+/* Sets when lines saved into history are committed to the history file */
+void SLINPUT_Set_HistoryCommit(SLINPUT_State *state, size_t num_bytes,
+    unsigned long seconds) {
+  state->term_info.history_commit_bytes = num_bytes;
+  state->term_info.history_commit_seconds = seconds;
 }
 
 /* Set function pointer */
@@ -914,6 +5418,14 @@ void SLINPUT_Set_CompletionRequest(SLINPUT_State *state,
   state->term_info.completion_request = completion_request_cb;
 }
 
+/* Sets the task runner, or the default if run_tasks_cb is NULL */
+void SLINPUT_Set_RunTasks(SLINPUT_State *state, SLINPUT_TaskInfo task_info,
+    SLINPUT_RunTasks *run_tasks_cb) {
+  state->term_info.task_info = task_info;
+  state->term_info.run_tasks = run_tasks_cb ? run_tasks_cb :
+    RunTasksSerial;
+}
+
 /* Set function pointer */
 void SLINPUT_Set_GetTerminalWidth(SLINPUT_State *state,
     SLINPUT_GetTerminalWidth *get_terminal_width_cb) {
@@ -953,11 +5465,144 @@ void SLINPUT_Set_Streams(SLINPUT_State *state,
   state->term_info.stream_out = stream_out;
 }
 
+/* Set history encoding */
+void SLINPUT_Set_HistoryEncoding(SLINPUT_State *state,
+    SLINPUT_HistoryEncoding history_encoding) {
+  /* Single byte characters are already as compact as UTF-8 */
+  state->term_info.history_encoding = SLI_CHAR_SIZE > 1 ?
+    (sli_ushort) history_encoding : (sli_ushort) SLINPUT_HE_NATIVE;
+}
+
+/* Set history capacity, moving the newest entries into a new ring */
+int SLINPUT_Set_HistoryCapacity(SLINPUT_State *state, size_t capacity) {
+  TermInfo *term_info = &state->term_info;
+  HistoryEntry **history = NULL;
+  unsigned long *contexts = NULL;
+  size_t index;
+
+  /* The hash table has up to four slots a line, each as large as a slot of
+  the ring or its contexts */
+  if (capacity > ((size_t) -1)/4/sizeof(size_t))
+    return -1;
+
+  if (term_info->history && capacity) {
+    history = term_info->malloc_in(term_info->alloc_info,
+      sizeof(HistoryEntry *)*capacity);
+    if (!history) {
+      /* Out of memory */
+      return -1;
+    }
+  }
+
+  if (term_info->history_contexts && capacity) {
+    contexts = term_info->malloc_in(term_info->alloc_info,
+      sizeof(unsigned long)*capacity);
+    if (!contexts) {
+      /* Out of memory */
+      if (history)
+        term_info->free_in(term_info->alloc_info, history);
+      return -1;
+    }
+  }
+
+  /* Erased slots are not moved, and the hash table is rebuilt after */
+  if (term_info->history_table) {
+    term_info->free_in(term_info->alloc_info, term_info->history_table);
+    term_info->history_table = NULL;
+  }
+
+  HistorySqueeze(term_info);
+  while (term_info->num_history > capacity)
+    HistoryDropOldest(term_info);
+
+  for (index = 0; history && index < term_info->num_history; ++index)
+    history[index] = HistoryAt(term_info, index);
+
+  for (index = 0; contexts && index < term_info->num_history; ++index)
+    contexts[index] = HistoryContextAt(term_info, index);
+
+  if (term_info->history)
+    term_info->free_in(term_info->alloc_info, term_info->history);
+
+  if (term_info->history_contexts) {
+    term_info->free_in(term_info->alloc_info,
+      term_info->history_contexts);
+  }
+
+  term_info->history = history;
+  term_info->history_contexts = contexts;
+  term_info->history_capacity = capacity;
+  term_info->first_history = 0;
+  if (term_info->num_history)
+    HistoryCompact(term_info);
+  else
+    HistoryFreeChunks(term_info);
+
+  HistoryTableRebuild(term_info);
+  HistoryFitBudget(term_info);
+  return 0;
+}
+
+/* Set the memory budget for history, removing the oldest lines over it */
+void SLINPUT_Set_HistoryBudget(SLINPUT_State *state, size_t num_bytes) {
+  TermInfo *term_info = &state->term_info;
+  term_info->history_budget = num_bytes;
+  HistoryFitBudget(term_info);
+  if (term_info->num_history)
+    HistoryCompact(term_info);
+  else
+    HistoryFreeChunks(term_info);
+}
+
+/* Set erasing of older duplicates in history */
+void SLINPUT_Set_HistoryEraseDuplicates(SLINPUT_State *state,
+    int erase_duplicates) {
+  state->term_info.erase_duplicates = (sli_ushort) (erase_duplicates != 0);
+
+  /* Without memory, the table is built by the next save */
+  HistoryTableRebuild(&state->term_info);
+}
+
+/* Set packing older history lines into front coded blocks */
+void SLINPUT_Set_HistoryFrontCoding(SLINPUT_State *state, int front_coding) {
+  /* Lines already packed stay in their blocks */
+  state->term_info.front_coding = (sli_ushort) (front_coding != 0);
+}
+
+/* Set browsing history by the text before the cursor */
+void SLINPUT_Set_HistoryPrefixBrowse(SLINPUT_State *state, int prefix_browse) {
+  state->term_info.prefix_browse = (sli_ushort) (prefix_browse != 0);
+
+  /* The prefix index is built when first needed */
+  if (!prefix_browse && !state->term_info.suggest_history)
+    PrefixIndexReset(&state->term_info);
+}
+
+/* Set suggesting lines from history */
+void SLINPUT_Set_HistorySuggest(SLINPUT_State *state, int suggest_history) {
+  state->term_info.suggest_history = (sli_ushort) (suggest_history != 0);
+
+  /* The prefix index is built when first needed */
+  if (!suggest_history && !state->term_info.prefix_browse)
+    PrefixIndexReset(&state->term_info);
+}
+
+/* Set the context of lines saved, and browsed first */
+void SLINPUT_Set_HistoryContext(SLINPUT_State *state, unsigned long context) {
+  TermInfo *term_info = &state->term_info;
+  term_info->history_context = context;
+
+  /* The context index is built when first needed */
+  term_info->context_lines = term_info->context_indexed ?
+    ContextFind(term_info, context, 0) : NULL;
+}
+
 /* Creates the state */
 SLINPUT_State *SLINPUT_CreateState(
     SLINPUT_AllocInfo alloc_info,
     SLINPUT_Malloc malloc_cb, SLINPUT_Free free_cb) {
   SLINPUT_CompletionInfo completion_info = { NULL };
+  SLINPUT_TaskInfo task_info = { NULL };
   SLINPUT_State *state;
   TermInfo *term_info;
 
@@ -1000,11 +5645,17 @@ SLINPUT_State *SLINPUT_CreateState(
   SLINPUT_Set_GetTerminalWidth(state, SLINPUT_GetTerminalWidth_Default);
   SLINPUT_Set_CompletionRequest(state, completion_info,
     (SLINPUT_CompletionRequest *) NULL);
+  SLINPUT_Set_RunTasks(state, task_info, (SLINPUT_RunTasks *) NULL);
 
   SLINPUT_Set_NumColumns(state, 0);
   SLINPUT_Set_CursorMargin(state, 5);
   SLINPUT_Set_ContinueCharLeft(state, '<');
   SLINPUT_Set_ContinueCharRight(state, '>');
+  SLINPUT_Set_HistoryEncoding(state, SLINPUT_HISTORY_ENCODING);
+  SLINPUT_Set_HistoryCapacity(state, SLINPUT_MAX_HISTORY);
+  SLINPUT_Set_HistoryBudget(state, SLINPUT_HISTORY_BUDGET);
+  SLINPUT_Set_HistoryCommit(state, SLINPUT_HISTORY_COMMIT_BYTES,
+    SLINPUT_HISTORY_COMMIT_SECONDS);
 
   return state;
 }
@@ -1022,13 +5673,33 @@ void SLINPUT_DestroyState(SLINPUT_State *state) {
   SLINPUT_DestroyStreams_Default(state, &term_info->stream_in_default,
     &term_info->stream_out_default);
 
-  for (index = 0; index < term_info->num_history; ++index)
-    term_info->free_in(term_info->alloc_info, term_info->history[index]);
+  SLINPUT_Set_HistoryCapacity(state, 0);
+  HistoryCommit(term_info, state);
+  HistoryDetach(term_info, state);
+  if (term_info->history_decode)
+    term_info->free_in(term_info->alloc_info, term_info->history_decode);
+
+  if (state->line_info.column_sums)
+    term_info->free_in(term_info->alloc_info, state->line_info.column_sums);
+
+  for (index = 0; index < SLINPUT_KILL_RING_SIZE; ++index) {
+    if (state->kill_ring.entries[index]) {
+      term_info->free_in(term_info->alloc_info,
+        state->kill_ring.entries[index]);
+    }
+  }
+
+  if (state->history_search.matches) {
+    term_info->free_in(term_info->alloc_info,
+      state->history_search.matches);
+  }
+  if (state->history_search.text)
+    term_info->free_in(term_info->alloc_info, state->history_search.text);
 
   term_info->free_in(term_info->alloc_info, state);
 }
 
 /* Replaces the line during completion */
 int SLINPUT_CompletionReplace(SLINPUT_State *state, const sli_char *string) {
-  return LineReplace(state, string, 1);
+  return LineReplace(state, string, EDIT_REPLACE, 1);
 }
@@ -6,11 +6,17 @@
 #define SLINPUT_INTERNAL_HEADER
 #include "include/slinput.h"
 
-/** The maximum number of lines stored as history */
+/** The number of lines stored as history, unless a capacity is set */
 #ifndef SLINPUT_MAX_HISTORY
 #define SLINPUT_MAX_HISTORY 32
 #endif
 
+/** The bytes of memory that may hold the lines in history, unless a budget
+is set, or 0 for no limit */
+#ifndef SLINPUT_HISTORY_BUDGET
+#define SLINPUT_HISTORY_BUDGET 0
+#endif
+
 /** The minimum number of columns in a line */
 #ifndef SLINPUT_MIN_COLUMNS
 #define SLINPUT_MIN_COLUMNS 4
@@ -21,6 +27,108 @@
 #define SLINPUT_MAX_COLUMNS 640
 #endif
 
+/** Characters per block of the column sums, as a power of two */
+#ifndef SLINPUT_COLUMN_BLOCK_BITS
+#define SLINPUT_COLUMN_BLOCK_BITS 5
+#endif
+
+/** The number of killed texts kept for yanking */
+#ifndef SLINPUT_KILL_RING_SIZE
+#define SLINPUT_KILL_RING_SIZE 4
+#endif
+
+/** The maximum number of edit records kept for undo and redo */
+#ifndef SLINPUT_UNDO_RECORDS
+#define SLINPUT_UNDO_RECORDS 64
+#endif
+
+/** The number of characters of edited text kept for undo and redo */
+#ifndef SLINPUT_UNDO_CHARS
+#define SLINPUT_UNDO_CHARS 1024
+#endif
+
+/** The maximum number of characters in a history search query */
+#ifndef SLINPUT_SEARCH_CHARS
+#define SLINPUT_SEARCH_CHARS 32
+#endif
+
+/** The number of best matches kept by fuzzy history search */
+#ifndef SLINPUT_FUZZY_MATCHES
+#define SLINPUT_FUZZY_MATCHES 16
+#endif
+
+/** The most lines of the ring scored as one task by fuzzy history search */
+#ifndef SLINPUT_SEARCH_SHARD_LINES
+#define SLINPUT_SEARCH_SHARD_LINES 1024
+#endif
+
+/** The most bytes of the history file scored as one task by fuzzy history
+search */
+#ifndef SLINPUT_SEARCH_SHARD_BYTES
+#define SLINPUT_SEARCH_SHARD_BYTES 65536L
+#endif
+
+/** The number of lines a fuzzy history search task scores between checks
+for a key pressed, which cancels the search, when the tasks run on the
+calling thread */
+#ifndef SLINPUT_SEARCH_POLL_LINES
+#define SLINPUT_SEARCH_POLL_LINES 256
+#endif
+
+/** The most fuzzy history search tasks given to a task runner at once. A key
+pressed is checked for on the calling thread between batches. */
+#ifndef SLINPUT_SEARCH_BATCH_SHARDS
+#define SLINPUT_SEARCH_BATCH_SHARDS 16
+#endif
+
+/** The number of leading characters of history lines in the prefix index */
+#ifndef SLINPUT_PREFIX_CHARS
+#define SLINPUT_PREFIX_CHARS 16
+#endif
+
+/** The number of history file records added to the prefix index at a time
+while it loads, newest first, between checks for a key pressed */
+#ifndef SLINPUT_PREFIX_LOAD_LINES
+#define SLINPUT_PREFIX_LOAD_LINES 256
+#endif
+
+/** The most lines in the prefix index examined to suggest a line from
+history after each keystroke */
+#ifndef SLINPUT_SUGGEST_PROBES
+#define SLINPUT_SUGGEST_PROBES 16
+#endif
+
+/** The number of uses of history over which the frecency of a line, its
+count of uses decaying with age, halves */
+#ifndef SLINPUT_FRECENCY_HALF_LIFE
+#define SLINPUT_FRECENCY_HALF_LIFE 64
+#endif
+
+/** The number of lines packed together in a front coded history block */
+#ifndef SLINPUT_HISTORY_BLOCK_LINES
+#define SLINPUT_HISTORY_BLOCK_LINES 16
+#endif
+
+/** The minimum number of bytes allocated at a time to hold history */
+#ifndef SLINPUT_HISTORY_CHUNK_BYTES
+#define SLINPUT_HISTORY_CHUNK_BYTES 4096
+#endif
+
+/** Bytes of records gathered before they are committed to a history file */
+#ifndef SLINPUT_HISTORY_COMMIT_BYTES
+#define SLINPUT_HISTORY_COMMIT_BYTES 4096
+#endif
+
+/** Seconds records are held before they are committed to a history file */
+#ifndef SLINPUT_HISTORY_COMMIT_SECONDS
+#define SLINPUT_HISTORY_COMMIT_SECONDS 5
+#endif
+
+/** The SLINPUT_HistoryEncoding used for saved lines until one is set */
+#ifndef SLINPUT_HISTORY_ENCODING
+#define SLINPUT_HISTORY_ENCODING SLINPUT_HE_NATIVE
+#endif
+
 /* Default input functions. */
 
 /** Default function for entering raw mode */
@@ -62,6 +170,171 @@ void SLINPUT_DestroyStreams_Default(
   SLINPUT_Stream *stream_in,
   SLINPUT_Stream *stream_out);
 
+/** A history file opened by the adapter */
+typedef struct HistoryFile {
+  void *file_data;  /**< Adapter information for the open file, or NULL */
+  const unsigned char *contents;  /**< The file contents when opened */
+  unsigned long num_bytes;  /**< The number of bytes of contents */
+} HistoryFile;
+
+/** History shared between states, stored as the records of a history file,
+which follow this header. It is freed when the last reference is released. */
+struct SLINPUT_SharedHistory {
+  SLINPUT_AllocInfo alloc_info;  /**< Allocation information of the state
+                                      that created it */
+  SLINPUT_Free *free_in;  /**< Frees the shared history */
+  size_t num_refs;  /**< Number of references held */
+  unsigned long num_bytes;  /**< Bytes of the records, with the magic bytes */
+  struct PrefixNode *prefix_index;  /**< Prefix index of the records, shared
+                                         by the states attached, or NULL if
+                                         out of memory */
+};
+
+/** Opens a history file for appending, creating it if it does not exist, and
+maps its contents for reading. Return a negative value on error. */
+int SLINPUT_OpenHistoryFile_Default(
+  const SLINPUT_State *state,
+  const char *path,
+  HistoryFile *history_file);
+
+/** Appends bytes to a history file and commits them to storage. Return a
+negative value on error. */
+int SLINPUT_AppendHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file,
+  const void *data,
+  size_t num_bytes);
+
+/** Locks for sharing a history file with other processes */
+typedef enum HistoryLock {
+  HISTORY_LOCK_NONE,  /**< Unlocked */
+  HISTORY_LOCK_SHARED,  /**< Locked for reading */
+  HISTORY_LOCK_EXCLUSIVE  /**< Locked for appending */
+} HistoryLock;
+
+/** Locks or unlocks a history file, waiting for a lock held by another
+process. Return a negative value on error. */
+int SLINPUT_LockHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file,
+  HistoryLock lock);
+
+/** Updates the contents of a history file to include bytes appended since it
+was opened or refreshed. If the file was replaced by another process, then
+return 1, still reading the file replaced. Return a negative value on
+error. */
+int SLINPUT_RefreshHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file);
+
+/** Opens the file that replaced a history file, holding the same lock, and
+closes the file replaced. Return a negative value on error. */
+int SLINPUT_ReopenHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file);
+
+/** Replaces the contents of a history file with bytes written to a new file
+renamed over it, holding the same lock. Return a negative value on error. */
+int SLINPUT_ReplaceHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file,
+  const void *data,
+  size_t num_bytes);
+
+/** Unmaps the contents of a history file and closes it */
+void SLINPUT_CloseHistoryFile_Default(
+  const SLINPUT_State *state,
+  HistoryFile *history_file);
+
+/** Returns a count of seconds, used to time history file commits */
+unsigned long SLINPUT_Seconds_Default(void);
+
+/** A list of lines in history by ordinal, oldest first. The ordinal of a
+history file record is its end offset, and that of a line in the ring follows
+those of the file records in sequence order. */
+typedef struct OrdinalList {
+  unsigned long *ordinals;  /**< Ordinals of the lines listed */
+  unsigned long *ordinals_base;  /**< Allocation holding the ordinals, with
+                                      room before and after them */
+  size_t num_ordinals;  /**< Number of ordinals listed */
+  size_t ordinals_size;  /**< Number of ordinals the allocation holds */
+} OrdinalList;
+
+/** A node of the prefix index, a trie of the leading characters of lines in
+history. Each node lists the lines that start with the characters on the path
+to it. */
+typedef struct PrefixNode {
+  struct PrefixNode *child;  /**< First node for a following character */
+  struct PrefixNode *sibling;  /**< Next node for another character */
+  OrdinalList lines;  /**< The lines with this prefix */
+  sli_char character;  /**< The character leading to this node */
+} PrefixNode;
+
+/** The lines in history saved in one context, in the context index */
+typedef struct HistoryContext {
+  struct HistoryContext *next;  /**< Next context in the same slot of the
+                                     context table */
+  unsigned long context;  /**< The context key */
+  OrdinalList lines;  /**< The lines saved in the context */
+} HistoryContext;
+
+/** A line saved in history. The text follows the header in the same
+history chunk, nil terminated, in the encoding given, unless the line has
+been packed into a front coded block. */
+typedef struct HistoryEntry {
+  unsigned long hash;  /**< Hash of the characters, for finding duplicates */
+  size_t num_bytes;  /**< Bytes of text, including the nil */
+  unsigned long last_use;  /**< History clock when the line was last used */
+  sli_ushort frecency;  /**< Uses of the line decayed to last_use, in
+                             FRECENCY_USE parts, or 0 for an older copy */
+  sli_ushort encoding;  /**< SLINPUT_HistoryEncoding of the text */
+  sli_ushort char_mask;  /**< A bit for each class of character in the text,
+                              ruling it out of fuzzy matches */
+  sli_ushort line;  /**< Index plus one of the line in its front coded
+                         block, or 0 if the text follows the header */
+} HistoryEntry;
+
+/** Consecutive lines in history packed together once they are no longer
+among the newest. The block header is followed by the entries of its lines,
+then by the coded text of each line in turn: the count of leading bytes it
+shares with the line before as a base 128 number, low digits first, then the
+bytes that follow those. Erased lines are kept until the whole block is. */
+typedef struct HistoryBlock {
+  size_t num_bytes;  /**< Bytes allocated for the block */
+  size_t max_bytes;  /**< Bytes of text of the longest line, without nil */
+  sli_ushort num_lines;  /**< Number of lines packed */
+  sli_ushort num_live;  /**< Number of lines still in the ring */
+} HistoryBlock;
+
+/** A line of a front coded history block, decoded when its text is read.
+The decoder continues from the line it holds when a later line in the same
+block is read. */
+typedef struct HistoryDecode {
+  const HistoryBlock *block;  /**< Block of the line held, or NULL */
+  size_t offset;  /**< Offset in the coded text following the line held */
+  unsigned char *bytes;  /**< Text of the line held, without nil */
+  size_t size;  /**< Number of bytes bytes can hold */
+  sli_ushort line;  /**< Number of lines of the block decoded, the last
+                         being the line held */
+} HistoryDecode;
+
+/** A block of memory from which history entries are allocated in turn */
+typedef struct HistoryChunk {
+  struct HistoryChunk *next;  /**< The chunk allocated before this one */
+  struct HistoryChunk *previous;  /**< The chunk allocated after this one */
+  size_t num_bytes;  /**< Bytes for entries following the header */
+  size_t used_bytes;  /**< Bytes allocated to entries so far */
+  size_t live_bytes;  /**< Bytes used by entries still in history */
+} HistoryChunk;
+
+/** A line in history while browsing, from the oldest in the history file to
+the empty line following the newest in the ring */
+typedef struct HistoryPosition {
+  size_t index;  /**< Ring index, num_history for the empty line */
+  unsigned long file_end;  /**< When non-zero, the end offset of the history
+                                file record preceding the ring */
+} HistoryPosition;
+
 /** Terminal information, callbacks and state */
 typedef struct TermInfo {
   SLINPUT_Stream stream_in_default;  /**< The default input stream */
@@ -83,8 +356,78 @@ typedef struct TermInfo {
   SLINPUT_Free *free_in;  /**< Callback pointer */
   SLINPUT_CompletionInfo completion_info;  /**< Completion callback info */
   SLINPUT_CompletionRequest *completion_request;  /**< Callback pointer */
-  sli_char *history[SLINPUT_MAX_HISTORY];  /**< Holds pointers to saved lines */
-  sli_sshort num_history;  /**< The number of entries in the history array */
+  SLINPUT_TaskInfo task_info;  /**< Task runner callback info */
+  SLINPUT_RunTasks *run_tasks;  /**< Callback pointer */
+  HistoryEntry **history;  /**< Ring of saved lines, allocated on first save */
+  size_t history_capacity;  /**< The number of entries the ring can hold */
+  size_t first_history;  /**< Ring index of the oldest entry */
+  size_t num_history;  /**< The number of entries in the ring */
+  size_t num_erased;  /**< Entries in the ring erased as duplicates, NULL */
+  size_t first_sequence;  /**< Sequence number of the oldest entry */
+  unsigned long history_clock;  /**< Count of lines used, timing frecency */
+  size_t *history_table;  /**< Hash table of the sequence numbers plus one of
+                               the newest copy of each line, zero when
+                               empty, used to find duplicates */
+  size_t history_table_size;  /**< Slots in the hash table, a power of two */
+  sli_ushort erase_duplicates;  /**< Non-zero to erase older duplicates */
+  sli_ushort prefix_browse;  /**< Non-zero to browse history by the text
+                                  before the cursor */
+  sli_ushort suggest_history;  /**< Non-zero to suggest the newest line in
+                                    history extending the line */
+  PrefixNode *prefix_index;  /**< Root of the prefix index, NULL until
+                                  history is browsed by prefix */
+  unsigned long prefix_file_next;  /**< End of the newest history file record
+                                        not yet in the prefix index, or zero
+                                        once all have been added */
+  unsigned long history_context;  /**< Context key given to lines saved, or
+                                       0 for none */
+  unsigned long *history_contexts;  /**< Context key of the line in each
+                                        slot of the ring, allocated once a
+                                        line is saved in a context */
+  HistoryContext **context_table;  /**< Hash table of the contexts of lines
+                                        in the ring, chained in each slot */
+  size_t context_table_size;  /**< Number of slots, a power of two */
+  size_t num_contexts;  /**< Number of contexts in the table */
+  HistoryContext *context_lines;  /**< The current context in the context
+                                       index, or NULL if it has no lines */
+  sli_ushort context_indexed;  /**< Non-zero once the context index is built,
+                                    when history is browsed in a context */
+  size_t index_bytes;  /**< Bytes allocated for the prefix and context
+                            indexes */
+  sli_ushort share_history;  /**< Non-zero to read lines other processes
+                                  append to the history file */
+  HistoryFile history_file;  /**< The attached history file */
+  SLINPUT_SharedHistory *shared_history;  /**< The attached shared history,
+                                             read as the history file */
+  unsigned long history_file_end;  /**< End of the records that were in the
+                                        history file when attached */
+  unsigned long history_file_read;  /**< End of the bytes of the history file
+                                         read or written by this state */
+  unsigned char *history_log;  /**< Records waiting to be committed to the
+                                    history file */
+  size_t history_log_bytes;  /**< Bytes of records waiting in the log */
+  size_t history_log_size;  /**< Bytes allocated for the log */
+  unsigned long history_log_time;  /**< Seconds when the oldest record
+                                        waiting in the log was added */
+  size_t history_commit_bytes;  /**< Log bytes that cause a commit */
+  unsigned long history_commit_seconds;  /**< Log age that causes a commit */
+  HistoryChunk *history_chunks;  /**< The newest chunk holding entries */
+  HistoryChunk *history_oldest_chunk;  /**< The oldest chunk */
+  size_t history_chunk_bytes;  /**< Bytes allocated for the chunks, with
+                                    their headers */
+  size_t history_live_bytes;  /**< Chunk bytes used by entries in history */
+  size_t history_dead_bytes;  /**< Chunk bytes left by removed entries */
+  size_t history_block_bytes;  /**< Bytes allocated for front coded blocks */
+  size_t history_budget;  /**< Most bytes allocated for history, or 0 */
+  sli_ushort history_encoding;  /**< Encoding of lines saved from now on */
+  sli_ushort front_coding;  /**< Non-zero to pack older lines into front
+                                 coded blocks */
+  size_t history_packed;  /**< Ring index before which lines are packed */
+  HistoryDecode *history_decode;  /**< Two decoders, so that two packed lines
+                                       can be compared, allocated with their
+                                       bytes */
+  size_t history_decode_blocks;  /**< Number of blocks whose longest line
+                                      fills the decoders */
   sli_ushort columns_in;  /**< The number of columns, zero uses width callback */
   sli_ushort cursor_margin_in;  /**< The cursor margin for scrolling to occur */
   sli_char continuation_character_left;  /**< Printed when left scrollable */
@@ -100,15 +443,156 @@ typedef struct LineInfo {
   sli_char *end_ptr;           /**< End of the line (points to '\0') */
   sli_char *cursor_ptr;        /**< Horizontal cursor position */
   sli_char *scroll_ptr;        /**< Horizontal scroll pointer */
-  sli_sshort fit_len;          /**< Max chars that fit in a line */
+  unsigned char *widths;       /**< Display width of each buffer character,
+                                    zero after a grapheme cluster's first */
+  sli_ushort max_widths;       /**< Number of characters widths can hold */
+  unsigned long *column_sums;  /**< Fenwick tree of the columns of each block
+                                    of widths, allocated with widths */
+  sli_sshort fit_len;          /**< Columns of input text that fit in a line */
   sli_sshort columns;          /**< The number of columns in the console */
   sli_sshort cursor_margin;    /**< Cursor margin before scroll performed */
 } LineInfo;
 
+/** Killed text held for yanking */
+typedef struct KillRing {
+  sli_char *entries[SLINPUT_KILL_RING_SIZE];  /**< Killed text, nil ended */
+  sli_ushort newest;  /**< Index of the most recently killed entry */
+  sli_ushort num_entries;  /**< Number of entries in the ring */
+  sli_ushort yank_age;  /**< Age of the entry last yanked, 0 is newest */
+  sli_ushort yank_position;  /**< Buffer index of the text last yanked */
+  sli_ushort yank_length;  /**< Length of the text last yanked, 0 if the
+                                previous key was not a yank */
+} KillRing;
+
+/** A line in history matched by fuzzy search */
+typedef struct FuzzyMatch {
+  HistoryPosition position;  /**< The line matched */
+  long score;  /**< Score of the match, higher is better */
+  unsigned long ordinal;  /**< Ordinal of the line, higher is newer */
+} FuzzyMatch;
+
+/** A range of lines in history scored by one fuzzy history search task,
+either indexes in the ring or file offsets of record starts */
+typedef struct FuzzyShard {
+  size_t first_index;  /**< Ring index of the first line */
+  size_t end_index;  /**< Ring index after the last line */
+  unsigned long file_start;  /**< File offset of the first record start */
+  unsigned long file_stop;  /**< File offset after the last record start,
+                                 or 0 if the shard is in the ring */
+  FuzzyMatch *ranked;  /**< Heap of the best matches, worst at the root */
+  size_t num_ranked;  /**< Number of matches in ranked */
+  size_t num_scanned;  /**< Number of lines scored */
+  HistoryDecode decode;  /**< Decoder for the packed lines in the shard */
+} FuzzyShard;
+
+/** A fuzzy history search split into shards scored as tasks, which may run
+concurrently. Tasks only write to their own shard, except that tasks run on
+the calling thread also poll for input and write cancelled. */
+typedef struct FuzzyRun {
+  const struct SLINPUT_State *state;  /**< The state searched */
+  const sli_char *query;  /**< The characters searched for */
+  size_t query_length;  /**< Number of characters in the query */
+  size_t max_matches;  /**< The most matches kept by each shard */
+  size_t oldest_index;  /**< Ring index of the oldest line in the ring */
+  FuzzyShard *shards;  /**< The shards scored */
+  size_t first_shard;  /**< Index of the shard of the first task */
+  sli_ushort query_mask;  /**< Character class mask of the query */
+  sli_ushort poll;  /**< Non-zero if tasks check for a key pressed, as they
+                         run on the calling thread */
+  sli_ushort cancelled;  /**< Non-zero once cancelled */
+} FuzzyRun;
+
+/** Incremental reverse search of history. The lines matching each length of
+query are held in turn in matches, newest first, each a subset of the lines
+matching the shorter query before it. A fuzzy search instead ranks the best
+matches afresh as the query changes. */
+typedef struct HistorySearch {
+  HistoryPosition *matches;  /**< Lines matching each length of query */
+  size_t matches_size;  /**< Number of positions matches can hold */
+  size_t level_ends[SLINPUT_SEARCH_CHARS + 1];  /**< End index in matches of
+                                                     the lines matching each
+                                                     length of query */
+  sli_char *text;  /**< A line decoded for matching */
+  size_t text_size;  /**< Number of characters text can hold */
+  const sli_char *prompt_in;  /**< The prompt replaced while searching */
+  sli_char prompt[SLINPUT_SEARCH_CHARS + 32];  /**< The search prompt */
+  sli_char query[SLINPUT_SEARCH_CHARS];  /**< The characters searched for */
+  FuzzyMatch ranked[SLINPUT_FUZZY_MATCHES];  /**< Best fuzzy matches of
+                                                 the query, best first */
+  sli_ushort num_ranked;  /**< Number of fuzzy matches ranked */
+  sli_ushort rank;  /**< Index in ranked of the fuzzy match shown */
+  sli_ushort query_length;  /**< Number of characters in the query */
+  sli_ushort fuzzy;  /**< Non-zero for fuzzy rather than substring search */
+  sli_ushort active;  /**< Non-zero while searching */
+  sli_ushort failing;  /**< Non-zero if no older line matches the query */
+} HistorySearch;
+
+/** A line in history suggested to complete the line being input, shown
+dimmed after the cursor */
+typedef struct HistorySuggestion {
+  HistoryPosition position;  /**< The line suggested */
+  sli_ushort shown;  /**< Non-zero while the suggestion is shown */
+} HistorySuggestion;
+
+/** Grapheme cluster break classes of characters, see Unicode UAX #29. The
+order matches the generated table in src/unicode/grapheme.h. */
+typedef enum GraphemeBreak {
+  BREAK_OTHER,  /**< Any other character */
+  BREAK_CR,  /**< Carriage return */
+  BREAK_LF,  /**< Line feed */
+  BREAK_CONTROL,  /**< Control and separator characters */
+  BREAK_EXTEND,  /**< Combining marks and other extending characters */
+  BREAK_ZWJ,  /**< Zero width joiner */
+  BREAK_REGIONAL_INDICATOR,  /**< Regional indicator, pairs form a flag */
+  BREAK_PREPEND,  /**< Joins the following character */
+  BREAK_SPACING_MARK,  /**< Spacing combining mark */
+  BREAK_L,  /**< Hangul leading consonant */
+  BREAK_V,  /**< Hangul vowel */
+  BREAK_T,  /**< Hangul trailing consonant */
+  BREAK_LV,  /**< Hangul LV syllable */
+  BREAK_LVT,  /**< Hangul LVT syllable */
+  BREAK_PICTOGRAPHIC  /**< Extended pictographic, e.g. emoji */
+} GraphemeBreak;
+
+/** Kinds of edit recorded in the undo log */
+typedef enum EditKind {
+  EDIT_INSERT_CHAR,  /**< Character input, consecutive inputs are coalesced */
+  EDIT_INSERT,  /**< Insertion of text */
+  EDIT_DELETE,  /**< Deletion of characters */
+  EDIT_REPLACE,  /**< Replacement of the whole line */
+  EDIT_HISTORY  /**< History browsing, consecutive browses are coalesced */
+} EditKind;
+
+/** A single edit of the line. The deleted text followed by the inserted text
+is held in the undo log text ring starting at text_index. */
+typedef struct EditRecord {
+  sli_ushort position;  /**< Buffer index at which the edit took place */
+  sli_ushort cursor;  /**< Buffer index of the cursor before the edit */
+  sli_ushort num_deleted;  /**< Number of characters deleted */
+  sli_ushort num_inserted;  /**< Number of characters inserted */
+  sli_ushort text_index;  /**< Index of the record's text in the text ring */
+  sli_ushort kind;  /**< The EditKind, used for coalescing */
+} EditRecord;
+
+/** Bounded log of edits to the line, used for undo and redo. Records are held
+oldest first in a ring, the undoable records followed by the redoable ones. */
+typedef struct UndoLog {
+  EditRecord records[SLINPUT_UNDO_RECORDS];  /**< Ring of edit records */
+  sli_char text[SLINPUT_UNDO_CHARS];  /**< Ring of deleted and inserted text */
+  sli_ushort first_record;  /**< Ring index of the oldest record */
+  sli_ushort num_records;  /**< Number of undoable and redoable records */
+  sli_ushort num_undo;  /**< Number of records that can be undone */
+  sli_ushort text_used;  /**< Number of text ring characters in use */
+} UndoLog;
+
 /** Single line input state */
 struct SLINPUT_State {
   TermInfo term_info;  /**< Terminal input state */
   LineInfo line_info;  /**< Line input state */
+  UndoLog undo_log;  /**< Edits of the line being input */
+  KillRing kill_ring;  /**< Text killed for yanking */
+  HistorySearch history_search;  /**< Incremental history search */
+  HistorySuggestion history_suggestion;  /**< Line suggested from history */
 };
 
 #endif
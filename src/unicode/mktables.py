@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Generates the Unicode lookup tables used by slinput.
+
+The width table is derived from the Unicode character database bundled with
+Python's unicodedata module. The grapheme cluster break table is derived from
+gcbprop.txt, which is vendored alongside this script as unicodedata doesn't
+provide the property. Both tables must come from the same Unicode version,
+so the script stops without writing them unless the version of Python's
+unicodedata matches that of gcbprop.txt. The tables are written as C90
+headers, so no script needs to run when building. Run this script from the
+repository root, with a Python bundling the same Unicode version, to
+regenerate:
+
+    python3 src/unicode/mktables.py
+"""
+
+import os
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x110000
+BLOCK_BITS = 8
+BLOCK_SIZE = 1 << BLOCK_BITS
+WIDTHS_PER_BYTE = 4
+BREAKS_PER_BYTE = 2
+
+# Grapheme cluster break classes, in the order of GraphemeBreak in slinputi.h
+GRAPHEME_BREAKS = [
+    'Other', 'CR', 'LF', 'Control', 'Extend', 'ZWJ', 'Regional_Indicator',
+    'Prepend', 'SpacingMark', 'L', 'V', 'T', 'LV', 'LVT',
+    'Extended_Pictographic'
+]
+
+
+def char_width(code_point):
+    """Returns the number of terminal columns occupied by a code point"""
+    char = chr(code_point)
+    category = unicodedata.category(char)
+
+    # Combining marks and format characters occupy no columns, except soft
+    # hyphen which is displayed
+    if category in ('Mn', 'Me') or (category == 'Cf' and code_point != 0xad):
+        return 0
+
+    # Hangul Jamo medial vowels and final consonants join the preceding
+    # initial consonant
+    if 0x1160 <= code_point <= 0x11ff or 0xd7b0 <= code_point <= 0xd7ff:
+        return 0
+
+    # Zero width space
+    if code_point == 0x200b:
+        return 0
+
+    # Wide and fullwidth characters occupy two columns
+    if unicodedata.east_asian_width(char) in ('W', 'F'):
+        return 2
+
+    # Everything else, including control characters, occupies one column
+    return 1
+
+
+def two_level_table(values):
+    """Splits values into blocks, sharing identical blocks. Returns the block
+    index for each block of code points and the distinct blocks."""
+    index = []
+    blocks = []
+    block_lookup = {}
+    for start in range(0, len(values), BLOCK_SIZE):
+        block = tuple(values[start:start + BLOCK_SIZE])
+        if block not in block_lookup:
+            block_lookup[block] = len(blocks)
+            blocks.append(block)
+        index.append(block_lookup[block])
+    return index, blocks
+
+
+def pack_values(block, values_per_byte):
+    """Packs values into bytes with the first value in the lowest bits"""
+    bits = 8 // values_per_byte
+    packed = []
+    for start in range(0, len(block), values_per_byte):
+        byte = 0
+        for offset in range(values_per_byte):
+            byte |= block[start + offset] << (offset * bits)
+        packed.append(byte)
+    return packed
+
+
+def read_grapheme_breaks(path):
+    """Reads the grapheme cluster break class of each code point. Extended
+    pictographic code points are given their own class, as the grapheme
+    cluster break of all of them is Other."""
+    breaks = [0] * MAX_CODE_POINT
+    with open(path) as data:
+        for line in data:
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            code_points, value = [field.strip() for field in line.split(';')]
+            first, _, last = code_points.partition('..')
+            for code_point in range(int(first, 16), int(last or first, 16) + 1):
+                if value != 'Extended_Pictographic' or not breaks[code_point]:
+                    breaks[code_point] = GRAPHEME_BREAKS.index(value)
+    return breaks
+
+
+def data_version(path):
+    """Returns the Unicode version given at the end of the first line of a
+    vendored data file"""
+    with open(path) as data:
+        return data.readline().split()[-1]
+
+
+def format_array(values, per_line=12):
+    """Formats integer values as the body of a C array"""
+    lines = []
+    for start in range(0, len(values), per_line):
+        lines.append('  ' + ', '.join('0x%02x' % value
+            for value in values[start:start + per_line]) + ',')
+    lines[-1] = lines[-1][:-1]
+    return '\n'.join(lines)
+
+
+def write_width_table(path):
+    widths = [char_width(code_point)
+        for code_point in range(MAX_CODE_POINT)]
+    index, blocks = two_level_table(widths)
+    if len(blocks) > 256:
+        sys.exit('Too many distinct width blocks')
+
+    packed = []
+    for block in blocks:
+        packed.extend(pack_values(block, WIDTHS_PER_BYTE))
+
+    with open(path, 'w') as header:
+        header.write('''/**
+@file width.h
+@brief Display width of Unicode code points
+
+Generated by src/unicode/mktables.py from Unicode %s, do not edit.
+*/
+#ifndef SLINPUT_UNICODE_WIDTH_HEADER
+#define SLINPUT_UNICODE_WIDTH_HEADER
+
+/** Code points per block of the width table */
+#define SLINPUT_WIDTH_BLOCK_BITS %d
+
+/** Number of code points covered by the width table */
+#define SLINPUT_WIDTH_CODE_POINTS 0x%xUL
+
+/** Block of the width table for each block of code points */
+static const unsigned char SLINPUT_WidthIndex[%d] = {
+%s
+};
+
+/** Widths of the code points in each distinct block, packed four two bit
+widths per byte with the lowest code point in the lowest bits */
+static const unsigned char SLINPUT_WidthBlocks[%d] = {
+%s
+};
+
+#endif
+''' % (unicodedata.unidata_version, BLOCK_BITS, MAX_CODE_POINT,
+            len(index), format_array(index), len(packed),
+            format_array(packed)))
+
+
+def write_grapheme_table(data_path, path):
+    version = data_version(data_path)
+    breaks = read_grapheme_breaks(data_path)
+    index, blocks = two_level_table(breaks)
+    if len(blocks) > 256:
+        sys.exit('Too many distinct grapheme break blocks')
+
+    packed = []
+    for block in blocks:
+        packed.extend(pack_values(block, BREAKS_PER_BYTE))
+
+    with open(path, 'w') as header:
+        header.write('''/**
+@file grapheme.h
+@brief Grapheme cluster break class of Unicode code points
+
+Generated by src/unicode/mktables.py from gcbprop.txt, Unicode %s, do not
+edit. The classes are the values of GraphemeBreak in slinputi.h.
+*/
+#ifndef SLINPUT_UNICODE_GRAPHEME_HEADER
+#define SLINPUT_UNICODE_GRAPHEME_HEADER
+
+/** Code points per block of the grapheme break table */
+#define SLINPUT_BREAK_BLOCK_BITS %d
+
+/** Number of code points covered by the grapheme break table */
+#define SLINPUT_BREAK_CODE_POINTS 0x%xUL
+
+/** Block of the grapheme break table for each block of code points */
+static const unsigned char SLINPUT_BreakIndex[%d] = {
+%s
+};
+
+/** Grapheme break classes of the code points in each distinct block, packed
+two four bit classes per byte with the lowest code point in the lowest bits */
+static const unsigned char SLINPUT_BreakBlocks[%d] = {
+%s
+};
+
+#endif
+''' % (version, BLOCK_BITS, MAX_CODE_POINT, len(index),
+            format_array(index), len(packed), format_array(packed)))
+
+
+def main():
+    directory = os.path.dirname(os.path.abspath(__file__))
+    version = data_version(os.path.join(directory, 'gcbprop.txt'))
+    if unicodedata.unidata_version != version:
+        sys.exit('unicodedata is Unicode %s but gcbprop.txt is Unicode %s, '
+            'regenerate with a Python bundling Unicode %s' %
+            (unicodedata.unidata_version, version, version))
+
+    write_width_table(os.path.join(directory, 'width.h'))
+    write_grapheme_table(os.path.join(directory, 'gcbprop.txt'),
+        os.path.join(directory, 'grapheme.h'))
+
+
+if __name__ == '__main__':
+    main()
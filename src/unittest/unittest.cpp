@@ -1,5 +1,12 @@
 #include <list>
 #include <optional>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <gtest/gtest.h>
 
@@ -35,6 +42,7 @@ class SingleLineInput : public ::testing::Test {
     input_.clear();
     output_.clear();
     allocated_memory_ = 0;
+    fail_alloc_size_ = 0;
   }
 
   /**
@@ -85,6 +93,7 @@ class SingleLineInput : public ::testing::Test {
   uint16_t terminal_width_ = 0;  /**< The width of the terminal for the test */
   bool is_flushing_ = false;  /**< true if the input is being flushed */
   size_t allocated_memory_ = 0;  /**< Counts alloc'd memory for the test */
+  size_t fail_alloc_size_ = 0;  /**< Size of allocation to fail, if not 0 */
 };
 
 SingleLineInput::SingleLineInput() {
@@ -150,6 +159,9 @@ int SingleLineInput::IsSpaceIn(const SLINPUT_State *state,
 void *SingleLineInput::MallocIn(SLINPUT_AllocInfo alloc_info, size_t size) {
   SingleLineInput *self =
     static_cast<SingleLineInput *>(alloc_info.alloc_info_data);
+  if (size == self->fail_alloc_size_)
+    return nullptr;
+
   char *ptr = static_cast<char *>(malloc(size + sizeof(size_t)));
   *reinterpret_cast<size_t *>(ptr) = size;
   self->allocated_memory_ += size;
@@ -182,7 +194,9 @@ int SingleLineInput::CursorControlOut(const SLINPUT_State *state,
     L"[SLINPUT_CCC_RESTORE_CURSOR]",     /* SLINPUT_CCC_RESTORE_CURSOR */
     L"[SLINPUT_CCC_CLEAR_LINE]",  /* SLINPUT_CCC_CLEAR_LINE */
     L"[SLINPUT_CCC_WRAP_ON]",    /* SLINPUT_CCC_WRAP_ON */
-    L"[SLINPUT_CCC_WRAP_OFF]"     /* SLINPUT_CCC_WRAP_OFF */
+    L"[SLINPUT_CCC_WRAP_OFF]",     /* SLINPUT_CCC_WRAP_OFF */
+    L"[SLINPUT_CCC_DIM_ON]",    /* SLINPUT_CCC_DIM_ON */
+    L"[SLINPUT_CCC_DIM_OFF]"     /* SLINPUT_CCC_DIM_OFF */
   };
 
   const wchar_t *str = SLINPUT_CursorControlTable[cursor_control_code];
@@ -2016,32 +2030,68 @@ TEST_F(SingleLineInput, HistorySelection) {
   EXPECT_EQ(allocated_memory_, 0);
 }
 
-/** Completion data for SLINPUT_CompletionInfo */
-typedef struct CompletionData {
-  uint32_t value;  /**< Holds value to check during completion test */
-} CompletionData;
+/* Test history capacity set at runtime */
+TEST_F(SingleLineInput, HistoryCapacity) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 20;
 
-static int CompletionRequest(SLINPUT_State *state,
-    SLINPUT_CompletionInfo completion_info, uint16_t string_length,
-    const sli_char *string) {
-  EXPECT_EQ(wcslen(string), string_length);
+  /* No lines are kept without capacity */
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 0), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"Entry: 0"), 0);
 
-  CompletionData *completion_data =
-    static_cast<CompletionData *>(completion_info.completion_info_data);
-  EXPECT_EQ(completion_data->value, 42u);
+  /* The ring wraps, removing the oldest lines */
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 3), 0);
+  for (int32_t i = 1; i <= 5; ++i) {
+    sli_char history_buffer[16];
 
-  if (wcscmp(string, L"One ") == 0) {
-    /* User would be promted here with options which would output text. */
-    /* Therefore replace with same line to cause a redraw. */
-    SLINPUT_CompletionReplace(state, string);
-  } else if (wcscmp(string, L"One Two ") == 0) {
-    SLINPUT_CompletionReplace(state, L"One Two Three");
+    swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+      L"Entry: %d", i);
+
+    EXPECT_EQ(SLINPUT_Save(state, history_buffer), i < 3 ? i : 3);
   }
 
-  return 0;
+  /* A capacity too large to allocate is refused, keeping the lines */
+  EXPECT_LT(SLINPUT_Set_HistoryCapacity(state, static_cast<size_t>(-1)), 0);
+
+  /* Reducing the capacity keeps the newest lines */
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 2), 0);
+
+  for (int32_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 8);
+  EXPECT_STREQ(buffer, L"Entry: 4");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Entry: 5[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Entry: 4[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Entry: 4[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
 }
 
-TEST_F(SingleLineInput, TabCommandCompletion) {
+/* Test older duplicates are erased from history */
+TEST_F(SingleLineInput, HistoryEraseDuplicates) {
   SLINPUT_Stream stream = { this };
   SLINPUT_AllocInfo alloc_info = { this };
   SLINPUT_State *state =
@@ -2049,68 +2099,118 @@ TEST_F(SingleLineInput, TabCommandCompletion) {
   ASSERT_TRUE(state);
   SLINPUT_Set_Streams(state, stream, stream);
   InitState(state);
+  terminal_width_ = 20;
+
+  /* Enabling erases duplicates already saved */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 3);
+  SLINPUT_Set_HistoryEraseDuplicates(state, 1);
+
+  /* Saving moves a line to the most recent position */
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd"), 3);
+
+  /* Browse over the erased lines, leaving "ls", "make", "cd" */
+  for (int32_t i = 0; i < 4; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
 
   sli_char buffer[40];
-  terminal_width_ = 20;
 
-  CompletionData completion_data;
-  completion_data.value = 42;
-  SLINPUT_CompletionInfo completion_info = { &completion_data };
-  SLINPUT_Set_CompletionRequest(state, completion_info, CompletionRequest);
-  SLINPUT_Set_LeaveRaw(state, LeaveRawIn);
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 4);
+  EXPECT_STREQ(buffer, L"make");
 
-  /* Characters */
-  const sli_char *first_input = L"One ";
-  while (*first_input)
-    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  cd[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  make[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ls[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ls[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  make[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
 
-  /* Trigger command completion */
-  input_.push_back( KeyInput { SLINPUT_KC_TAB, L'\0' } );
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
 
-  const sli_char *second_input = L"Two ";
-  while (*second_input)
-    input_.push_back( KeyInput { SLINPUT_KC_NUL, *second_input++ } );
+/* Test memory for history stays bounded as old lines are removed */
+TEST_F(SingleLineInput, HistoryChunksCompacted) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 40;
 
-  /* Trigger command completion */
-  input_.push_back( KeyInput { SLINPUT_KC_TAB, L'\0' } );
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 8), 0);
 
-  /* End input */
+  const size_t state_memory = allocated_memory_;
+  size_t settled_memory = 0;
+  size_t peak_memory = 0;
+  for (int32_t i = 0; i < 10000; ++i) {
+    sli_char history_buffer[64];
+
+    swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+      L"%*sEntry: %d", i % 40, L"", i);
+
+    EXPECT_EQ(SLINPUT_Save(state, history_buffer), i < 8 ? i + 1 : 8);
+    if (i == 1000)
+      settled_memory = allocated_memory_ - state_memory;
+    else if (allocated_memory_ - state_memory > peak_memory)
+      peak_memory = allocated_memory_ - state_memory;
+  }
+
+  /* Removed lines are compacted away rather than accumulating */
+  EXPECT_LT(peak_memory, 4 * settled_memory);
+
+  /* Select the oldest line */
+  for (int32_t i = 0; i < 8; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
   input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
 
+  sli_char buffer[64];
+
   EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
-    sizeof(buffer)/sizeof(buffer[0]), buffer), 13);
-  EXPECT_STREQ(buffer, L"One Two Three");
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 43);
+  EXPECT_STREQ(buffer, L"                                Entry: 9992");
 
   EXPECT_STREQ(output_.c_str(),
     /* Line wrap off */
     L"[SLINPUT_CCC_WRAP_OFF]"
     /* ApplyDimension and RedrawLine */
     L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    /* Key presses */
-    L"[SLINPUT_CCC_DISABLE_CURSOR]O[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    /* Line redrawn */
-    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    /* Key presses */
-    L"[SLINPUT_CCC_DISABLE_CURSOR]T[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]w[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    /* Command completion replace */
-    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One Two Three[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9999[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9998[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9997[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9996[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9995[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9994[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9993[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>                          Entry: 9992[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
     /* New line */
     L"\n"
     /* Line wrap on */
-    L"[SLINPUT_CCC_WRAP_ON]"
-  );
+    L"[SLINPUT_CCC_WRAP_ON]");
 
   SLINPUT_DestroyState(state);
   EXPECT_EQ(allocated_memory_, 0);
 }
 
-TEST_F(SingleLineInput, InitialString) {
+/* Test history stored as UTF-8 */
+TEST_F(SingleLineInput, HistoryUtf8) {
   SLINPUT_Stream stream = { this };
   SLINPUT_AllocInfo alloc_info = { this };
   SLINPUT_State *state =
@@ -2118,37 +2218,2221 @@ TEST_F(SingleLineInput, InitialString) {
   ASSERT_TRUE(state);
   SLINPUT_Set_Streams(state, stream, stream);
   InitState(state);
+  terminal_width_ = 40;
 
-  sli_char buffer[256];
-  terminal_width_ = 20;
+  /* A line saved natively is still a duplicate of the same line in UTF-8 */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls -l"), 1);
+  SLINPUT_Set_HistoryEncoding(state, SLINPUT_HE_UTF8);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls -l\n"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"Gr\u00fc\u00dfe \u4e16\u754c \U0001f600"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"echo"), 3);
 
-  /* Characters followed by new line */
-  const sli_char *input = L"String\n";
-  while (*input)
-    input_.push_back( KeyInput { SLINPUT_KC_NUL, *input++ } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 10);
+  EXPECT_STREQ(buffer, L"Gr\u00fc\u00dfe \u4e16\u754c \U0001f600");
 
-  EXPECT_EQ(SLINPUT_Get(state, L"> ", L"Initial ",
-    sizeof(buffer)/sizeof(buffer[0]), buffer), 14);
   EXPECT_STREQ(output_.c_str(),
     /* Line wrap off */
     L"[SLINPUT_CCC_WRAP_OFF]"
     /* ApplyDimension and RedrawLine */
-    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Initial [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    /* Key presses */
-    L"[SLINPUT_CCC_DISABLE_CURSOR]S[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]r[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]i[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
-    L"[SLINPUT_CCC_DISABLE_CURSOR]g[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  echo[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Gr\xFC\xDF" L"e \x4E16\x754C \x1F600[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
     /* New line */
     L"\n"
     /* Line wrap on */
-    L"[SLINPUT_CCC_WRAP_ON]"
-  );
+    L"[SLINPUT_CCC_WRAP_ON]");
 
-  /* Produces the characters */
-  EXPECT_STREQ(buffer, L"Initial String");
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Compare the memory held by history stored natively and as UTF-8 */
+TEST_F(SingleLineInput, HistoryUtf8Memory) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  size_t history_memory[2];
+
+  for (int32_t encoding = 0; encoding < 2; ++encoding) {
+    SLINPUT_State *state =
+      SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+    ASSERT_TRUE(state);
+    SLINPUT_Set_Streams(state, stream, stream);
+    EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 64), 0);
+    SLINPUT_Set_HistoryEncoding(state,
+      static_cast<SLINPUT_HistoryEncoding>(encoding));
+
+    const size_t state_memory = allocated_memory_;
+    for (int32_t i = 0; i < 64; ++i) {
+      sli_char history_buffer[48];
+
+      swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+        L"git commit -m \"Caf\u00e9 entry %d\"", i);
+
+      SLINPUT_Save(state, history_buffer);
+    }
+    history_memory[encoding] = allocated_memory_ - state_memory;
+
+    SLINPUT_DestroyState(state);
+    EXPECT_EQ(allocated_memory_, 0);
+  }
+
+  RecordProperty("NativeHistoryBytes", static_cast<int>(history_memory[0]));
+  RecordProperty("Utf8HistoryBytes", static_cast<int>(history_memory[1]));
+  if (sizeof(sli_char) > 1)
+    EXPECT_LT(history_memory[1] * 2, history_memory[0]);
+  else
+    EXPECT_EQ(history_memory[1], history_memory[0]);
+}
+
+/* Test front coded history uses less memory and reads back the same */
+TEST_F(SingleLineInput, HistoryFrontCoding) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  size_t history_memory[2];
+
+  for (int32_t front_coding = 0; front_coding < 2; ++front_coding) {
+    SLINPUT_State *state =
+      SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+    ASSERT_TRUE(state);
+    EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 256), 0);
+    SLINPUT_Set_HistoryFrontCoding(state, front_coding);
+
+    const size_t state_memory = allocated_memory_;
+    for (int32_t i = 0; i < 256; ++i) {
+      sli_char history_buffer[64];
+
+      swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+        L"kubectl get pods --namespace production -l app=web-%d", i);
+
+      EXPECT_GT(SLINPUT_Save(state, history_buffer), 0);
+    }
+    history_memory[front_coding] = allocated_memory_ - state_memory;
+
+    /* Packed lines decode in any order */
+    sli_char buffer[64];
+    EXPECT_EQ(SLINPUT_GetHistory(state, 200,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 53);
+    EXPECT_STREQ(buffer, L"kubectl get pods --namespace production -l app=web-55");
+    EXPECT_EQ(SLINPUT_GetHistory(state, 255,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 52);
+    EXPECT_STREQ(buffer, L"kubectl get pods --namespace production -l app=web-0");
+    EXPECT_EQ(SLINPUT_GetHistory(state, 199,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 53);
+    EXPECT_STREQ(buffer, L"kubectl get pods --namespace production -l app=web-56");
+
+    SLINPUT_HistoryMatch matches[1];
+    EXPECT_EQ(SLINPUT_MatchHistory(state, L"web-42", 1, matches), 1);
+    EXPECT_EQ(matches[0].age, 213u);
+
+    /* A packed copy of a line saved again is erased */
+    SLINPUT_Set_HistoryEraseDuplicates(state, 1);
+    EXPECT_GT(SLINPUT_Save(state,
+      L"kubectl get pods --namespace production -l app=web-3"), 0);
+    EXPECT_EQ(SLINPUT_GetHistory(state, 252,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 52);
+    EXPECT_STREQ(buffer, L"kubectl get pods --namespace production -l app=web-4");
+    EXPECT_EQ(SLINPUT_GetHistory(state, 253,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 52);
+    EXPECT_STREQ(buffer, L"kubectl get pods --namespace production -l app=web-2");
+
+    SLINPUT_DestroyState(state);
+    EXPECT_EQ(allocated_memory_, 0);
+  }
+
+  RecordProperty("PlainHistoryBytes", static_cast<int>(history_memory[0]));
+  RecordProperty("FrontCodedHistoryBytes",
+    static_cast<int>(history_memory[1]));
+  EXPECT_LT(history_memory[1] * 2, history_memory[0]);
+}
+
+/* Test the oldest lines are removed to keep history within its budget */
+TEST_F(SingleLineInput, HistoryBudget) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_LT(SLINPUT_GetHistoryBytes(state), 1024u);
+  SLINPUT_Set_HistoryBudget(state, 8192);
+
+  for (int32_t i = 0; i < 16; ++i) {
+    sli_char history_buffer[16];
+    swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+      L"ls %d", i);
+    EXPECT_EQ(SLINPUT_Save(state, history_buffer), i + 1);
+  }
+  const size_t short_bytes = SLINPUT_GetHistoryBytes(state);
+  EXPECT_GT(short_bytes, 0u);
+  EXPECT_LT(short_bytes, 8192u);
+
+  /* A pasted line pushes out the oldest short lines */
+  std::wstring pasted(1600, L'x');
+  const int num_history = SLINPUT_Save(state, pasted.c_str());
+  EXPECT_LT(num_history, 17);
+  EXPECT_GT(num_history, 1);
+  EXPECT_LE(SLINPUT_GetHistoryBytes(state), 8192u);
+  sli_char buffer[16];
+  EXPECT_EQ(SLINPUT_GetHistory(state, 1,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 5);
+  EXPECT_STREQ(buffer, L"ls 15");
+  const std::wstring oldest = L"ls " + std::to_wstring(17 - num_history);
+  EXPECT_EQ(SLINPUT_GetHistory(state, static_cast<size_t>(num_history - 1),
+    sizeof(buffer)/sizeof(buffer[0]), buffer),
+    static_cast<int>(oldest.size()));
+  EXPECT_STREQ(buffer, oldest.c_str());
+
+  /* A line that can't fit alone is not kept */
+  std::wstring huge(4096, L'y');
+  EXPECT_EQ(SLINPUT_Save(state, huge.c_str()), num_history);
+
+  /* Reducing the budget removes lines at once */
+  SLINPUT_Set_HistoryBudget(state, short_bytes/2);
+  EXPECT_LE(SLINPUT_GetHistoryBytes(state), short_bytes/2);
+  EXPECT_GE(SLINPUT_Save(state, L"pwd"), 1);
+  EXPECT_LE(SLINPUT_GetHistoryBytes(state), short_bytes/2);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test the decoders of packed lines shrink with them under a budget */
+TEST_F(SingleLineInput, HistoryBudgetFrontCoding) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 64), 0);
+  SLINPUT_Set_HistoryFrontCoding(state, 1);
+  std::wstring pasted(1200, L'x');
+  EXPECT_EQ(SLINPUT_Save(state, pasted.c_str()), 1);
+  for (int32_t i = 0; i < 40; ++i) {
+    sli_char history_buffer[16];
+    swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+      L"ls %d", i);
+    EXPECT_EQ(SLINPUT_Save(state, history_buffer), i + 2);
+  }
+
+  /* Removing the packed long line frees the room decoding it took */
+  SLINPUT_Set_HistoryBudget(state, 4000);
+  EXPECT_LE(SLINPUT_GetHistoryBytes(state), 4000u);
+  for (int32_t i = 0; i < 40; ++i) {
+    sli_char history_buffer[16];
+    sli_char buffer[16];
+    swprintf(history_buffer, sizeof(history_buffer)/sizeof(history_buffer[0]),
+      L"pwd %d", i);
+    EXPECT_GT(SLINPUT_Save(state, history_buffer), 1);
+    EXPECT_LE(SLINPUT_GetHistoryBytes(state), 4000u);
+    EXPECT_GT(SLINPUT_GetHistory(state, 0,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 0);
+    EXPECT_STREQ(buffer, history_buffer);
+  }
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test lines viewed in one state are imported into another */
+TEST_F(SingleLineInput, HistoryViewImport) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_HistoryEncoding(state, SLINPUT_HE_UTF8);
+  EXPECT_EQ(SLINPUT_Save(state, L"first"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"sec\u00f6nd"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"third"), 3);
+
+  /* Views point at the stored UTF-8, oldest first */
+  std::string exported;
+  SLINPUT_HistoryView view;
+  size_t iterator = 0;
+  while (SLINPUT_ViewHistory(state, &iterator, &view)) {
+    EXPECT_EQ(view.encoding, SLINPUT_HE_UTF8);
+    exported.append(static_cast<const char *>(view.text), view.num_bytes);
+    exported.push_back('\0');
+  }
+  EXPECT_EQ(exported, std::string("first\0sec\xC3\xB6nd\0third\0", 20));
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+
+  /* A line that is not nil terminated or not UTF-8 saves nothing */
+  EXPECT_LT(SLINPUT_ImportHistory(state, "ab", 2, SLINPUT_HE_UTF8), 0);
+  EXPECT_LT(SLINPUT_ImportHistory(state, "a\x80\0", 3, SLINPUT_HE_UTF8), 0);
+  EXPECT_LT(SLINPUT_ImportHistory(state, "\xF8\x80\x80\x80\x80\0", 6,
+    SLINPUT_HE_UTF8), 0);
+  EXPECT_LT(SLINPUT_ImportHistory(state, "\xC3\0", 2, SLINPUT_HE_UTF8), 0);
+  sli_char buffer[16];
+  EXPECT_LT(SLINPUT_GetHistory(state, 0,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 0);
+
+  EXPECT_EQ(SLINPUT_ImportHistory(state, exported.data(), exported.size(),
+    SLINPUT_HE_UTF8), 3);
+  EXPECT_EQ(SLINPUT_GetHistory(state, 1,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"sec\u00f6nd");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/** A temporary file, removed when it goes out of scope, even when a test
+fails part way */
+class TempFile {
+ public:
+  TempFile() {
+    const int fd = mkstemp(path_);
+    created_ = fd != -1;
+    if (created_)
+      close(fd);
+  }
+
+  ~TempFile() {
+    if (created_)
+      unlink(path_);
+  }
+
+  TempFile(const TempFile &) = delete;
+  TempFile &operator=(const TempFile &) = delete;
+
+  /** @return non-zero if the file was created */
+  bool Created() const { return created_; }
+
+  /** @return the path of the file */
+  const char *Path() const { return path_; }
+
+ private:
+  char path_[20] = "/tmp/slinputtXXXXXX";  /**< Path of the file */
+  bool created_ = false;  /**< True if the file was created */
+};
+
+/* Test lines saved into a history file in an earlier session */
+TEST_F(SingleLineInput, HistoryFile) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  /* Earlier session */
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"first"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"second\n"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"th\u00efrd"), 3);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* Later session, browsing past its own line into the file */
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 20;
+
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"fourth"), 1);
+
+  for (int32_t i = 0; i < 5; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"second");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  fourth[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  th\xEFrd[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  second[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  first[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  first[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  second[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* A file in another format is not attached */
+  FILE *file = fopen(path, "wb");
+  ASSERT_TRUE(file);
+  fputs("ls -l\n", file);
+  fclose(file);
+
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_LT(SLINPUT_AttachHistory(state, path), 0);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Returns the size of a file in bytes */
+static long FileSize(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return -1;
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+/* Test lines saved into history are committed to the file together */
+TEST_F(SingleLineInput, HistoryCommit) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_HistoryCommit(state, 30, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(FileSize(path), 8);
+
+  /* Each record is 12 bytes plus the text */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"pwd"), 2);
+  EXPECT_EQ(FileSize(path), 8);
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 3);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16);
+
+  EXPECT_EQ(SLINPUT_Save(state, L"cd"), 4);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16);
+  EXPECT_EQ(SLINPUT_CommitHistory(state), 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16 + 14);
+
+  /* Commit each line as it is saved */
+  SLINPUT_Set_HistoryCommit(state, 0, 3600);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 5);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16 + 14 + 14);
+
+  /* Lines waiting are committed when the state is destroyed */
+  SLINPUT_Set_HistoryCommit(state, 4096, 3600);
+  EXPECT_EQ(SLINPUT_Save(state, L"pwd"), 6);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16 + 14 + 14);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16 + 14 + 14 + 15);
+}
+
+/* Test a line too long for the budget is still appended to the file */
+TEST_F(SingleLineInput, HistoryBudgetFile) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_HistoryBudget(state, 1024);
+  SLINPUT_Set_HistoryCommit(state, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(FileSize(path), 8 + 14);
+
+  std::wstring huge(2048, L'y');
+  SLINPUT_Save(state, huge.c_str());
+  EXPECT_LE(SLINPUT_GetHistoryBytes(state), 1024u);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 12 + 2048);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test lines not committed are kept and committed later */
+TEST_F(SingleLineInput, HistoryCommitRetry) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+  const std::string moved = std::string(path) + ".moved";
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_HistoryShared(state, 1);
+  SLINPUT_Set_HistoryCommit(state, 4096, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"pwd"), 2);
+
+  /* A directory at the path cannot be opened to read shared lines */
+  ASSERT_EQ(rename(path, moved.c_str()), 0);
+  ASSERT_EQ(mkdir(path, 0700), 0);
+  EXPECT_LT(SLINPUT_CommitHistory(state), 0);
+  EXPECT_LT(SLINPUT_AttachHistory(state, NULL), 0);
+  EXPECT_EQ(rmdir(path), 0);
+  ASSERT_EQ(rename(moved.c_str(), path), 0);
+  EXPECT_EQ(FileSize(path), 8);
+
+  /* Both lines are committed, once */
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 3);
+  EXPECT_EQ(SLINPUT_CommitHistory(state), 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16);
+  EXPECT_EQ(SLINPUT_CommitHistory(state), 0);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, NULL), 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 15 + 16);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test states share seed history, keeping the lines they save apart */
+TEST_F(SingleLineInput, HistorySharedSeed) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"sec\u00f6nd"), 2);
+  SLINPUT_SharedHistory *shared_history = SLINPUT_CreateSharedHistory(state);
+  ASSERT_TRUE(shared_history);
+  SLINPUT_DestroyState(state);
+  EXPECT_GT(allocated_memory_, 0);
+
+  SLINPUT_State *other = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(other);
+  EXPECT_EQ(SLINPUT_AttachSharedHistory(other, shared_history), 0);
+  EXPECT_EQ(SLINPUT_Save(other, L"other"), 1);
+
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  EXPECT_EQ(SLINPUT_AttachSharedHistory(state, shared_history), 0);
+  SLINPUT_ReleaseSharedHistory(shared_history);
+  EXPECT_EQ(SLINPUT_Save(state, L"own"), 1);
+
+  /* Up past its own line into the shared lines, without the other state's */
+  for (int32_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"sec\u00f6nd");
+
+  /* The shared history is freed with the last state attached */
+  SLINPUT_DestroyState(state);
+  EXPECT_GT(allocated_memory_, 0);
+  SLINPUT_DestroyState(other);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test prefix browsing goes from a state's own lines into shared history */
+TEST_F(SingleLineInput, HistorySharedPrefix) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_Save(state, L"make all"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls -l"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 3);
+  SLINPUT_SharedHistory *shared_history = SLINPUT_CreateSharedHistory(state);
+  ASSERT_TRUE(shared_history);
+  SLINPUT_DestroyState(state);
+
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_HistoryPrefixBrowse(state, 1);
+  EXPECT_EQ(SLINPUT_AttachSharedHistory(state, shared_history), 0);
+  SLINPUT_ReleaseSharedHistory(shared_history);
+  EXPECT_EQ(SLINPUT_Save(state, L"make own"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 2);
+
+  /* Up through its own line and the shared lines, then down one */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'a' } );
+  for (int32_t i = 0; i < 4; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 10);
+  EXPECT_STREQ(buffer, L"make clean");
+
+  /* Then back down past the shared lines to its own */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 8);
+  EXPECT_STREQ(buffer, L"make own");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test a record torn by an interrupted commit is skipped */
+TEST_F(SingleLineInput, HistoryFileTorn) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"first"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"second"), 2);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* The start of a record for "third" */
+  FILE *file = fopen(path, "ab");
+  ASSERT_TRUE(file);
+  fwrite("\x05\0\0\0thi", 1, 7, file);
+  fclose(file);
+
+  /* A session that appends after the torn record */
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"fourth"), 1);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* Browse back over the torn record and down again */
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 20;
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+
+  for (int32_t i = 0; i < 4; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  for (int32_t i = 0; i < 2; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"fourth");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  fourth[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  second[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  first[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  first[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  second[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  fourth[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test lines saved by another state are read from a shared history file */
+TEST_F(SingleLineInput, HistoryShared) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *other =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(other);
+  SLINPUT_Set_HistoryShared(other, 1);
+  SLINPUT_Set_HistoryCommit(other, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(other, path), 0);
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 20;
+  SLINPUT_Set_HistoryShared(state, 1);
+  SLINPUT_Set_HistoryCommit(state, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+
+  /* The other state reads "ls" before committing "make" */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(SLINPUT_Save(other, L"make"), 2);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 16);
+
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 2);
+  EXPECT_STREQ(buffer, L"ls");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  make[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ls[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ls[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  /* "make" was read once */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 3);
+
+  SLINPUT_DestroyState(other);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test a record still being written to a shared history file is read once
+it is complete */
+TEST_F(SingleLineInput, HistorySharedPartial) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  const TempFile records_file;
+  ASSERT_TRUE(temp_file.Created());
+  ASSERT_TRUE(records_file.Created());
+  const char *path = temp_file.Path();
+  const char *records_path = records_file.Path();
+
+  /* Write the records of "pwd" and "make" */
+  SLINPUT_State *writer =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(writer);
+  SLINPUT_Set_HistoryCommit(writer, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(writer, records_path), 0);
+  EXPECT_EQ(SLINPUT_Save(writer, L"pwd"), 1);
+  EXPECT_EQ(SLINPUT_Save(writer, L"make"), 2);
+  SLINPUT_DestroyState(writer);
+  char records[8 + 15 + 16];
+  FILE *file = fopen(records_path, "rb");
+  ASSERT_TRUE(file);
+  ASSERT_EQ(fread(records, 1, sizeof(records), file), sizeof(records));
+  fclose(file);
+
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_HistoryShared(state, 1);
+  SLINPUT_Set_HistoryCommit(state, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+
+  /* "make" is half written */
+  file = fopen(path, "ab");
+  ASSERT_TRUE(file);
+  fwrite(records + 8, 1, 15 + 8, file);
+  fclose(file);
+
+  sli_char buffer[40];
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 1);
+
+  file = fopen(path, "ab");
+  ASSERT_TRUE(file);
+  fwrite(records + 8 + 15 + 8, 1, 8, file);
+  fclose(file);
+
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd"), 4);
+
+  /* A record torn before an intact one is skipped */
+  file = fopen(path, "ab");
+  ASSERT_TRUE(file);
+  fwrite(records + 8 + 15, 1, 6, file);
+  fclose(file);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 5);
+  file = fopen(path, "ab");
+  ASSERT_TRUE(file);
+  fwrite(records + 8, 1, 15, file);
+  fclose(file);
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd"), 7);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test compacting a history file shared with another state */
+TEST_F(SingleLineInput, HistoryCompact) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *other =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(other);
+  SLINPUT_Set_HistoryShared(other, 1);
+  SLINPUT_Set_HistoryCommit(other, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(other, path), 0);
+
+  SLINPUT_State *compactor =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(compactor);
+  SLINPUT_Set_HistoryShared(compactor, 1);
+  EXPECT_EQ(SLINPUT_AttachHistory(compactor, path), 0);
+
+  const sli_char *lines[] = { L"ls", L"make", L"ls", L"pwd", L"make", L"cd" };
+  for (const sli_char *line : lines)
+    EXPECT_GT(SLINPUT_Save(other, line), 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 16 + 14 + 15 + 16 + 14);
+
+  /* Keep the newest three distinct lines */
+  EXPECT_EQ(SLINPUT_CompactHistory(compactor, 3), 0);
+  EXPECT_EQ(FileSize(path), 8 + 15 + 16 + 14);
+  std::string temp_path(path);
+  temp_path += ".tmp";
+  EXPECT_EQ(access(temp_path.c_str(), F_OK), -1);
+
+  /* The other state appends to the new file */
+  EXPECT_GT(SLINPUT_Save(other, L"vi"), 0);
+  EXPECT_EQ(FileSize(path), 8 + 15 + 16 + 14 + 14);
+
+  SLINPUT_DestroyState(compactor);
+  SLINPUT_DestroyState(other);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* Browse the compacted file */
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 20;
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+
+  for (int32_t i = 0; i < 5; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 3);
+  EXPECT_STREQ(buffer, L"pwd");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* History selection */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  vi[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  cd[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  make[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  pwd[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  pwd[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test a state not sharing the history file commits to the file that
+replaced it */
+TEST_F(SingleLineInput, HistoryCompactUnshared) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *other =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(other);
+  SLINPUT_Set_HistoryCommit(other, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(other, path), 0);
+
+  SLINPUT_State *compactor =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(compactor);
+  EXPECT_EQ(SLINPUT_AttachHistory(compactor, path), 0);
+
+  const sli_char *lines[] = { L"ls", L"make", L"ls", L"pwd" };
+  for (const sli_char *line : lines)
+    EXPECT_GT(SLINPUT_Save(other, line), 0);
+  EXPECT_EQ(FileSize(path), 8 + 14 + 16 + 14 + 15);
+
+  EXPECT_EQ(SLINPUT_CompactHistory(compactor, 100), 0);
+  EXPECT_EQ(FileSize(path), 8 + 16 + 14 + 15);
+
+  /* The line is committed to the new file, not the replaced one */
+  EXPECT_GT(SLINPUT_Save(other, L"vi"), 0);
+  EXPECT_EQ(FileSize(path), 8 + 16 + 14 + 15 + 14);
+  EXPECT_GT(SLINPUT_Save(other, L"cd"), 0);
+  EXPECT_EQ(FileSize(path), 8 + 16 + 14 + 15 + 14 + 14);
+
+  SLINPUT_DestroyState(compactor);
+  SLINPUT_DestroyState(other);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test lines read into history since the file was attached are browsed
+once after it is compacted, by the compactor and by another state */
+TEST_F(SingleLineInput, HistoryCompactBrowse) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  SLINPUT_State *writer =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(writer);
+  SLINPUT_Set_HistoryCommit(writer, 0, 3600);
+  EXPECT_EQ(SLINPUT_AttachHistory(writer, path), 0);
+  EXPECT_EQ(SLINPUT_Save(writer, L"a"), 1);
+  EXPECT_EQ(SLINPUT_Save(writer, L"b"), 2);
+  SLINPUT_DestroyState(writer);
+
+  SLINPUT_State *states[3];
+  for (SLINPUT_State *&state : states) {
+    state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+    ASSERT_TRUE(state);
+    SLINPUT_Set_Streams(state, stream, stream);
+    InitState(state);
+    SLINPUT_Set_HistoryShared(state, 1);
+    SLINPUT_Set_HistoryCommit(state, 0, 3600);
+    EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  }
+  SLINPUT_State *compactor = states[0];
+  SLINPUT_State *other = states[1];
+  writer = states[2];
+
+  EXPECT_EQ(SLINPUT_Save(compactor, L"c"), 1);
+  EXPECT_EQ(SLINPUT_Save(compactor, L"a"), 2);
+  EXPECT_EQ(SLINPUT_Save(other, L"d"), 3);
+
+  /* The other state has not read "f" when the file is compacted */
+  EXPECT_EQ(SLINPUT_Save(writer, L"f"), 4);
+  EXPECT_EQ(SLINPUT_CompactHistory(compactor, 100), 0);
+  EXPECT_EQ(FileSize(path), 8 + 5*13);
+  EXPECT_EQ(SLINPUT_Save(writer, L"g"), 5);
+
+  auto browse = [&](SLINPUT_State *state, int32_t num_up) {
+    sli_char buffer[40];
+    for (int32_t i = 0; i < num_up; ++i)
+      input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+    EXPECT_GT(SLINPUT_Get(state, L"> ", nullptr,
+      sizeof(buffer)/sizeof(buffer[0]), buffer), 0);
+    return std::wstring(buffer);
+  };
+
+  /* The other state saved "d" before reading "c" and "a" */
+  const sli_char *lines[] = { L"g", L"f", L"d", L"a", L"c", L"b", L"b" };
+  const sli_char *other_lines[] =
+    { L"g", L"f", L"a", L"c", L"d", L"b", L"b" };
+  for (int32_t i = 1; i < 8; ++i) {
+    EXPECT_EQ(browse(compactor, i), lines[i - 1]);
+    EXPECT_EQ(browse(other, i), other_lines[i - 1]);
+  }
+
+  for (SLINPUT_State *state : states)
+    SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test incremental reverse search of history */
+TEST_F(SingleLineInput, HistorySearch) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 60;
+
+  EXPECT_EQ(SLINPUT_Save(state, L"make all"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls -l"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 4);
+  EXPECT_EQ(SLINPUT_Save(state, L"make test"), 5);
+
+  input_.push_back( KeyInput { SLINPUT_KC_SEARCH_BACKWARD, L'\0' } );
+  for (const sli_char *ptr = L"ma"; *ptr; ++ptr)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *ptr } );
+  for (const sli_char *ptr = L"ke c"; *ptr; ++ptr)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *ptr } );
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_SEARCH_BACKWARD, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_SEARCH_BACKWARD, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 8);
+  EXPECT_STREQ(buffer, L"make all");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Search started */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`':  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Query typed, narrowing the matches */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`m':  [SLINPUT_CCC_SAVE_CURSOR]make test [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`ma':  [SLINPUT_CCC_SAVE_CURSOR]make test [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`mak':  [SLINPUT_CCC_SAVE_CURSOR]make test [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`make':  [SLINPUT_CCC_SAVE_CURSOR]make test [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`make ':  [SLINPUT_CCC_SAVE_CURSOR]make test [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`make c':  [SLINPUT_CCC_SAVE_CURSOR]make clean [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspace */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`make ':  [SLINPUT_CCC_SAVE_CURSOR]make clean [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Search backward for older matches */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](reverse-i-search)`make ':  [SLINPUT_CCC_SAVE_CURSOR]make all [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](failing reverse-i-search)`make ':  [SLINPUT_CCC_SAVE_CURSOR]make all [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Enter ends the search */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]make all [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistoryPrefixBrowse) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_HistoryPrefixBrowse(state, 1);
+
+  EXPECT_EQ(SLINPUT_Save(state, L"make all"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls -l"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 4);
+
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'a' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 10);
+  EXPECT_STREQ(buffer, L"make clean");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Prefix typed */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]m[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]a[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Up through the lines starting with the prefix, cursor kept after it */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ma[SLINPUT_CCC_SAVE_CURSOR]ke clean [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ma[SLINPUT_CCC_SAVE_CURSOR]ke all [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Nothing older, then down to the newer line and past it to the prefix */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ma[SLINPUT_CCC_SAVE_CURSOR]ke clean [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ma[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Up again */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  ma[SLINPUT_CCC_SAVE_CURSOR]ke clean [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  /* Lines saved after the index is built are found too */
+  EXPECT_EQ(SLINPUT_Save(state, L"make test"), 5);
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 10);
+  EXPECT_STREQ(buffer, L"make clean");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test the history file is added to the prefix index as browsing needs it */
+TEST_F(SingleLineInput, HistoryPrefixLoad) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  const TempFile temp_file;
+  ASSERT_TRUE(temp_file.Created());
+  const char *path = temp_file.Path();
+
+  /* Earlier session, the line sought followed by more than a load of others */
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_GT(SLINPUT_Save(state, L"make old"), 0);
+  for (int32_t i = 0; i < 800; ++i)
+    EXPECT_GT(SLINPUT_Save(state, (L"echo " + std::to_wstring(i)).c_str()),
+      0);
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+
+  /* Later session, keys waiting so nothing is loaded while idle */
+  state = SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_HistoryPrefixBrowse(state, 1);
+  EXPECT_EQ(SLINPUT_AttachHistory(state, path), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"make new"), 1);
+
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 8);
+  EXPECT_STREQ(buffer, L"make old");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test lines saved in the current context are browsed and ranked first */
+TEST_F(SingleLineInput, HistoryContext) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  EXPECT_EQ(SLINPUT_Save(state, L"date"), 1);
+  SLINPUT_Set_HistoryContext(state, 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 2);
+  SLINPUT_Set_HistoryContext(state, 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 3);
+  SLINPUT_Set_HistoryContext(state, 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make test"), 4);
+  SLINPUT_Set_HistoryContext(state, 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"pwd"), 5);
+  SLINPUT_Set_HistoryContext(state, 1);
+
+  /* Up through the context, then the rest of history; down from the newest
+  of the rest returns to the oldest line of the context */
+  for (int32_t i = 0; i < 5; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  for (int32_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_DOWN, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 4);
+  EXPECT_STREQ(buffer, L"make");
+
+  /* Switching context browses its lines first */
+  SLINPUT_Set_HistoryContext(state, 2);
+  for (int32_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 9);
+  EXPECT_STREQ(buffer, L"make test");
+
+  /* An equal fuzzy match from the current context ranks first */
+  SLINPUT_Set_HistoryContext(state, 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd a"), 6);
+  SLINPUT_Set_HistoryContext(state, 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"cd b"), 7);
+  SLINPUT_Set_HistoryContext(state, 1);
+  SLINPUT_HistoryMatch matches[1];
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"cd", 1, matches), 1);
+  EXPECT_EQ(matches[0].age, 1u);
+
+  /* The newest line of the context extending the line is suggested */
+  SLINPUT_Set_HistoryContext(state, 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 8);
+  SLINPUT_Set_HistoryContext(state, 1);
+  SLINPUT_Set_HistorySuggest(state, 1);
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'm' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'a' } );
+  input_.push_back( KeyInput { SLINPUT_KC_END, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 9);
+  EXPECT_STREQ(buffer, L"make test");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/* Test a context is dropped from the index with the last of its lines */
+TEST_F(SingleLineInput, HistoryContextDrop) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 4), 0);
+  SLINPUT_Set_HistoryContext(state, 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 1);
+
+  /* Browsing in the context builds the index */
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 4);
+  EXPECT_STREQ(buffer, L"make");
+
+  /* Each line in a context of its own, only the newest four in the ring */
+  for (int32_t i = 0; i < 1000; ++i) {
+    swprintf(buffer, sizeof(buffer)/sizeof(buffer[0]), L"ls %d", i);
+    SLINPUT_Set_HistoryContext(state, static_cast<unsigned long>(i + 2));
+    EXPECT_EQ(SLINPUT_Save(state, buffer), i < 3 ? i + 2 : 4);
+  }
+  EXPECT_LT(SLINPUT_GetHistoryBytes(state), 16384u);
+
+  /* A context still in the ring browses its line first */
+  SLINPUT_Set_HistoryContext(state, 999);
+  input_.push_back( KeyInput { SLINPUT_KC_UP, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"ls 997");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistorySuggest) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_HistorySuggest(state, 1);
+  terminal_width_ = 30;
+
+  EXPECT_EQ(SLINPUT_Save(state, L"make all"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 3);
+
+  for (const sli_char *ptr = L"make a"; *ptr; ++ptr)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *ptr } );
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'x' } );
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_END, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 10);
+  EXPECT_STREQ(buffer, L"make clean");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Typing shows the newest line extending the line, dimmed */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]m[SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]ake clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]a[SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]ke clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]k[SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]e clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON] clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]a[SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]ll[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspace */
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* No line extends the line, so the suggestion is cleared */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]x[SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspace */
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR][SLINPUT_CCC_DIM_ON]clean[SLINPUT_CCC_DIM_OFF] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* End accepts the suggestion */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  make clean[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistoryFuzzySearch) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  terminal_width_ = 60;
+
+  EXPECT_EQ(SLINPUT_Save(state, L"git commit -m"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"git checkout main"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"grep -r todo"), 4);
+
+  input_.push_back( KeyInput { SLINPUT_KC_SEARCH_FUZZY, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'g' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'c' } );
+  input_.push_back( KeyInput { SLINPUT_KC_SEARCH_FUZZY, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'o' } );
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  sli_char buffer[40];
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 13);
+  EXPECT_STREQ(buffer, L"git commit -m");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Fuzzy search started */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](fuzzy-search)`':  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Query typed, showing the best match, newest first for equal scores */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](fuzzy-search)`g':  [SLINPUT_CCC_SAVE_CURSOR]grep -r todo [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](fuzzy-search)`gc':  [SLINPUT_CCC_SAVE_CURSOR]git checkout main [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Next best match */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](fuzzy-search)`gc':  [SLINPUT_CCC_SAVE_CURSOR]git commit -m [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Consecutive characters rank higher */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE](fuzzy-search)`gco':  [SLINPUT_CCC_SAVE_CURSOR]git commit -m [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Enter ends the search */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]git commit -m [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistoryMatch) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+
+  EXPECT_EQ(SLINPUT_Save(state, L"git commit -m"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make clean"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"git checkout main"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"grep -r todo"), 4);
+
+  /* Best first, equal scores newest first */
+  SLINPUT_HistoryMatch matches[2];
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"gc", 2, matches), 2);
+  EXPECT_EQ(matches[0].age, 1u);
+  EXPECT_EQ(matches[1].age, 3u);
+  EXPECT_EQ(matches[0].score, matches[1].score);
+
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"gco", 2, matches), 2);
+  EXPECT_EQ(matches[0].age, 3u);
+  EXPECT_EQ(matches[1].age, 1u);
+  EXPECT_GT(matches[0].score, matches[1].score);
+
+  /* Only the best are kept */
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"e", 1, matches), 1);
+  EXPECT_EQ(matches[0].age, 0u);
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"xyz", 2, matches), 0);
+
+  sli_char buffer[8];
+  EXPECT_EQ(SLINPUT_GetHistory(state, 2,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 7);
+  EXPECT_STREQ(buffer, L"make cl");
+  EXPECT_EQ(SLINPUT_GetHistory(state, 4,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), -1);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/** Task runner data for SLINPUT_TaskInfo */
+typedef struct TaskData {
+  size_t num_runs;  /**< Number of times the runner was called */
+  size_t num_tasks;  /**< Number of tasks run */
+} TaskData;
+
+/* Runs the tasks last first, as a thread pool might */
+static int RunTasksReversed(const SLINPUT_State *, SLINPUT_TaskInfo task_info,
+    SLINPUT_Task *task, void *task_data, size_t num_tasks) {
+  TaskData *data = static_cast<TaskData *>(task_info.task_info_data);
+  ++data->num_runs;
+  data->num_tasks += num_tasks;
+  while (num_tasks)
+    task(task_data, --num_tasks);
+
+  return 0;
+}
+
+TEST_F(SingleLineInput, HistoryMatchTasks) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 3000), 0);
+
+  /* Enough lines for the ring to be split into three shards */
+  for (int line = 0; line < 2500; ++line) {
+    std::wstring text = L"echo " + std::to_wstring(line);
+    if (line == 10 || line == 2000)
+      text += L" needle";
+    EXPECT_GT(SLINPUT_Save(state, text.c_str()), 0);
+  }
+
+  SLINPUT_HistoryMatch serial[3];
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"needle", 3, serial), 2);
+  EXPECT_EQ(serial[0].age, 499u);
+  EXPECT_EQ(serial[1].age, 2489u);
+
+  /* The shards merge to the same matches, whatever order they run in */
+  TaskData task_data = { 0, 0 };
+  SLINPUT_TaskInfo task_info = { &task_data };
+  SLINPUT_Set_RunTasks(state, task_info, RunTasksReversed);
+  SLINPUT_HistoryMatch reversed[3];
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"needle", 3, reversed), 2);
+  EXPECT_EQ(task_data.num_runs, 1u);
+  EXPECT_EQ(task_data.num_tasks, 3u);
+  for (size_t index = 0; index < 2; ++index) {
+    EXPECT_EQ(reversed[index].age, serial[index].age);
+    EXPECT_EQ(reversed[index].score, serial[index].score);
+  }
+
+  /* The runner is given at most 16 shards at a time */
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 20000), 0);
+  for (int line = 2500; line < 17500; ++line) {
+    std::wstring text = L"echo " + std::to_wstring(line);
+    EXPECT_GT(SLINPUT_Save(state, text.c_str()), 0);
+  }
+  task_data.num_runs = 0;
+  task_data.num_tasks = 0;
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"needle", 3, reversed), 2);
+  EXPECT_EQ(task_data.num_runs, 2u);
+  EXPECT_EQ(task_data.num_tasks, 18u);
+  EXPECT_EQ(reversed[0].age, 15499u);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistoryFrecency) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 3);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 4);
+  EXPECT_EQ(SLINPUT_Save(state, L"make test"), 5);
+  EXPECT_EQ(SLINPUT_Save(state, L"git status"), 6);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 7);
+
+  /* Each line once, the most used first */
+  SLINPUT_HistoryMatch matches[8];
+  EXPECT_EQ(SLINPUT_FrecentHistory(state, 3, matches), 3);
+  EXPECT_EQ(matches[0].age, 1u);
+  EXPECT_EQ(matches[1].age, 0u);
+  EXPECT_EQ(matches[2].age, 2u);
+  EXPECT_GT(matches[0].score, matches[1].score);
+  EXPECT_GT(matches[1].score, matches[2].score);
+  EXPECT_EQ(SLINPUT_FrecentHistory(state, 8, matches), 4);
+  EXPECT_EQ(matches[3].age, 6u);
+
+  /* Entering the newest line again is a use */
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 7);
+  EXPECT_EQ(SLINPUT_FrecentHistory(state, 1, matches), 1);
+  EXPECT_EQ(matches[0].age, 0u);
+
+  /* Frecency breaks the tie between equal fuzzy matches */
+  EXPECT_EQ(SLINPUT_Save(state, L"git checkout main"), 8);
+  for (int use = 0; use < 4; ++use) {
+    EXPECT_EQ(SLINPUT_Save(state, L"ls"), 9 + 2*use);
+    EXPECT_EQ(SLINPUT_Save(state, L"git checkout main"), 10 + 2*use);
+  }
+  EXPECT_EQ(SLINPUT_Save(state, L"git commit -m"), 17);
+  EXPECT_EQ(SLINPUT_MatchHistory(state, L"gc", 2, matches), 2);
+  EXPECT_EQ(matches[0].age, 1u);
+  EXPECT_EQ(matches[1].age, 0u);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, HistoryFrecencyNoTable) {
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+
+  /* Without memory for the hash table of 32 lines, lines are still saved */
+  fail_alloc_size_ = 64*sizeof(size_t);
+  EXPECT_EQ(SLINPUT_Set_HistoryCapacity(state, 32), 0);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 1);
+  EXPECT_EQ(SLINPUT_Save(state, L"make"), 2);
+  EXPECT_EQ(SLINPUT_Save(state, L"ls"), 3);
+
+  /* Erasing duplicates needs the table */
+  SLINPUT_Set_HistoryEraseDuplicates(state, 1);
+  EXPECT_LT(SLINPUT_Save(state, L"pwd"), 0);
+  SLINPUT_Set_HistoryEraseDuplicates(state, 0);
+
+  /* Once the table is built, each line is ranked once */
+  fail_alloc_size_ = 0;
+  EXPECT_EQ(SLINPUT_Save(state, L"pwd"), 4);
+  SLINPUT_HistoryMatch matches[4];
+  EXPECT_EQ(SLINPUT_FrecentHistory(state, 4, matches), 3);
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+/** Completion data for SLINPUT_CompletionInfo */
+typedef struct CompletionData {
+  uint32_t value;  /**< Holds value to check during completion test */
+} CompletionData;
+
+static int CompletionRequest(SLINPUT_State *state,
+    SLINPUT_CompletionInfo completion_info, uint16_t string_length,
+    const sli_char *string) {
+  EXPECT_EQ(wcslen(string), string_length);
+
+  CompletionData *completion_data =
+    static_cast<CompletionData *>(completion_info.completion_info_data);
+  EXPECT_EQ(completion_data->value, 42u);
+
+  if (wcscmp(string, L"One ") == 0) {
+    /* User would be promted here with options which would output text. */
+    /* Therefore replace with same line to cause a redraw. */
+    SLINPUT_CompletionReplace(state, string);
+  } else if (wcscmp(string, L"One Two ") == 0) {
+    SLINPUT_CompletionReplace(state, L"One Two Three");
+  }
+
+  return 0;
+}
+
+TEST_F(SingleLineInput, TabCommandCompletion) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  CompletionData completion_data;
+  completion_data.value = 42;
+  SLINPUT_CompletionInfo completion_info = { &completion_data };
+  SLINPUT_Set_CompletionRequest(state, completion_info, CompletionRequest);
+  SLINPUT_Set_LeaveRaw(state, LeaveRawIn);
+
+  /* Characters */
+  const sli_char *first_input = L"One ";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Trigger command completion */
+  input_.push_back( KeyInput { SLINPUT_KC_TAB, L'\0' } );
+
+  const sli_char *second_input = L"Two ";
+  while (*second_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *second_input++ } );
+
+  /* Trigger command completion */
+  input_.push_back( KeyInput { SLINPUT_KC_TAB, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 13);
+  EXPECT_STREQ(buffer, L"One Two Three");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]O[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Line redrawn */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]T[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]w[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Command completion replace */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One Two Three[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]"
+  );
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, InitialString) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[256];
+  terminal_width_ = 20;
+
+  /* Characters followed by new line */
+  const sli_char *input = L"String\n";
+  while (*input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *input++ } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", L"Initial ",
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 14);
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Initial [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]S[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]r[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]i[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]g[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]"
+  );
+
+  /* Produces the characters */
+  EXPECT_STREQ(buffer, L"Initial String");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, UndoEscape) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Characters */
+  const sli_char *first_input = L"Simple";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Escape then undo */
+  input_.push_back( KeyInput { SLINPUT_KC_ESCAPE, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_UNDO, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"Simple");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]S[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]i[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]m[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]p[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]l[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Escape clears the buffer */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Undo restores the buffer */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  Simple[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, UndoRedoCoalescedInput) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Characters */
+  const sli_char *first_input = L"One two";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Backspace three times */
+  for (int16_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+
+  /* Undo the backspaces, then the coalesced input */
+  for (int16_t i = 0; i < 4; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_UNDO, L'\0' } );
+
+  /* Nothing further to undo */
+  input_.push_back( KeyInput { SLINPUT_KC_UNDO, L'\0' } );
+
+  /* Redo the coalesced input */
+  input_.push_back( KeyInput { SLINPUT_KC_REDO, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 7);
+  EXPECT_STREQ(buffer, L"One two");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]O[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]w[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspaces */
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Undo the backspaces */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One tw[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One two[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Undo the coalesced input */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Redo the coalesced input */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One two[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, KillAndYankPop) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Characters */
+  const sli_char *first_input = L"One two three";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Kill the last word, then the rest of the line */
+  input_.push_back( KeyInput { SLINPUT_KC_KILL_WORD, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_KILL_TO_START, L'\0' } );
+
+  /* Yank the newest kill, then replace it with the older kill */
+  input_.push_back( KeyInput { SLINPUT_KC_YANK, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_YANK_POP, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 5);
+  EXPECT_STREQ(buffer, L"three");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]O[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]w[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]h[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]r[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Kill word */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One two [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Kill to start */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Yank */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One two [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Yank pop */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  three[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, KillToEndAndYank) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Characters */
+  const sli_char *first_input = L"One two";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Cursor left three times */
+  for (int16_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_LEFT, L'\0' } );
+
+  /* Kill to the end of the line, then yank it back */
+  input_.push_back( KeyInput { SLINPUT_KC_KILL_TO_END, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_YANK, L'\0' } );
+
+  /* Yank pop with a single kill does nothing */
+  input_.push_back( KeyInput { SLINPUT_KC_YANK_POP, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 7);
+  EXPECT_STREQ(buffer, L"One two");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]O[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]n[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR] [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]t[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]w[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR][SLINPUT_CCC_CURSOR_LEFT][SLINPUT_CCC_CURSOR_LEFT][SLINPUT_CCC_CURSOR_LEFT]"
+    /* Kill to end */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Yank */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  One two[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, WideCharacters) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 12;
+
+  /* Wide characters occupy two columns */
+  const sli_char *first_input = L"\x65E5\x672C\x8A9E" L"ab";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Cursor left three times, over a wide character */
+  for (int16_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_LEFT, L'\0' } );
+
+  /* Backspace over a wide character */
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+
+  /* Cursor right over a narrow and wide character */
+  for (int16_t i = 0; i < 2; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_RIGHT, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 4);
+  EXPECT_STREQ(buffer, L"\x65E5\x8A9E" L"ab");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]\x65E5[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]\x672C[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]\x8A9E[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]a[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Scroll the line by a wide character */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  \x672C\x8A9E" L"ab[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Cursor left, two columns for the wide character */
+    L"[SLINPUT_CCC_CURSOR_LEFT][SLINPUT_CCC_CURSOR_LEFT][SLINPUT_CCC_CURSOR_LEFT][SLINPUT_CCC_CURSOR_LEFT]"
+    /* Backspace, two columns for the wide character */
+    L"\b\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR]\x8A9E" L"ab [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Cursor right, the whole line now fits */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  \x65E5\x8A9E[SLINPUT_CCC_SAVE_CURSOR]ab [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_CURSOR_RIGHT]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, WideCharacterCutOff) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+  SLINPUT_Set_ContinueCharLeft(state, L'<');
+  SLINPUT_Set_ContinueCharRight(state, L'>');
+
+  sli_char buffer[40];
+  terminal_width_ = 12;
+
+  /* Home displays the start of the line */
+  input_.push_back( KeyInput { SLINPUT_KC_HOME, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  /* The initial string is wider than the line */
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", L"ab\x65E5\x672C\x8A9E\x6F22",
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 6);
+  EXPECT_STREQ(buffer, L"ab\x65E5\x672C\x8A9E\x6F22");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]> <\x672C\x8A9E\x6F22[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Home, a space fills the column of the wide character cut off */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]ab\x65E5\x672C >[SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, CombiningCharacters) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Letters with combining acute accents */
+  const sli_char *first_input = L"ae\x0301" L"o\x0301";
+  while (*first_input)
+    input_.push_back( KeyInput { SLINPUT_KC_NUL, *first_input++ } );
+
+  /* Backspace deletes the letter and its accent */
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+
+  /* Cursor left over the letter and its accent */
+  input_.push_back( KeyInput { SLINPUT_KC_LEFT, L'\0' } );
+
+  /* Delete deletes the letter and its accent */
+  input_.push_back( KeyInput { SLINPUT_KC_DEL, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", nullptr,
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 1);
+  EXPECT_STREQ(buffer, L"a");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Key presses */
+    L"[SLINPUT_CCC_DISABLE_CURSOR]a[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]e[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]\x301[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]o[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    L"[SLINPUT_CCC_DISABLE_CURSOR]\x301[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspace, one column for the letter and its accent */
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Cursor left */
+    L"[SLINPUT_CCC_CURSOR_LEFT]"
+    /* Delete */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, EmojiSequences) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[40];
+  terminal_width_ = 20;
+
+  /* Home, cursor right over two flags then a zero width joiner sequence */
+  input_.push_back( KeyInput { SLINPUT_KC_HOME, L'\0' } );
+  for (int16_t i = 0; i < 3; ++i)
+    input_.push_back( KeyInput { SLINPUT_KC_RIGHT, L'\0' } );
+
+  /* Backspace deletes the whole zero width joiner sequence */
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  /* Flags GB and FR, then woman zero width joiner laptop */
+  EXPECT_EQ(SLINPUT_Get(state, L"> ",
+    L"\x1F1EC\x1F1E7\x1F1EB\x1F1F7\x1F469\x200D\x1F4BB" L"a",
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 5);
+  EXPECT_STREQ(buffer, L"\x1F1EC\x1F1E7\x1F1EB\x1F1F7" L"a");
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  \x1F1EC\x1F1E7\x1F1EB\x1F1F7\x1F469\x200D\x1F4BB" L"a[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Home */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]\x1F1EC\x1F1E7\x1F1EB\x1F1F7\x1F469\x200D\x1F4BB" L"a [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Cursor right, one column per flag and two for the sequence */
+    L"[SLINPUT_CCC_CURSOR_RIGHT][SLINPUT_CCC_CURSOR_RIGHT][SLINPUT_CCC_CURSOR_RIGHT][SLINPUT_CCC_CURSOR_RIGHT]"
+    /* Backspace */
+    L"\b\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR]a [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
+
+  SLINPUT_DestroyState(state);
+  EXPECT_EQ(allocated_memory_, 0);
+}
+
+TEST_F(SingleLineInput, LongLineOfWideCharacters) {
+  SLINPUT_Stream stream = { this };
+  SLINPUT_AllocInfo alloc_info = { this };
+  SLINPUT_State *state =
+    SLINPUT_CreateState(alloc_info, MallocIn, FreeIn);
+  ASSERT_TRUE(state);
+  SLINPUT_Set_Streams(state, stream, stream);
+  InitState(state);
+
+  sli_char buffer[256];
+  terminal_width_ = 20;
+
+  /* Spans several blocks of column sums */
+  std::wstring initial = L"a";
+  for (int16_t i = 0; i < 100; ++i)
+    initial += (i % 10 == 9) ? L'0' + (i / 10) : L'\x65E5';
+
+  /* Home, end, then backspace and delete at the start */
+  input_.push_back( KeyInput { SLINPUT_KC_HOME, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_END, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_BACKSPACE, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_HOME, L'\0' } );
+  input_.push_back( KeyInput { SLINPUT_KC_DEL, L'\0' } );
+
+  /* End input */
+  input_.push_back( KeyInput { SLINPUT_KC_NUL, L'\n' } );
+
+  EXPECT_EQ(SLINPUT_Get(state, L"> ", initial.c_str(),
+    sizeof(buffer)/sizeof(buffer[0]), buffer), 99);
+  EXPECT_STREQ(buffer, initial.substr(1, 99).c_str());
+
+  EXPECT_STREQ(output_.c_str(),
+    /* Line wrap off */
+    L"[SLINPUT_CCC_WRAP_OFF]"
+    /* ApplyDimension and RedrawLine */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  \x65E5\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5" L"9[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Home */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]a\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5 [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* End */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  \x65E5\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5" L"9[SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Backspace */
+    L"\b[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR] [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Home */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_LINE]>  [SLINPUT_CCC_SAVE_CURSOR]a\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5 [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* Delete, a space fills the column of the wide character cut off */
+    L"[SLINPUT_CCC_DISABLE_CURSOR][SLINPUT_CCC_CLEAR_TO_END_OF_LINE][SLINPUT_CCC_SAVE_CURSOR]\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5\x65E5  [SLINPUT_CCC_RESTORE_CURSOR][SLINPUT_CCC_ENABLE_CURSOR]"
+    /* New line */
+    L"\n"
+    /* Line wrap on */
+    L"[SLINPUT_CCC_WRAP_ON]");
 
   SLINPUT_DestroyState(state);
   EXPECT_EQ(allocated_memory_, 0);